@@ -5,14 +5,14 @@
 #include "ES_Types.h"
 #include "ES_Events.h"
 
-void ResetEncryptionIndex(void);
+// ES_SENDPACKET carries the packet type in the low byte and the PeerTable
+// slot of the DOG it is for in the high byte
+#define SENDPACKET_PARAM(Type, Slot) ((uint16_t)(((Slot) << 8) | (Type)))
+#define SENDPACKET_TYPE(Param)       ((uint8_t)((Param) & 0xFF))
+#define SENDPACKET_SLOT(Param)       ((uint8_t)((Param) >> 8))
 
 bool InitComm_Service ( uint8_t Priority );
 bool PostComm_Service( ES_Event ThisEvent );
 ES_Event RunComm_Service( ES_Event ThisEvent );
 
-/***getter***/
-uint8_t* GetDataPacket_Tx (void);
-uint8_t* GetIMUData(void);
-
 #endif 
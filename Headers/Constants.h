@@ -35,14 +35,9 @@
 #define FARMER_DOG_ENCR_KEY       0x03
 #define FARMER_DOG_CTRL           0x04
 #define DOG_FARMER_RESET_ENCR     0x05
+#define FARMER_DOG_CTRL_AGG       0x06 // several CTRL samples in one packet, see PacketCodec.h
 
-//Data Packet Lengths (API ID + Frame ID + Dest bytes + Options + RF data)
-#define REQ_2_PAIR_LENGTH					7
-#define PAIR_ACK_LENGTH						6
-#define	ENCR_KEY_LENGTH						38
-#define CTRL_LENGTH								9
-#define	ENCR_RESET_LENGTH					6
-#define STATUS_LENGTH							18
+//Data Packet Lengths come from PACKET_SCHEMA in PacketCodec.h
 
 //Data Packet Array
 #define FRAME_ID                  0x01
@@ -54,9 +49,33 @@
 #define START_DELIMITER 					0x7E
 #define OPTIONS										0x00
 
-#define PAIR_ACK_FRAME_LENGTH     6
 #define HEADER_LENGTH							3
 
+// AT commands, used by XBeeLink to set up the radio
+#define API_IDENTIFIER_AT         0x08 // apply now
+#define API_IDENTIFIER_AT_Queue   0x09 // hold until AC
+#define API_IDENTIFIER_AT_Response 0x88
+#define AT_COMMAND_BYTE_INDEX_RX  2
+#define AT_STATUS_BYTE_INDEX      4
+#define AT_HEADER_LENGTH          4 // API ID, frame ID, two command letters
+#define API_MODE_NO_ESCAPES       1
+
+// XBee BD parameter values, also index UART.c's divisor table
+#define XBEE_BD_9600              3
+#define XBEE_BD_115200            7
+#define NUM_XBEE_BAUDS            8
+#define LINK_TARGET_BD            XBEE_BD_115200
+#define XBEE_D6_RTS               1   // DIO6 as RTS flow control
+
+// send whole frames to UART5 with the uDMA, comment out to fall back to
+// one byte per ES_BYTE_SENT
+#define UART_TX_DMA
+
+// hold the XBee off with its RTS line (PD6 to DIO6) while the RX queue is
+// backing up, so it keeps frames in its own buffer instead of us dropping
+// them. Comment out to leave RTS alone and drop on a full queue
+//#define UART_RX_FLOW
+
 //Tx Packet
 #define START_BYTE_INDEX					0
 #define LENGTH_MSB_BYTE_INDEX			1
@@ -91,8 +110,42 @@
 //Timers
 #define ONE_SEC										976
 //#define GAME_TIME									218*ONE_SEC
-#define INTER_MESSAGE_TIME				300	// FARMER transmits a packet every 300 ms 
+#define INTER_MESSAGE_TIME				300	// FARMER transmits a packet every 300 ms to start with
+#define INTER_MESSAGE_MIN_TIME		100	// LinkStats speeds that up to this on a clean link
+#define INTER_MESSAGE_MAX_TIME		600	// and backs off to this, MAX_PEERS of these fit in LOST_COMM_TIME
 #define LOST_COMM_TIME						3*ONE_SEC // DOG+FARMER unpair if no message received after 1 second
+// send CTRL as soon as the inputs change, with a heartbeat in between,
+// rather than one CTRL every LinkStats interval; looks at the inputs every
+// CTRL_SAMPLE_TIME, so it trades a faster tick for fewer packets on air
+//#define CTRL_ON_CHANGE
+#define CTRL_SAMPLE_TIME					20	// ms between looks at the inputs
+#define CTRL_HEARTBEAT_TIME				500	// longest a DOG goes without a CTRL, well inside its lost comm time
+#define CTRL_DEADBAND							4		// accelerometer counts that don't count as a change
+// send the last few samples in each control packet (FARMER_DOG_CTRL_AGG)
+// instead of just the newest; only for DOGs that understand it
+//#define CTRL_AGGREGATE
+// start every control packet with the key index it was encrypted from, in
+// the clear, so a lost frame doesn't put the DOG out of step; only for DOGs
+// that understand it, the others count the index themselves
+//#define CTRL_KEY_INDEX
+// send control packets only in our own slot of a TDMA_FRAME_TIME cycle, so
+// FARMERs sharing the channel take turns instead of colliding at random
+//#define CTRL_SLOTTED
+#define TDMA_FRAME_TIME						100
+#define TDMA_SLOTS								10
+#define TDMA_SLOT_TIME						(TDMA_FRAME_TIME / TDMA_SLOTS)
+#define TDMA_HOP_FAILS						2		// failed CTRLs in a row that move us to another slot
+#define LOST_COMM_SLACK						(ONE_SEC/10) // lost comm may be declared up to 100 ms late
+// REQ2PAIR is repeated until a DOG answers or PAIR_WINDOW_TIME runs out,
+// the wait doubling from PAIR_RETRY_BASE_TIME up to PAIR_RETRY_MAX_TIME
+// with up to half of it random so FARMERs pairing at once drift apart
+#define PAIR_WINDOW_TIME					LOST_COMM_TIME
+#define PAIR_RETRY_BASE_TIME			40
+#define PAIR_RETRY_MAX_TIME				320
+// a DOG we lose keeps its address, key and key index this long, and is
+// asked to come back with a unicast REQ2PAIR every RESUME_RETRY_TIME
+#define SESSION_GRACE_TIME				(10*ONE_SEC)
+#define RESUME_RETRY_TIME					200
 
 //Interrupts
 #define PRIORITY_0 								0
@@ -0,0 +1,72 @@
+/****************************************************************************
+
+  Header file for the host DOG simulator, only built with ES_HOST_BUILD
+
+ ****************************************************************************/
+
+#ifndef DogSim_H
+#define DogSim_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DOGSIM_MAX_DOGS     4
+#define DOGSIM_MAX_FARMERS  8     // other FARMERs on the channel
+#define DOGSIM_MAX_SAMPLES  4096  // latency samples kept per run for the percentiles
+
+typedef struct {
+	uint32_t DurationMs;
+	uint8_t NumDogs;                      // 1 .. DOGSIM_MAX_DOGS
+	uint8_t DogTags[DOGSIM_MAX_DOGS];     // tag each DOG answers REQ_2_PAIR for, 0 for any
+	uint16_t LossPermille;                // each over the air attempt, either way
+	uint16_t LatencyMs;                   // one way, radio and XBee
+	uint16_t JitterMs;                    // 0 .. this added to LatencyMs
+	uint16_t ReportPeriodMs;              // DOG_FARMER_REPORT while paired
+	uint32_t ResetEncrEveryMs;            // a DOG asks for an encryption reset this often, 0 never
+	uint32_t OutageStartMs;               // everything lost for OutageMs from here
+	uint32_t OutageMs;                    // 0 for no outage
+	uint16_t PairRetryMs;                 // press pair again this long after a DOG is left unpaired
+	uint8_t OtherFarmers;                 // 0 .. DOGSIM_MAX_FARMERS sharing the channel
+	uint16_t OtherPeriodMs;               // each sends this often, free running, plus up to a quarter of it
+	uint16_t OtherAirMs;                  // how long each of their exchanges holds the channel
+	bool OthersSlotted;                   // they send in slots 0, 1, .. of a TDMA_FRAME_TIME cycle instead
+	uint32_t Seed;
+} DogSimScenario_t;
+
+typedef struct {
+	uint32_t Count;
+	uint32_t P50;
+	uint32_t P90;
+	uint32_t P99;
+	uint32_t Max;
+} DogSimPercentiles_t;
+
+typedef struct {
+	uint32_t FramesToDogs;     // TX API frames from the FARMER, AT commands not included
+	uint32_t TxStatusFailed;   // of those, unicasts the XBee reported as not delivered
+	uint32_t Collisions;       // attempts either way lost to another FARMER's traffic
+	uint32_t CtrlSent;         // control packets on the wire, CTRL and CTRL_AGG
+	uint32_t CtrlReceived;     // decrypted cleanly by a DOG
+	uint32_t CtrlBadKey;       // arrived but did not decrypt to a control packet
+	uint32_t CtrlIndexJumps;   // carried a key index other than the one the DOG expected
+	uint32_t ResetEncrSent;
+	uint32_t ReportsSent;
+	uint32_t ReportsLost;      // every attempt lost in the air
+	uint32_t Pairings;         // DOG received its key
+	uint32_t FirstPairMs;      // from the first REQ_2_PAIR to the first DOG with a key, 0 if never
+	uint32_t ReconnectMs;      // end of the outage to the next clean CTRL, 0 if n/a
+	float LossPercent;         // control packets and reports that never made it
+	DogSimPercentiles_t PairMs;       // REQ_2_PAIR to key, every pairing
+	DogSimPercentiles_t CtrlGapMs;    // between clean CTRLs at a DOG
+	DogSimPercentiles_t CtrlLatencyMs;// off the FARMER's UART to decrypted at the DOG
+} DogSimResult_t;
+
+// run once per simulated ms; the host program ticks the ES timers and runs
+// the services from here
+typedef void (*DogSimStep_t)(void);
+
+void DogSim_Init(const DogSimScenario_t *pScenario);
+void DogSim_Poll(uint32_t NowMs);
+void DogSim_RunScenario(const DogSimScenario_t *pScenario, DogSimStep_t Step, DogSimResult_t *pResult);
+
+#endif /* DogSim_H */
@@ -30,7 +30,7 @@
 /****************************************************************************/
 // This macro determines that nuber of services that are *actually* used in
 // a particular application. It will vary in value from 1 to MAX_NUM_SERVICES
-#define NUM_SERVICES 6
+#define NUM_SERVICES 7
 
 /****************************************************************************/
 // These are the definitions for Service 0, the lowest priority service.
@@ -119,11 +119,11 @@
 // These are the definitions for Service 6
 #if NUM_SERVICES > 6
 // the header file with the public function prototypes
-#define SERV_6_HEADER "TestHarnessService6.h"
+#define SERV_6_HEADER "XBeeLink.h"
 // the name of the Init function
-#define SERV_6_INIT InitTestHarnessService6
+#define SERV_6_INIT InitXBeeLink
 // the name of the run function
-#define SERV_6_RUN RunTestHarnessService6
+#define SERV_6_RUN RunXBeeLink
 // How big should this services Queue be?
 #define SERV_6_QUEUE_SIZE 3
 #endif
@@ -254,16 +254,20 @@ typedef enum {  ES_NO_EVENT = 0,
                 ES_INIT,   /* used to transition from initial pseudo-state */
                 ES_TIMEOUT, /* signals that the timer has expired */
                 ES_SHORT_TIMEOUT, /* signals that a short timer has expired */
+                ES_TIMEOUT_SET, /* several timers expired together, param is
+                                   the bit mask of the timer numbers */
                 /* User-defined events start here */
                 ES_NEW_KEY, /* signals a new key received from terminal */
 								//FARMER_SM pairing/unpairing requests
 								ES_UNPAIR, ES_PAIR,
 								// Transmit_SM events
-								ES_START_XMIT, ES_BYTE_SENT,
+								ES_START_XMIT, ES_BYTE_SENT, ES_TX_COMPLETE,
 								// Receive_SM events
 								ES_BYTE_RECEIVED, ES_DATAPACKET_RECEIVED,
 								// Comm_Service
 								ES_SENDPACKET,
+								// XBeeLink, param is (FrameID << 8) | status
+								ES_AT_RESPONSE,
 								// FARMER_SM received messages
 								ES_DOG_REPORT_RECEIVED, ES_DOG_ACK_RECEIVED, ES_DOG_RESET_ENCR_RECEIVED,
 								// Touch button debounce events
@@ -321,7 +325,7 @@ typedef enum {  ES_NO_EVENT = 0,
 // Unlike services, any combination of timers may be used and there is no
 // priority in servicing them
 #define TIMER_UNUSED ((pPostFunc)0)
-#define TIMER0_RESP_FUNC PostReceive_SM
+#define TIMER0_RESP_FUNC PostXBeeLink
 #define TIMER1_RESP_FUNC PostFARMER_SM
 #define TIMER2_RESP_FUNC PostTransmit_SM
 #define TIMER3_RESP_FUNC PostFARMER_SM
@@ -329,8 +333,8 @@ typedef enum {  ES_NO_EVENT = 0,
 #define TIMER5_RESP_FUNC PostTouch_SM
 #define TIMER6_RESP_FUNC PostNose_SM
 #define TIMER7_RESP_FUNC PostFARMER_SM
-#define TIMER8_RESP_FUNC TIMER_UNUSED
-#define TIMER9_RESP_FUNC TIMER_UNUSED
+#define TIMER8_RESP_FUNC PostFARMER_SM
+#define TIMER9_RESP_FUNC PostFARMER_SM
 #define TIMER10_RESP_FUNC TIMER_UNUSED
 #define TIMER11_RESP_FUNC TIMER_UNUSED
 #define TIMER12_RESP_FUNC TIMER_UNUSED
@@ -338,6 +342,23 @@ typedef enum {  ES_NO_EVENT = 0,
 #define TIMER14_RESP_FUNC TIMER_UNUSED
 #define TIMER15_RESP_FUNC TIMER_UNUSED
 
+/****************************************************************************/
+// These are the services that would rather get their timeouts batched. When
+// two or more timers that post to one of these functions expire on the same
+// tick, the service gets a single ES_TIMEOUT_SET event whose EventParam has
+// bit N set for each expired timer N, instead of one ES_TIMEOUT per timer.
+// A lone expiration is still delivered as a plain ES_TIMEOUT.
+// Should be a comma separated list of post functions from the list above.
+#define NUM_TIMEOUT_SET_SERVICES 1
+#if NUM_TIMEOUT_SET_SERVICES > 0
+#define TIMEOUT_SET_FUNCS PostFARMER_SM
+#endif
+
+/****************************************************************************/
+// The number of microsecond one-shot timers multiplexed onto the short timer
+// hardware (ES_ShortTimer.c). Up to 32.
+#define NUM_SHORT_TIMERS 8
+
 /****************************************************************************/
 // Give the timer numbers symbolc names to make it easier to move them
 // to different timers if the need arises. Keep these definitions close to the
@@ -345,7 +366,7 @@ typedef enum {  ES_NO_EVENT = 0,
 // the timer number matches where the timer event will be routed
 // These symbolic names should be changed to be relevant to your application 
 
-#define RECEIVE_TIMER 0
+#define LINK_TIMER 0
 #define GAME_TIMER 1
 #define TRANSMIT_TIMER 2
 #define INTER_MESSAGE_TIMER 3
@@ -353,5 +374,7 @@ typedef enum {  ES_NO_EVENT = 0,
 #define TOUCHDEBOUNCE_TIMER 5
 #define NOSEDEBOUNCE_TIMER 6
 #define DEBUG_TIMER 7
+#define PAIR_RETRY_TIMER 8
+#define SAMPLE_TIMER 9
 
 #endif /* CONFIGURE_H */
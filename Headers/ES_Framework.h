@@ -35,6 +35,9 @@ typedef enum {
 
 ES_Return_t ES_Initialize( TimerRate_t NewRate  );
 ES_Return_t ES_Run( void );
+#ifdef ES_HOST_BUILD
+ES_Return_t ES_RunPending( void );
+#endif
 bool ES_PostAll( ES_Event ThisEvent );
 bool ES_PostToService( uint8_t WhichService, ES_Event ThisEvent);
 bool ES_PostToServiceLIFO( uint8_t WhichService, ES_Event TheEvent);
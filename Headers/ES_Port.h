@@ -26,7 +26,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "termio.h"
-#include "bitdefs.h"       /* generic bit defs (BIT0HI, BIT0LO,...) */
+#include "BITDEFS.H"       /* generic bit defs (BIT0HI, BIT0LO,...) */
 #include "Bin_Const.h"     /* macros to specify binary constants in C */
 #include "ES_Types.h"
 
@@ -3,12 +3,39 @@
 #ifndef ES_ShortTimer_H
 #define ES_ShortTimer_H
 #include <stdint.h>
+#include <stdbool.h>
+
+// the timestamp counts system clock cycles, 40MHz
+#define ES_CYCLES_PER_US 40
+
+void ES_TimestampInit(void);
+uint32_t ES_GetCycles(void);
+uint32_t ES_GetMicros(void);
+
+#ifdef ES_HOST_BUILD
+// a simulation that runs faster than real time hands in its own clock
+typedef uint32_t (*ES_CycleSource_t)(void);
+void ES_SetCycleSource(ES_CycleSource_t Source);
+#endif
+
+#ifndef ES_HOST_BUILD
 #include "driverlib/timer.h"
 #include "ES_Configure.h"
+#include "ES_Timers.h"
 
 #define SHORT_TIMER_UNUSED MAX_NUM_SERVICES
 
+// the short timers used by the original 2 channel interface. Its timeouts
+// carry TIMER_A or TIMER_B as before, ES_ShortTimer_Start's carry the number
+#define SHORT_TIMER_A 0
+#define SHORT_TIMER_B 1
+
 void ES_ShortTimerInit(uint8_t TimeAPrio, uint8_t TimeBPrio);
 void ES_ShortTimerStart( uint32_t Which, uint16_t TimeoutValue);
+ES_TimerReturn_t ES_ShortTimer_Start(uint8_t Num, uint8_t WhichService,
+                                     uint32_t Micros);
+ES_TimerReturn_t ES_ShortTimer_Cancel(uint8_t Num);
+bool ES_ShortTimer_IsActive(uint8_t Num);
+#endif /* ES_HOST_BUILD */
 
 #endif //ES_ShortTimer_H
@@ -42,12 +42,16 @@ typedef enum { ES_Timer_ERR           = -1,
 } ES_TimerReturn_t;
 
 void             ES_Timer_Init(TimerRate_t Rate);
-void             ES_Timer_Tick_Resp(void);
+void             ES_Timer_Tick_Resp(uint8_t ElapsedTicks);
 ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint16_t NewTime);
+ES_TimerReturn_t ES_Timer_InitTimerSlack(uint8_t Num, uint16_t NewTime,
+                                         uint16_t Slack);
 ES_TimerReturn_t ES_Timer_SetTimer(uint8_t Num, uint16_t NewTime);
 ES_TimerReturn_t ES_Timer_StartTimer(uint8_t Num);
 ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num);
 uint16_t         ES_Timer_GetTime(void);
+uint32_t         ES_Timer_GetExpiredCount(void);
+uint32_t         ES_Timer_GetCoalescedCount(void);
 
 #endif   /* ES_Timers_H */
 /*------------------------------ End of file ------------------------------*/
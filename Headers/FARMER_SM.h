@@ -7,9 +7,9 @@
 
 typedef enum { Wait2Pair, Wait4PairResponse, Paired, Debug} FARMERState_t ;
 
-uint8_t* GetEncryptionKey(void);
 uint8_t GetDogTag(void);
 uint8_t* GetSensorData(void); // placeholder
+uint8_t* GetSensorSamples(void);
 
 bool InitFARMER_SM ( uint8_t Priority );
 bool PostFARMER_SM( ES_Event ThisEvent );
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifndef ES_HOST_BUILD
 // the headers to access the GPIO subsystem
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
@@ -29,6 +30,10 @@
 #include "driverlib/timer.h"
 #include "driverlib/interrupt.h"
 #include "driverlib/pwm.h"
+#else
+// HWREG and the pin names, for the host stand-in (HostHardware.c)
+#include "HostHardware.h"
+#endif
 #include "termio.h"
 
 #include "BITDEFS.H"
@@ -54,7 +59,7 @@
 
 
 //Port D
-
+#define RTS_PIN	BIT6HI	// XBee RTS (DIO6): PD6, low lets it send to us
 
 //Port E
 
@@ -0,0 +1,64 @@
+/****************************************************************************
+
+  Header file for the host stand-in for the Tiva GPIO and ADC, only built
+  with ES_HOST_BUILD. Takes the place of inc/hw_* and driverlib for the
+  modules that touch their pins directly with HWREG.
+
+ ****************************************************************************/
+
+#ifndef HostHardware_H
+#define HostHardware_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// every HWREG goes to a small register file instead of the bus
+#define HWREG(x) (*HostHW_Register(x))
+
+// the register addresses and bits the FARMER's modules use, same values as
+// inc/hw_memmap.h, inc/hw_gpio.h and inc/hw_sysctl.h
+#define GPIO_PORTA_BASE     0x40004000
+#define GPIO_PORTB_BASE     0x40005000
+#define GPIO_PORTD_BASE     0x40007000
+#define GPIO_PORTE_BASE     0x40024000
+#define GPIO_PORTF_BASE     0x40025000
+
+#define GPIO_O_DATA         0x00000000
+#define GPIO_O_DIR          0x00000400
+#define GPIO_O_DEN          0x0000051C
+#define GPIO_O_LOCK         0x00000520
+#define GPIO_O_CR           0x00000524
+#define GPIO_LOCK_KEY       0x4C4F434B
+
+#define GPIO_PIN_0          0x00000001
+#define GPIO_PIN_1          0x00000002
+#define GPIO_PIN_2          0x00000004
+#define GPIO_PIN_3          0x00000008
+#define GPIO_PIN_4          0x00000010
+#define GPIO_PIN_5          0x00000020
+#define GPIO_PIN_6          0x00000040
+#define GPIO_PIN_7          0x00000080
+
+#define SYSCTL_RCGCGPIO     0x400FE608
+#define SYSCTL_PRGPIO       0x400FEA08
+#define SYSCTL_RCGCGPIO_R0  0x00000001
+#define SYSCTL_RCGCGPIO_R1  0x00000002
+#define SYSCTL_RCGCGPIO_R2  0x00000004
+#define SYSCTL_RCGCGPIO_R3  0x00000008
+#define SYSCTL_RCGCGPIO_R4  0x00000010
+#define SYSCTL_RCGCGPIO_R5  0x00000020
+#define SYSCTL_PRGPIO_R0    0x00000001
+#define SYSCTL_PRGPIO_R1    0x00000002
+#define SYSCTL_PRGPIO_R2    0x00000004
+#define SYSCTL_PRGPIO_R3    0x00000008
+#define SYSCTL_PRGPIO_R4    0x00000010
+#define SYSCTL_PRGPIO_R5    0x00000020
+
+// ADC_MultiRead channels, PE0 first
+#define HOST_ADC_CHANNELS   4
+
+volatile uint32_t* HostHW_Register(uint32_t Address);
+void HostHW_SetInputs(uint32_t PortBase, uint8_t Pins, uint8_t Levels);
+void HostHW_SetAnalog(uint8_t Channel, uint16_t Value);
+
+#endif /* HostHardware_H */
@@ -0,0 +1,42 @@
+/****************************************************************************
+
+  Header file for the radio link statistics
+
+ ****************************************************************************/
+
+#ifndef LinkStats_H
+#define LinkStats_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "PeerTable.h"
+
+typedef struct {
+	uint16_t RSSIAvg16;         // -dBm times 16, moving average
+	uint16_t ReportIntervalAvg; // ms between reports, moving average
+	uint16_t LastReportTime;    // ES_Timer_GetTime() of the last report
+	uint16_t Reports;
+	uint16_t TxSuccesses;
+	uint16_t TxFailures;
+	uint16_t KeyResets;         // DOG_FARMER_RESET_ENCRs, the DOG lost its place in the key
+} LinkPeerStats_t;
+
+void LinkStats_Init(void);
+void LinkStats_ResetPeer(uint8_t Slot);
+
+// fed by Comm_Service
+void LinkStats_FrameSent(uint8_t FrameID, uint8_t Slot, uint8_t FrameLength);
+void LinkStats_TxStatus(uint8_t FrameID, bool Success);
+void LinkStats_FrameReceived(uint8_t Slot, uint8_t RSSI, uint8_t FrameLength, bool IsReport);
+void LinkStats_KeyReset(uint8_t Slot);
+
+// rate control, LinkStats_Update is run on every control packet tick
+void LinkStats_Update(void);
+uint16_t LinkStats_GetInterMessageTime(void);
+
+const LinkPeerStats_t* LinkStats_GetPeer(uint8_t Slot);
+uint16_t LinkStats_GetAirtimePermille(void);
+void LinkStats_Print(void);
+
+#endif /* LinkStats_H */
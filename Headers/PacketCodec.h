@@ -0,0 +1,118 @@
+/****************************************************************************
+
+  Header file for the FARMER/DOG packet schema and codec
+
+ ****************************************************************************/
+
+#ifndef PacketCodec_H
+#define PacketCodec_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+#include "PeerTable.h"
+
+#define BROADCAST_ADDRESS   0xFFFF
+
+/*
+  FARMER_DOG_CTRL_AGG payload: how many samples are valid, the FARMER's
+  time (ms) of the newest one, then CTRL_AGG_SAMPLES samples newest first,
+  each its age in ms (relative to the newest, 255 for older) followed by
+  the same bytes a FARMER_DOG_CTRL carries. Unused samples are zero.
+*/
+#define CTRL_AGG_SAMPLES        4
+#define CTRL_AGG_SAMPLE_LENGTH  (1 + CTRL_DATA_LENGTH)
+#define CTRL_AGG_COUNT_INDEX    0
+#define CTRL_AGG_TIME_INDEX     1
+#define CTRL_AGG_SAMPLE_INDEX   3
+#define CTRL_AGG_NEWEST_INDEX   (CTRL_AGG_SAMPLE_INDEX + 1) // CTRL bytes of the newest sample
+#define CTRL_AGG_LENGTH         (CTRL_AGG_SAMPLE_INDEX + CTRL_AGG_SAMPLES * CTRL_AGG_SAMPLE_LENGTH)
+
+// who sends the packet
+#define PKT_FROM_FARMER     0
+#define PKT_FROM_DOG        1
+
+// how the packet is encrypted
+#define PKT_CLEAR           0   // not at all
+#define PKT_XOR             1   // XOR with the DOG's key from where the last packet left off
+#define PKT_XOR_INDEXED     2   // the same, after a clear byte saying where in the key it starts
+
+// the clear key index byte is KEY_INDEX_FLAG | index; packet type codes
+// never have the top bit set, so a DOG can tell it from a plain packet
+// (an encrypted type byte can have it, the length tells those apart)
+#define KEY_INDEX_FLAG      0x80
+#define KEY_INDEX_MASK      0x1F
+
+#ifdef CTRL_KEY_INDEX
+#define CTRL_CIPHER         PKT_XOR_INDEXED
+#else
+#define CTRL_CIPHER         PKT_XOR
+#endif
+
+/*
+  Every packet type in the protocol, one line each:
+    X(Name, type code, sender, payload bytes, cipher)
+  Encrypted packets have their packet type byte and every payload byte
+  XORed with successive bytes of the DOG's key. PKT_XOR_INDEXED packets
+  carry the key index of their first encrypted byte in the clear ahead of
+  them, so the DOG never has to guess it after a lost packet. Only FARMER
+  packets can be encrypted, the FARMER needs the plain type byte of a DOG
+  packet to find out what it is. Type codes must run from 0 with no gaps.
+*/
+#define PACKET_SCHEMA(X) \
+	X(REPORT,     DOG_FARMER_REPORT,     PKT_FROM_DOG,    IMU_DATA_LENGTH,      PKT_CLEAR  ) \
+	X(REQ_2_PAIR, FARMER_DOG_REQ_2_PAIR, PKT_FROM_FARMER, 1,                    PKT_CLEAR  ) \
+	X(ACK,        DOG_ACK,               PKT_FROM_DOG,    0,                    PKT_CLEAR  ) \
+	X(ENCR_KEY,   FARMER_DOG_ENCR_KEY,   PKT_FROM_FARMER, NUM_ENCRYPTION_BYTES, PKT_CLEAR  ) \
+	X(CTRL,       FARMER_DOG_CTRL,       PKT_FROM_FARMER, CTRL_DATA_LENGTH,     CTRL_CIPHER) \
+	X(RESET_ENCR, DOG_FARMER_RESET_ENCR, PKT_FROM_DOG,    0,                    PKT_CLEAR  ) \
+	X(CTRL_AGG,   FARMER_DOG_CTRL_AGG,   PKT_FROM_FARMER, CTRL_AGG_LENGTH,      CTRL_CIPHER)
+
+// API frame bytes ahead of the packet type: API ID, frame ID, destination
+// and options going out; API ID, source, RSSI and options coming in
+#define TX_API_OVERHEAD     (PACKET_TYPE_BYTE_INDEX_TX - HEADER_LENGTH)
+#define RX_API_OVERHEAD     PACKET_TYPE_BYTE_INDEX_RX
+
+// frame data length (API ID -> RF data) for each packet, PKT_LENGTH_CTRL etc.
+#define PKT_LENGTH_ENTRY(Name, Type, Sender, Payload, Cipher) \
+	PKT_LENGTH_##Name = (((Sender) == PKT_FROM_FARMER) ? TX_API_OVERHEAD : RX_API_OVERHEAD) + 1 + (Payload) + \
+		((Cipher) == PKT_XOR_INDEXED),
+enum { PACKET_SCHEMA(PKT_LENGTH_ENTRY) };
+
+#define PKT_COUNT_ENTRY(Name, Type, Sender, Payload, Cipher) PKT_COUNT_##Name,
+enum { PACKET_SCHEMA(PKT_COUNT_ENTRY) NUM_PACKET_TYPES };
+
+typedef struct {
+	uint8_t Sender;
+	uint8_t PayloadLength;
+	uint8_t FrameLength;   // 0 for a type code that isn't in the schema
+	uint8_t Cipher;        // PKT_CLEAR, PKT_XOR or PKT_XOR_INDEXED
+} PacketSpec_t;
+
+// what Packet_Decode found in a frame from a DOG
+typedef struct {
+	uint8_t PacketType;
+	uint16_t Source;
+	uint8_t RSSI;
+	const uint8_t *Payload; // points into the frame, PayloadLength bytes
+	uint8_t PayloadLength;
+} PacketView_t;
+
+const PacketSpec_t* Packet_GetSpec(uint8_t PacketType);
+uint8_t Packet_Encode(uint8_t *Frame, uint8_t PacketType, uint8_t FrameID, uint16_t Dest,
+	const uint8_t *Payload, const uint8_t *Key, uint8_t *pKeyIndex);
+bool Packet_Decode(const uint8_t *Frame, uint8_t FrameLength, PacketView_t *pView);
+
+#ifdef ES_HOST_BUILD
+typedef struct {
+	uint32_t Cases;          // packets built and taken apart again
+	uint32_t Mismatches;     // where anything about one of them was wrong
+	double EncodeNs[NUM_PACKET_TYPES]; // Packet_Encode per call, FARMER packets
+	double DecodeNs[NUM_PACKET_TYPES]; // Packet_Decode per call, DOG packets
+} PacketBenchResult_t;
+
+void Packet_RunBench(uint32_t Iterations, uint32_t Seed, PacketBenchResult_t *pResult);
+#endif
+
+#endif /* PacketCodec_H */
@@ -0,0 +1,39 @@
+/****************************************************************************
+
+  Header file for the word at a time checksum and XOR kernel
+
+ ****************************************************************************/
+
+#ifndef PacketKernel_H
+#define PacketKernel_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+
+uint8_t PacketKernel_Sum(const uint8_t *pData, uint8_t Length);
+uint8_t PacketKernel_CopySum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length);
+uint8_t PacketKernel_XorSum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length,
+	const uint8_t *Key, uint8_t *pKeyIndex);
+
+#ifdef ES_HOST_BUILD
+#define KERNEL_BENCH_SIZES  8   // frame sizes timed, see KernelBenchLengths
+
+typedef struct {
+	uint8_t Length;
+	double ByteNs;           // the byte at a time loops, per call
+	double KernelNs;         // PacketKernel, per call
+} PacketKernelTiming_t;
+
+typedef struct {
+	uint32_t Cases;          // length, key index, alignment and data combinations checked
+	uint32_t Mismatches;     // where the kernel and the byte loops disagreed in any way
+	PacketKernelTiming_t Sum[KERNEL_BENCH_SIZES];
+	PacketKernelTiming_t XorSum[KERNEL_BENCH_SIZES];
+} PacketKernelBenchResult_t;
+
+void PacketKernel_RunBench(uint32_t Iterations, uint32_t Seed, PacketKernelBenchResult_t *pResult);
+#endif
+
+#endif /* PacketKernel_H */
@@ -0,0 +1,46 @@
+/****************************************************************************
+
+  Header file for the table of DOGs the FARMER is talking to
+
+ ****************************************************************************/
+
+#ifndef PeerTable_H
+#define PeerTable_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_PEERS             4
+#define NO_PEER               0xFF
+#define NUM_ENCRYPTION_BYTES  32
+#define IMU_DATA_LENGTH       12
+#define CTRL_DATA_LENGTH      3  // sensor bytes in a control packet
+
+// PeerResuming: lost communication, but the address, key and key index are
+// kept until SessionDeadline so the DOG can be taken back without pairing
+typedef enum { PeerFree, PeerPairing, PeerPaired, PeerResuming } PeerState_t ;
+
+typedef struct {
+	uint16_t Address;          // 16 bit XBee source address of the DOG
+	PeerState_t State;
+	uint8_t DogTag;
+	uint8_t EncryptionKey[NUM_ENCRYPTION_BYTES];
+	uint8_t EncryptionIndex;   // next key byte to use
+	uint16_t LostCommDeadline; // ES_Timer_GetTime() after which we give up on it
+	uint8_t IMU_Data[IMU_DATA_LENGTH]; // latest report
+	uint8_t LastCtrl[CTRL_DATA_LENGTH]; // sensor bytes of the last control packet
+	uint16_t LastCtrlTime;     // ES_Timer_GetTime() it was built
+	uint16_t SessionDeadline;  // PeerResuming: ES_Timer_GetTime() after which it is forgotten
+	uint16_t LastResumeTry;    // PeerResuming: when the last unicast REQ2PAIR went out
+} Peer_t;
+
+void PeerTable_Init(void);
+uint8_t PeerTable_Find(uint16_t Address);
+uint8_t PeerTable_Add(uint16_t Address);
+void PeerTable_Remove(uint8_t Slot);
+Peer_t* PeerTable_Get(uint8_t Slot);
+uint8_t PeerTable_NextPaired(void);
+uint8_t PeerTable_NumPaired(void);
+uint8_t PeerTable_NumResuming(void);
+
+#endif /* PeerTable_H */
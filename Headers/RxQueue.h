@@ -0,0 +1,40 @@
+/****************************************************************************
+
+  Header file for the receive frame queue
+
+ ****************************************************************************/
+
+#ifndef RxQueue_H
+#define RxQueue_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+
+// completed frames waiting for Comm_Service, a power of two
+#define RX_QUEUE_FRAMES   4
+#define RX_QUEUE_MASK     (RX_QUEUE_FRAMES - 1)
+
+// UART_RX_FLOW watermarks: RTS goes up with this many frames waiting, which
+// leaves room for the one the XBee is partway through, and comes back down
+// once Comm_Service has them down to RX_FLOW_LOW_FRAMES
+#define RX_FLOW_HIGH_FRAMES   (RX_QUEUE_FRAMES - 1)
+#define RX_FLOW_LOW_FRAMES    1
+
+void RxQueue_Init(void);
+
+// producer side (ProcessReceivedByte, UART interrupt)
+bool RxQueue_Put(const uint8_t *pFrame, uint8_t FrameLength, uint16_t *pSeq);
+
+// consumer side (Comm_Service)
+bool RxQueue_Take(const uint8_t **ppFrame, uint8_t *pFrameLength, uint16_t *pSeq);
+void RxQueue_Release(void);
+
+// statistics
+uint8_t RxQueue_GetDepth(void);
+uint8_t RxQueue_GetMaxDepth(void);
+uint16_t RxQueue_GetOverruns(void);
+uint16_t RxQueue_GetFrames(void);
+
+#endif /* RxQueue_H */
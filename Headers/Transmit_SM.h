@@ -11,5 +11,7 @@ bool IsLastByte(void);
 bool InitTransmit_SM ( uint8_t Priority );
 bool PostTransmit_SM( ES_Event ThisEvent );
 ES_Event RunTransmit_SM( ES_Event ThisEvent );
+uint32_t GetTxFrameCycles(void);
+uint32_t GetTxAvgFrameCycles(void);
 
 #endif 
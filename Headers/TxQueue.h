@@ -0,0 +1,53 @@
+/****************************************************************************
+
+  Header file for the transmit frame queue
+
+ ****************************************************************************/
+
+#ifndef TxQueue_H
+#define TxQueue_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+#include "PeerTable.h"
+
+// number of frame buffers shared by all lanes, the one on the wire and the
+// ones waiting on a transmit status
+#define TX_QUEUE_BUFFERS  6
+// room for the biggest frame: header, frame data and checksum
+#define TX_FRAME_SIZE     (HEADER_LENGTH + MAX_FRAME_LENGTH + 1)
+// most frames sent but still waiting on their transmit status
+#define TX_WINDOW         3
+// times a frame is resent after a failed transmit status
+#define TX_RETRY_BUDGET   2
+// give up waiting for a transmit status after this many ms
+#define TX_STATUS_TIMEOUT 100
+
+// lanes are served in order, lower numbers first
+typedef enum { TX_LANE_PAIRING, TX_LANE_CTRL, NUM_TX_LANES } TxLane_t ;
+
+void TxQueue_Init(void);
+
+// producer side (Comm_Service)
+uint8_t* TxQueue_Acquire(TxLane_t Lane, uint8_t Slot, uint8_t *pFrameID);
+void TxQueue_Commit(uint8_t FrameLength);
+void TxQueue_Abandon(void);
+bool TxQueue_TxStatus(uint8_t FrameID, bool Success);
+
+// consumer side (Transmit_SM)
+bool TxQueue_StartNext(uint8_t **ppFrame, uint8_t *pFrameLength);
+void TxQueue_Release(void);
+bool TxQueue_SendFailed(void);
+
+// statistics
+uint8_t TxQueue_GetDepth(void);
+uint8_t TxQueue_GetMaxDepth(void);
+uint16_t TxQueue_GetDrops(TxLane_t Lane);
+uint16_t TxQueue_GetRetransmits(void);
+uint16_t TxQueue_GetExpired(void);
+uint16_t TxQueue_GetSuperseded(void);
+uint16_t TxQueue_GetGaveUp(void);
+
+#endif /* TxQueue_H */
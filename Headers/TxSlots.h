@@ -0,0 +1,28 @@
+/****************************************************************************
+
+  Header file for the slotted (TDMA) control packet schedule
+
+ ****************************************************************************/
+
+#ifndef TxSlots_H
+#define TxSlots_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+
+void TxSlots_Init(uint8_t DogTag, uint16_t Now);
+uint16_t TxSlots_Delay(uint16_t Now, uint16_t Wanted);
+
+// fed by LinkStats
+void TxSlots_TxStatus(bool Success);
+void TxSlots_ReportReceived(uint16_t Now);
+
+// statistics
+uint8_t TxSlots_GetSlot(void);
+uint16_t TxSlots_GetHops(void);
+uint16_t TxSlots_GetCollisions(void);
+uint16_t TxSlots_GetReportsInSlot(void);
+
+#endif /* TxSlots_H */
@@ -1,9 +1,33 @@
 #ifndef UART_H
 #define UART_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+// The serial port to the XBee. UART.c drives UART5 on the Tiva, VirtualUART.c
+// stands in for it in host builds (ES_HOST_BUILD). Received bytes go to
+// ProcessReceivedByte, transmit progress is posted to Transmit_SM.
+// With UART_RX_FLOW the XBee's RTS follows the RX queue, see UART_UpdateRxFlow.
+
+// receive errors UART_ISR counts, from the flags in the data register
+typedef enum { UART_ERR_OVERRUN, UART_ERR_FRAMING, UART_ERR_PARITY, UART_ERR_BREAK,
+	NUM_UART_ERRORS } UARTError_t ;
+
 // Public Function Prototypes
 
 void InitUART(void);
 void UART_ISR(void);
+bool UART_SendByte(uint8_t DataByte);
+void UART_EnableTxInt(void);
+void UART_StartTxDMA(uint8_t *pData, uint8_t Length);
+void UART_AbortTx(void);
+uint32_t UART_TakeTxISRCycles(void);
+bool UART_SetBaudCode(uint8_t NewCode);
+uint32_t UART_GetBaud(void);
+uint32_t UART_GetByteTimeUs(void);
+uint16_t UART_GetErrorCount(UARTError_t Which);
+void UART_UpdateRxFlow(void);
+uint16_t UART_GetRxHolds(void);
+uint32_t UART_GetRxHeldMs(void);
 
 #endif 
@@ -0,0 +1,52 @@
+/****************************************************************************
+
+  Header file for the host stand-in for UART.c, only built with ES_HOST_BUILD
+
+ ****************************************************************************/
+
+#ifndef VirtualUART_H
+#define VirtualUART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "UART.h"
+
+#define VUART_MAX_FIFO    32    // deepest FIFO VUART_Configure will take
+#define VUART_LINE_SIZE   4096  // bytes that can be waiting on each wire
+
+typedef struct {
+	uint32_t ByteTimeUs;   // 0 to follow UART_SetBaudCode like the real one
+	uint8_t RxFifoDepth;   // 1 .. VUART_MAX_FIFO, 16 on the Tiva
+	uint8_t RxTrigger;     // RX interrupt at this FIFO level, 2 is the 1/8 setting
+	uint16_t ErrorRate;    // bytes in 65536 that arrive with a bit flipped and FE set
+	bool Loopback;         // bytes sent come straight back in instead of being captured
+	uint32_t Seed;         // for the error injection
+	uint8_t RtsLagBytes;   // bytes the radio still sends after RTS goes up (UART_RX_FLOW)
+} VUARTConfig_t;
+
+// where received bytes go, ProcessReceivedByte unless changed
+typedef void (*VUARTRxSink_t)(uint8_t DataByte);
+
+typedef struct {
+	uint32_t FramesSent;
+	uint32_t FramesDamaged;  // frames the generator or the line corrupted
+	uint32_t Accepted;       // undamaged frames that came out of the parser intact
+	uint32_t Missed;         // undamaged frames that never came out
+	uint32_t FalseAccepts;   // frames out that don't match an undamaged one sent
+	uint32_t Overruns;       // bytes lost to a full RX FIFO
+	double FramesPerSec;     // host CPU time, all of the above included
+	uint32_t ParserBytes;    // RAM the receive path needs for its parser
+} VUARTBenchResult_t;
+
+void VUART_Configure(const VUARTConfig_t *pConfig);
+void VUART_SetRxSink(VUARTRxSink_t Sink);
+uint16_t VUART_InjectRx(const uint8_t *pBytes, uint16_t Length);
+void VUART_Advance(uint32_t Microseconds);
+uint16_t VUART_TakeTx(uint8_t *pBytes, uint16_t MaxLength);
+uint32_t VUART_GetTimeUs(void);
+
+void VUART_RunReceiveBench(uint32_t Frames, uint8_t DamagePer256, uint32_t Seed,
+	VUARTBenchResult_t *pResult);
+
+#endif /* VirtualUART_H */
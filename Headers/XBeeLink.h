@@ -0,0 +1,24 @@
+/****************************************************************************
+
+  Header file for XBeeLink, the service that sets up the radio link
+
+ ****************************************************************************/
+
+#ifndef XBeeLink_H
+#define XBeeLink_H
+
+#include "ES_Configure.h"
+#include "ES_Types.h"
+#include "ES_Events.h"
+
+typedef enum { LinkConfiguring, LinkSwitching, LinkVerifying, LinkReverting, LinkReady } XBeeLinkState_t ;
+
+// ES_AT_RESPONSE carries the frame ID in the high byte and the status in the low
+#define AT_RESPONSE_PARAM(FrameID, Status) ((uint16_t)(((FrameID) << 8) | (Status)))
+
+bool InitXBeeLink ( uint8_t Priority );
+bool PostXBeeLink( ES_Event ThisEvent );
+ES_Event RunXBeeLink( ES_Event ThisEvent );
+bool XBeeLink_IsReady(void);
+
+#endif /* XBeeLink_H */
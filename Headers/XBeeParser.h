@@ -0,0 +1,78 @@
+/****************************************************************************
+
+  Header file for the XBee API frame parser
+
+ ****************************************************************************/
+
+#ifndef XBeeParser_H
+#define XBeeParser_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Constants.h"
+
+// parser states, one per field of the API frame
+typedef enum { Wait4Start, Wait4MSBLength, Wait4LSBLength, ReceivingData } ReceiveState_t ;
+
+// what XBee_ParseByte made of the byte it was just handed
+typedef enum { XBEE_IN_PROGRESS, XBEE_FRAME_GOOD, XBEE_FRAME_BAD } XBeeResult_t ;
+
+// raw bytes kept for rescanning, a power of two that holds the longest
+// frame (delimiter, length, frame data, checksum)
+#define XBEE_RING_SIZE  64
+#define XBEE_RING_MASK  (XBEE_RING_SIZE - 1)
+
+typedef struct {
+	ReceiveState_t State;
+	uint8_t FrameLength;              // num bytes in frame data (API ID -> RF data)
+	uint8_t BytesLeft;                // frame data bytes still to come
+	uint8_t Frame[MAX_FRAME_LENGTH];  // frame data, without delimiter, length or checksum
+	uint8_t Ring[XBEE_RING_SIZE];     // bytes from the start of the frame in progress on
+	uint8_t Head;                     // ring index of the frame in progress's delimiter
+	uint8_t Next;                     // ring index of the next byte to parse
+	uint8_t Tail;                     // ring index the next byte off the line goes in
+	uint8_t RescanLeft;               // bytes still to be parsed a second time
+	bool StartRescanned;              // delimiter of the frame in progress came from a rescan
+	uint8_t GapAt;                    // ring index of the first byte after the line went quiet
+	bool GapPending;                  // no frame may run on past GapAt
+	uint16_t GoodFrames;              // frames that passed the checksum
+	uint16_t BadFrames;               // frame starts dropped for length or checksum
+	uint16_t RecoveredFrames;         // good frames found by rescanning after a bad one
+} XBeeParser_t;
+
+void XBee_ParserInit(XBeeParser_t *pParser);
+void XBee_ParserReset(XBeeParser_t *pParser);
+void XBee_ParserGap(XBeeParser_t *pParser);
+XBeeResult_t XBee_ParseByte(XBeeParser_t *pParser, uint8_t Byte);
+XBeeResult_t XBee_ParseMore(XBeeParser_t *pParser);
+
+#ifdef ES_HOST_BUILD
+typedef struct {
+	uint32_t Bytes;          // in one pass
+	uint32_t GoodFrames;     // in one pass
+	uint32_t BadFrames;      // in one pass
+	double NsPerByte;        // host CPU time
+	double NsPerFrame;
+	double BytesPerSec;
+} XBeeParseBenchResult_t;
+
+uint32_t XBee_BuildBenchStream(uint8_t *pStream, uint32_t MaxLength, uint32_t Seed);
+void XBee_RunParseBench(const uint8_t *pStream, uint32_t Length, uint32_t Passes,
+	XBeeParseBenchResult_t *pResult);
+
+typedef struct {
+	uint32_t FramesSent;
+	uint32_t FramesDamaged;  // frames the generator corrupted
+	uint32_t Delivered;      // undamaged frames that came out of the parser intact
+	uint32_t Lost;           // undamaged frames that never came out
+	uint32_t Recovered;      // of those delivered, found by a rescan
+	uint32_t FalseAccepts;   // frames out that don't match an undamaged one sent
+	uint32_t Gaps;           // times the line went quiet inside a frame
+} XBeeRecoveryBenchResult_t;
+
+void XBee_RunRecoveryBench(uint32_t Frames, uint8_t DamagePer256, uint32_t Seed, bool ResetOnGap,
+	XBeeRecoveryBenchResult_t *pResult);
+#endif
+
+#endif /* XBeeParser_H */
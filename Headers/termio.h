@@ -15,7 +15,9 @@ extern "C" {
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#ifndef ES_HOST_BUILD
 #include "utils/uartstdio.h"
+#endif
 
 //#if defined(ccs)
 //#define printf	UARTprintf
@@ -0,0 +1,78 @@
+/****************************************************************************
+ Module
+   CodecBenchMain.c
+
+ Description
+   Host program for the packet benches:
+
+     codec-bench [iterations] [seed]
+
+   Packet_RunBench round trips every packet type in PACKET_SCHEMA and
+   times Packet_Encode and Packet_Decode per type. PacketKernel_RunBench
+   then checks the word at a time kernel against the byte loops it
+   replaced and times both per frame length.
+
+   The schema is built as configured in Constants.h; the Makefile's DEFS
+   adds switches such as -DCTRL_KEY_INDEX on top.
+
+ Notes
+   Only built with ES_HOST_BUILD. The times are host CPU time and only
+   mean something in a build with optimisation on (the Makefile's -O2).
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "PacketCodec.h"
+#include "PacketKernel.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define BENCH_ITERATIONS  2000000
+#define BENCH_SEED        7
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char *argv[]) {
+	PacketBenchResult_t Result;
+	PacketKernelBenchResult_t Kernel;
+	uint32_t Iterations = BENCH_ITERATIONS;
+	uint32_t Seed = BENCH_SEED;
+	uint8_t Type;
+	uint8_t i;
+
+	if (argc > 1) {
+		Iterations = strtoul(argv[1], NULL, 0);
+	}
+	if (argc > 2) {
+		Seed = strtoul(argv[2], NULL, 0);
+	}
+
+	Packet_RunBench(Iterations, Seed, &Result);
+	printf("round trip: %u cases, %u mismatches\n", Result.Cases, Result.Mismatches);
+	for (Type = 0; Type < NUM_PACKET_TYPES; Type++) {
+		const PacketSpec_t *pSpec = Packet_GetSpec(Type);
+
+		if (pSpec == NULL) {
+			continue;
+		}
+		if (pSpec->Sender == PKT_FROM_FARMER) {
+			printf("type 0x%02x, %2u byte frame: encode %.1f ns\n", Type, pSpec->FrameLength,
+				Result.EncodeNs[Type]);
+		} else {
+			printf("type 0x%02x, %2u byte frame: decode %.1f ns\n", Type, pSpec->FrameLength,
+				Result.DecodeNs[Type]);
+		}
+	}
+
+	PacketKernel_RunBench(Iterations, Seed, &Kernel);
+	printf("kernel: %u cases, %u mismatches\n", Kernel.Cases, Kernel.Mismatches);
+	for (i = 0; i < KERNEL_BENCH_SIZES; i++) {
+		printf("len %3u: sum %.1f -> %.1f ns, xor+sum %.1f -> %.1f ns\n", Kernel.Sum[i].Length,
+			Kernel.Sum[i].ByteNs, Kernel.Sum[i].KernelNs, Kernel.XorSum[i].ByteNs,
+			Kernel.XorSum[i].KernelNs);
+	}
+	return (Result.Mismatches != 0) || (Kernel.Mismatches != 0);
+}
@@ -0,0 +1,191 @@
+/****************************************************************************
+ Module
+   DogSimMain.c
+
+ Description
+   Host program that runs the real FARMER stack (Comm_Service, Receive_SM,
+   Transmit_SM, FARMER_SM, XBeeLink and the modules under them) against
+   the DOG simulator, over the virtual UART, for one scenario:
+
+     dogsim <scenario> [seed]
+
+   The scenarios are listed in the table below. The stack is built as it
+   is configured in Constants.h; the Makefile's DEFS adds switches such as
+   -DCTRL_SLOTTED on top.
+
+   Each simulated ms ticks the ES timers through SysTickIntHandler and runs
+   the services until they are idle. ES_GetCycles follows the virtual
+   UART's clock, so a scenario and seed always give the same run. The pilot holds the stick still for
+   2 s and then sweeps it through its range for 2 s, over and over, so the
+   inputs both change and sit still.
+
+ Notes
+   Only built with ES_HOST_BUILD. The stack's own printf trace goes to
+   /dev/null unless -v is given before the scenario; the results are
+   printed on one line at the end.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "ES_ShortTimer.h"
+
+#include "Constants.h"
+#include "HostHardware.h"
+#include "VirtualUART.h"
+#include "DogSim.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define BRAKE_PIN         GPIO_PIN_2  // PA2, low when pressed
+#define ACCEL_RL_CHANNEL  0
+#define ACCEL_FB_CHANNEL  2
+#define ACCEL_MIDDLE      1570        // reads as a centred stick
+#define ACCEL_SWING       700
+#define PILOT_HOLD_MS     2000
+#define PILOT_SWEEP_MS    2000
+
+typedef struct {
+	const char *pName;
+	DogSimScenario_t Scenario;
+} NamedScenario_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+void SysTickIntHandler(void);  // ES_Port.c, the SysTick vector on the target
+static void Step(void);
+static void MoveStick(uint32_t Ms);
+static uint32_t SimulatedCycles(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+// DurationMs, NumDogs, DogTags, LossPermille, LatencyMs, JitterMs,
+// ReportPeriodMs, ResetEncrEveryMs, OutageStartMs, OutageMs, PairRetryMs,
+// OtherFarmers, OtherPeriodMs, OtherAirMs, OthersSlotted
+static const NamedScenario_t Scenarios[] = {
+	{ "clean",    { 20000, 1, {0}, 0,   5, 4, 100, 0,    0,    0,    1000, 0, 0,   0, false } },
+	{ "lossy",    { 20000, 1, {0}, 100, 5, 4, 100, 5000, 8000, 4000, 1000, 0, 0,   0, false } },
+	{ "loss40",   { 20000, 1, {0}, 400, 5, 4, 100, 0,    0,    0,    1000, 0, 0,   0, false } },
+	{ "twodogs",  { 20000, 2, {0}, 50,  5, 4, 100, 0,    0,    0,    1000, 0, 0,   0, false } },
+	{ "others4",  { 20000, 1, {0}, 0,   5, 4, 100, 0,    0,    0,    1000, 4, 100, 8, false } },
+	{ "others4s", { 20000, 1, {0}, 0,   5, 4, 100, 0,    0,    0,    1000, 4, 100, 8, true  } },
+	{ "others8",  { 20000, 1, {0}, 0,   5, 4, 100, 0,    0,    0,    1000, 8, 100, 8, false } },
+	{ "others8s", { 20000, 1, {0}, 0,   5, 4, 100, 0,    0,    0,    1000, 8, 100, 8, true  } },
+};
+
+static uint32_t NowMs;
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char *argv[]) {
+	VUARTConfig_t Config = { 0, 16, 2, 0, false, 1 };
+	DogSimScenario_t Scenario;
+	DogSimResult_t Result;
+	FILE *pOut = stdout;
+	bool Verbose = false;
+	int Arg = 1;
+	size_t i;
+
+	if ((argc > Arg) && (strcmp(argv[Arg], "-v") == 0)) {
+		Verbose = true;
+		Arg++;
+	}
+	if (argc <= Arg) {
+		fprintf(stderr, "usage: dogsim [-v] <scenario> [seed]\nscenarios:");
+		for (i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++) {
+			fprintf(stderr, " %s", Scenarios[i].pName);
+		}
+		fprintf(stderr, "\n");
+		return 2;
+	}
+	for (i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++) {
+		if (strcmp(argv[Arg], Scenarios[i].pName) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(Scenarios) / sizeof(Scenarios[0])) {
+		fprintf(stderr, "dogsim: no scenario %s\n", argv[Arg]);
+		return 2;
+	}
+	Scenario = Scenarios[i].Scenario;
+	Scenario.Seed = (argc > Arg + 1) ? strtoul(argv[Arg + 1], NULL, 0) : 1;
+	Config.Seed = Scenario.Seed;
+
+	// keep the results, lose the trace
+	if (!Verbose) {
+		fflush(stdout);
+		pOut = fdopen(dup(fileno(stdout)), "w");
+		if ((pOut == NULL) || (freopen("/dev/null", "w", stdout) == NULL)) {
+			return 1;
+		}
+	}
+
+	// brake released, no DOG select jumpers, stick centred
+	HostHW_SetInputs(GPIO_PORTA_BASE, BRAKE_PIN, BRAKE_PIN);
+	MoveStick(0);
+
+	VUART_Configure(&Config);
+	ES_SetCycleSource(SimulatedCycles);
+	srand(Scenario.Seed);
+	if (ES_Initialize(ES_Timer_RATE_1mS) != Success) {
+		fprintf(stderr, "dogsim: ES_Initialize failed\n");
+		return 1;
+	}
+	DogSim_RunScenario(&Scenario, Step, &Result);
+
+	fprintf(pOut, "%s seed %u: pairings %u first %u ms, pair p50/p99 %u/%u ms, reconnect %u ms | "
+		"frames %u txfail %u collisions %u | ctrl sent %u rx %u bad %u jumps %u resets %u | "
+		"gap p50/p90/p99/max %u/%u/%u/%u ms, latency p50/p90/p99 %u/%u/%u ms | "
+		"reports %u lost %u, loss %.1f%%\n",
+		Scenarios[i].pName, Scenario.Seed, Result.Pairings, Result.FirstPairMs, Result.PairMs.P50,
+		Result.PairMs.P99, Result.ReconnectMs, Result.FramesToDogs, Result.TxStatusFailed,
+		Result.Collisions, Result.CtrlSent, Result.CtrlReceived, Result.CtrlBadKey, Result.CtrlIndexJumps,
+		Result.ResetEncrSent, Result.CtrlGapMs.P50, Result.CtrlGapMs.P90, Result.CtrlGapMs.P99,
+		Result.CtrlGapMs.Max, Result.CtrlLatencyMs.P50, Result.CtrlLatencyMs.P90,
+		Result.CtrlLatencyMs.P99, Result.ReportsSent, Result.ReportsLost, Result.LossPercent);
+	fclose(pOut);
+	return 0;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// One simulated ms of the FARMER: the tick, the pilot, then the services
+static void Step(void) {
+	SysTickIntHandler();
+	MoveStick(++NowMs);
+	if (ES_RunPending() != Success) {
+		fprintf(stderr, "dogsim: a service failed at %u ms\n", NowMs);
+		exit(1);
+	}
+}
+
+// Holds the stick still, then sweeps forward and back through its range
+static void MoveStick(uint32_t Ms) {
+	uint32_t Phase = Ms % (PILOT_HOLD_MS + PILOT_SWEEP_MS);
+	int32_t Offset = 0;
+
+	if (Phase >= PILOT_HOLD_MS) {
+		Phase -= PILOT_HOLD_MS;
+		// up, down through the middle and back, as a triangle
+		Offset = (int32_t)(Phase * 4 * ACCEL_SWING / PILOT_SWEEP_MS);
+		if (Offset > ACCEL_SWING) {
+			Offset = 2 * ACCEL_SWING - Offset;
+		}
+		if (Offset < -ACCEL_SWING) {
+			Offset = -2 * ACCEL_SWING - Offset;
+		}
+	}
+	HostHW_SetAnalog(ACCEL_FB_CHANNEL, ACCEL_MIDDLE + Offset);
+	HostHW_SetAnalog(ACCEL_RL_CHANNEL, ACCEL_MIDDLE);
+}
+
+// ES_GetCycles for the run, the virtual UART's time in 40MHz cycles
+static uint32_t SimulatedCycles(void) {
+	return VUART_GetTimeUs() * ES_CYCLES_PER_US;
+}
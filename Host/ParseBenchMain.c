@@ -0,0 +1,84 @@
+/****************************************************************************
+ Module
+   ParseBenchMain.c
+
+ Description
+   Host program for the XBee API frame parser's benches:
+
+     parse-bench [recording]
+
+   XBee_RunParseBench times the parser over a byte stream, PARSE_PASSES
+   times over. With no recording, XBee_BuildBenchStream lays down
+   STREAM_SIZE bytes of the FARMER's usual receive mix. A recording is the
+   raw bytes off the UART, up to STREAM_SIZE of them.
+
+   XBee_RunRecoveryBench then sends RECOVERY_FRAMES frames at each of the
+   damage rates below, once resetting the parser on a line gap and once
+   rescanning, and prints how many undamaged frames each way lost.
+
+ Notes
+   Only built with ES_HOST_BUILD. The times are host CPU time and only
+   mean something in a build with optimisation on (the Makefile's -O2).
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "XBeeParser.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define STREAM_SIZE       (1024UL * 1024UL)
+#define STREAM_SEED       1
+#define PARSE_PASSES      50
+#define RECOVERY_FRAMES   200000
+#define RECOVERY_SEED     5
+
+/*---------------------------- Module Variables ---------------------------*/
+// chance in 256 that a frame is damaged
+static const uint8_t DamageRates[] = { 20, 64, 128 };
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char *argv[]) {
+	XBeeParseBenchResult_t Result;
+	XBeeRecoveryBenchResult_t Reset;
+	XBeeRecoveryBenchResult_t Rescan;
+	uint8_t *pStream = malloc(STREAM_SIZE);
+	uint32_t Length;
+	uint8_t i;
+
+	if (pStream == NULL) {
+		return 1;
+	}
+	if (argc > 1) {
+		FILE *pFile = fopen(argv[1], "rb");
+
+		if (pFile == NULL) {
+			fprintf(stderr, "parse-bench: can't open %s\n", argv[1]);
+			return 1;
+		}
+		Length = fread(pStream, 1, STREAM_SIZE, pFile);
+		fclose(pFile);
+	} else {
+		Length = XBee_BuildBenchStream(pStream, STREAM_SIZE, STREAM_SEED);
+	}
+
+	XBee_RunParseBench(pStream, Length, PARSE_PASSES, &Result);
+	printf("%u bytes x %u passes: %u good frames, %u bad, %.1f ns/byte (%.0f MB/s), %.0f ns/frame\n",
+		Result.Bytes, PARSE_PASSES, Result.GoodFrames, Result.BadFrames, Result.NsPerByte,
+		Result.BytesPerSec / 1e6, Result.NsPerFrame);
+	free(pStream);
+
+	for (i = 0; i < sizeof(DamageRates); i++) {
+		XBee_RunRecoveryBench(RECOVERY_FRAMES, DamageRates[i], RECOVERY_SEED, true, &Reset);
+		XBee_RunRecoveryBench(RECOVERY_FRAMES, DamageRates[i], RECOVERY_SEED, false, &Rescan);
+		printf("%3u/256 damaged: undamaged frames lost, reset %u -> rescan %u, "
+			"recovered %u, false accepts %u -> %u\n",
+			DamageRates[i], Reset.Lost, Rescan.Lost, Rescan.Recovered, Reset.FalseAccepts,
+			Rescan.FalseAccepts);
+	}
+	return 0;
+}
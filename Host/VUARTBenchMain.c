@@ -0,0 +1,69 @@
+/****************************************************************************
+ Module
+   VUARTBenchMain.c
+
+ Description
+   Host program for VUART_RunReceiveBench: pushes generated XBee frames
+   through the virtual UART's FIFO and RX interrupt into the real parser
+   (Receive_SM, XBeeParser), at 115200 baud, once per line error rate:
+
+     vuart-bench [frames] [seed]
+
+   Each run damages DAMAGE_PER_256 of the frames on purpose on top of the
+   line errors, and prints one line of counts and frames per second.
+
+ Notes
+   Only built with ES_HOST_BUILD. Frames per second is host CPU time and
+   only means something in a build with optimisation on (the Makefile's
+   -O2).
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Constants.h"
+#include "VirtualUART.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define BENCH_FRAMES      200000
+#define BENCH_SEED        42
+#define DAMAGE_PER_256    5
+
+/*---------------------------- Module Variables ---------------------------*/
+// bytes in 65536 that arrive with a bit flipped
+static const uint16_t LineErrorRates[] = { 0, 16, 64 };
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char *argv[]) {
+	VUARTConfig_t Config = { 0, 16, 2, 0, false, 1, 0 };
+	VUARTBenchResult_t Result;
+	uint32_t Frames = BENCH_FRAMES;
+	uint32_t Seed = BENCH_SEED;
+	uint8_t i;
+
+	if (argc > 1) {
+		Frames = strtoul(argv[1], NULL, 0);
+	}
+	if (argc > 2) {
+		Seed = strtoul(argv[2], NULL, 0);
+	}
+
+	for (i = 0; i < sizeof(LineErrorRates) / sizeof(LineErrorRates[0]); i++) {
+		Config.ErrorRate = LineErrorRates[i];
+		VUART_Configure(&Config);
+		InitUART();
+		UART_SetBaudCode(XBEE_BD_115200);
+		VUART_RunReceiveBench(Frames, DAMAGE_PER_256, Seed, &Result);
+
+		printf("line errors %u/65536: sent %u damaged %u accepted %u missed %u "
+			"false %u overruns %u, %.0f frames/s, parser %u bytes\n",
+			LineErrorRates[i], Result.FramesSent, Result.FramesDamaged, Result.Accepted,
+			Result.Missed, Result.FalseAccepts, Result.Overruns, Result.FramesPerSec,
+			Result.ParserBytes);
+	}
+	return 0;
+}
@@ -9,8 +9,10 @@
  -------------- ---     --------
  05/16/2017			RM
 ****************************************************************************/
+#ifndef ES_HOST_BUILD
 #include "inc/hw_gpio.h"
 #include "inc/hw_types.h"
+#endif
 #include "termio.h"
 #include "ADMulti.h"
 
@@ -13,14 +13,24 @@
  05/14/2017			MCH
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+#include <string.h>
+
 #include "ES_Configure.h"
 #include "ES_Framework.h"
 #include "ES_DeferRecall.h"
 
-#include "Hardware.h"
 #include "Constants.h"
+#include "Comm_Service.h"
+#include "UART.h"
 #include "Transmit_SM.h"
 #include "FARMER_SM.h"
+#include "TxQueue.h"
+#include "RxQueue.h"
+#include "PeerTable.h"
+#include "XBeeLink.h"
+#include "PacketCodec.h"
+#include "LinkStats.h"
 
 
 /*----------------------------- Module Defines ----------------------------*/
@@ -28,21 +38,13 @@
 
 
 /*---------------------------- Module Functions ---------------------------*/
-static void ConstructPacket(uint8_t PacketType);
-static void InterpretPacket(uint8_t SizeOfData); 
-void ResetEncryptionIndex(void);
-uint8_t* GetIMUData(void);
+static void ConstructPacket(uint8_t PacketType, uint8_t Slot);
+static void InterpretPacket(const uint8_t *DataPacket_Rx, uint8_t SizeOfData);
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
 
-static uint8_t* DataPacket_Rx;
-static uint8_t DataPacket_Tx[42];
-static uint8_t EncryptionIndex;
-static uint8_t IMU_Data[12];
-static uint8_t DestMSB;
-static uint8_t DestLSB;
-static uint8_t DataFrameLength_Tx;
+static uint16_t ExpectedRxSeq; // sequence number the next received frame should have
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -67,6 +69,10 @@ bool InitComm_Service( uint8_t Priority )
 
   MyPriority = Priority;
 
+  TxQueue_Init();
+  PeerTable_Init();
+  LinkStats_Init();
+
   return true;
 }
 
@@ -115,16 +121,28 @@ ES_Event RunComm_Service( ES_Event ThisEvent )
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
 
 	if (ThisEvent.EventType == ES_DATAPACKET_RECEIVED ) {
-			// call InterpretPacket
-			uint8_t PacketLength = ThisEvent.EventParam;
-			InterpretPacket(PacketLength);
+			// take everything that is waiting, an event can find its frame
+			// already handled by an earlier one
+			const uint8_t *pFrame;
+			uint8_t PacketLength;
+			uint16_t Seq;
+			while (RxQueue_Take(&pFrame, &PacketLength, &Seq)) {
+				if (Seq != ExpectedRxSeq) {
+					printf("lost %u received frames\r\n", (uint16_t)(Seq - ExpectedRxSeq));
+				}
+				ExpectedRxSeq = Seq + 1;
+				InterpretPacket(pFrame, PacketLength);
+				RxQueue_Release();
+				UART_UpdateRxFlow();
+			}
 	} 
 	
 	if (ThisEvent.EventType == ES_SENDPACKET ) {
 			printf("boutta send some shiiiittt \r\n");
 			// call ConstructPacket
-			uint8_t PacketType = ThisEvent.EventParam;
-			ConstructPacket(PacketType);
+			uint8_t PacketType = SENDPACKET_TYPE(ThisEvent.EventParam);
+			uint8_t Slot = SENDPACKET_SLOT(ThisEvent.EventParam);
+			ConstructPacket(PacketType, Slot);
 
 	}
 
@@ -136,160 +154,118 @@ ES_Event RunComm_Service( ES_Event ThisEvent )
     ConstructPacket
 
  Parameters
-    DestMSB, DestLSB, SizeOfData (length of data array to send) 
+    PacketType, one of the FARMER_DOG_ packet types
+    Slot, PeerTable slot of the DOG it is for (NO_PEER for a broadcast
+      REQ_2_PAIR, a slot for one sent to a DOG we are resuming)
 
  Returns
    none
 
+ Description
+   Builds the frame straight into a TxQueue buffer with Packet_Encode and
+   kicks Transmit_SM.
+   Pairing and key frames go in ahead of control frames. If there is no
+   buffer to be had the frame is dropped before anything (encryption
+   index, sensor toggles) is used up.
+
  Author
    Sarah Cabreros
 ****************************************************************************/
-static void ConstructPacket(uint8_t PacketType) {
-		//printf("--------------CONSTRUCTING-----------\n\r");
-					ES_Event NewEvent;
-					
-					// initialize RunningSum variable
-					uint8_t RunningSum = 0;
-					uint8_t CheckSum;
+static void ConstructPacket(uint8_t PacketType, uint8_t Slot) {
+	uint16_t Dest;
+	const uint8_t* Payload;
+	const uint8_t* Key = NULL;
+	uint8_t* pKeyIndex = NULL;
+	uint8_t DogTag;
+	uint8_t FrameLength;
+	
+	// nothing for the DOGs while XBeeLink is still changing the radio's rate
+	if (!XBeeLink_IsReady()) {
+		printf("XBee link not ready, packet %d dropped\r\n", PacketType);
+		return;
+	}
+	
+	// everything but the pairing request goes to one DOG in particular
+	Peer_t* pPeer = PeerTable_Get(Slot);
+	if ((PacketType != FARMER_DOG_REQ_2_PAIR) && ((pPeer == NULL) || (pPeer->State == PeerFree))) {
+		printf("no DOG in slot %d, packet %d dropped\r\n", Slot, PacketType);
+		return;
+	}
+	if ((PacketType == FARMER_DOG_REQ_2_PAIR) && (pPeer != NULL) && (pPeer->State != PeerResuming)) {
+		printf("DOG in slot %d is not being resumed, REQ2PAIR dropped\r\n", Slot);
+		return;
+	}
+	
+	// get a buffer to build the frame in
+	TxLane_t Lane = ((PacketType == FARMER_DOG_CTRL) || (PacketType == FARMER_DOG_CTRL_AGG)) ?
+		TX_LANE_CTRL : TX_LANE_PAIRING;
+	uint8_t FrameID;
+	uint8_t* DataPacket_Tx = TxQueue_Acquire(Lane, (pPeer == NULL) ? NO_PEER : Slot, &FrameID);
+	if (DataPacket_Tx == NULL) {
+		printf("TX queue full, packet %d dropped\r\n", PacketType);
+		return;
+	}
+	
+	// pick out the destination and payload, PacketCodec does the rest
+	switch (PacketType) {
+		case FARMER_DOG_REQ_2_PAIR:
+			if (pPeer != NULL) {
+				// straight to a DOG we lost, to resume its session
+				DogTag = pPeer->DogTag;
+				Dest = pPeer->Address;
+			} else {
+				// broadcast to everyone, the DOG tag says which one we want
+				DogTag = GetDogTag();
+				Dest = BROADCAST_ADDRESS;
+			}
+			Payload = &DogTag;
+			break;
+			
+		case FARMER_DOG_ENCR_KEY:
+			Dest = pPeer->Address;
+			Payload = pPeer->EncryptionKey;
+			break;
+			
+		case FARMER_DOG_CTRL:
+			Dest = pPeer->Address;
+			Payload = GetSensorData();
+			Key = pPeer->EncryptionKey;
+			pKeyIndex = &pPeer->EncryptionIndex;
+			break;
+			
+		case FARMER_DOG_CTRL_AGG:
+			Dest = pPeer->Address;
+			Payload = GetSensorSamples();
+			Key = pPeer->EncryptionKey;
+			pKeyIndex = &pPeer->EncryptionIndex;
+			break;
+			
+		default:
+			// not something we know how to build
+			TxQueue_Abandon();
+			return;
+	}
+	
+	FrameLength = Packet_Encode(DataPacket_Tx, PacketType, FrameID, Dest, Payload, Key, pKeyIndex);
+	printf("Packet %d built for %x (Comm Service)\r\n", PacketType, Dest);
 	
-					// initialize pointer to data
-					uint8_t* DataToSend;
-					
-					//Header Construction
-					DataPacket_Tx[START_BYTE_INDEX] = START_DELIMITER; // don't add to RunningSum
-					DataPacket_Tx[LENGTH_MSB_BYTE_INDEX] = 0x00; // don't add to RunningSum
-		
-					DataPacket_Tx[API_IDENT_BYTE_INDEX_TX] = API_IDENTIFIER_Tx;
-					RunningSum += API_IDENTIFIER_Tx;
-					DataPacket_Tx[FRAME_ID_BYTE_INDEX] = FRAME_ID;
-					RunningSum += FRAME_ID;
-					DataPacket_Tx[OPTIONS_BYTE_INDEX_TX] = OPTIONS;
-					RunningSum += OPTIONS;
+	// queue it up
+	TxQueue_Commit(FrameLength);
+	LinkStats_FrameSent(FrameID, (pPeer == NULL) ? NO_PEER : Slot, FrameLength);
 	
-					switch (PacketType) {
-						case FARMER_DOG_REQ_2_PAIR:
-							printf("Req 2 Pair Construction (Comm Service) \n\r");
-						
-							// broadcast to everyone
-							DestMSB = 0xFF;
-							DestLSB = 0xFF;
-							DataPacket_Tx[DEST_ADDRESS_MSB_INDEX] = DestMSB; 
-							RunningSum += DestMSB;
-							DataPacket_Tx[DEST_ADDRESS_LSB_INDEX] = DestLSB; 
-							RunningSum += DestLSB;
-						
-						
-							//add the unique frame length
-							DataPacket_Tx[LENGTH_LSB_BYTE_INDEX] = REQ_2_PAIR_LENGTH; // don't add to RunningSum
-						
-							//add the packet type
-							DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX] = FARMER_DOG_REQ_2_PAIR;
-							RunningSum += FARMER_DOG_REQ_2_PAIR;
-							printf("Header is %d\r\n",DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX]);
-						
-							//get data
-							uint8_t DogTag = GetDogTag();
-						
-							//add data 
-							DataPacket_Tx[DATA_BYTE_INDEX_TX] = DogTag;
-							RunningSum += DogTag;
-						
-							// calculate and add check sum
-							CheckSum = 0xFF - RunningSum;
-							DataPacket_Tx[DATA_BYTE_INDEX_TX+1] = CheckSum;
-							
-						  //set the frame length as event param
-							DataFrameLength_Tx = REQ_2_PAIR_LENGTH;
-							NewEvent.EventParam = REQ_2_PAIR_LENGTH;						
-							break;
-							
-						case FARMER_DOG_ENCR_KEY:
-							printf("Encryption Key Construction (Comm Service) \n\r");
-						
-							// add destination address
-							DataPacket_Tx[DEST_ADDRESS_MSB_INDEX] = DestMSB; 
-							RunningSum += DestMSB;
-							DataPacket_Tx[DEST_ADDRESS_LSB_INDEX] = DestLSB; 
-							RunningSum += DestLSB;
-						
-							//add the unique frame length
-							DataPacket_Tx[LENGTH_LSB_BYTE_INDEX] = ENCR_KEY_LENGTH; // don't add to RunningSum
-						
-							//add the packet type
-							DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX] = FARMER_DOG_ENCR_KEY;
-							RunningSum += FARMER_DOG_ENCR_KEY;
-						  printf("Header is %d\r\n",DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX]); 
-							
-							// get data (encryption key)
-							DataToSend = GetEncryptionKey();
-						
-							// add data
-							for (int i = 0; i < 32; i++) {
-								DataPacket_Tx[DATA_BYTE_INDEX_TX+i] = *(DataToSend + i);
-								RunningSum += *(DataToSend + i);
-							}
-						
-							// add check sum
-							CheckSum = 0xFF - RunningSum;
-							DataPacket_Tx[DATA_BYTE_INDEX_TX + 32] = CheckSum;
-						
-						  //set the frame length as event param
-							DataFrameLength_Tx = ENCR_KEY_LENGTH;
-							NewEvent.EventParam = ENCR_KEY_LENGTH;	
-							break;
-							
-						case FARMER_DOG_CTRL:
-							printf("Farmer Control Construction \n\r");
-						
-							// add destination address
-							DataPacket_Tx[DEST_ADDRESS_MSB_INDEX] = DestMSB; 
-							RunningSum += DestMSB;
-							DataPacket_Tx[DEST_ADDRESS_LSB_INDEX] = DestLSB; 
-							RunningSum += DestLSB;				
-						
-							//add the unique frame length
-							DataPacket_Tx[LENGTH_LSB_BYTE_INDEX] = CTRL_LENGTH; // don't add to RunningSum
-							
-							// get encryption key
-							uint8_t* EncryptionData = GetEncryptionKey();
-							//uint8_t EncryptionKey = *(EncryptionData + EncryptionIndex);
-						
-							//encrypt + add the packet type
-							DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX] = FARMER_DOG_CTRL^(*(EncryptionData + EncryptionIndex));
-						 printf("Header is %d\r\n",DataPacket_Tx[PACKET_TYPE_BYTE_INDEX_TX]);
-							RunningSum += FARMER_DOG_CTRL^(*(EncryptionData + EncryptionIndex));
-							// increment encryption index
-							EncryptionIndex++;
-							if (EncryptionIndex > 31) EncryptionIndex = 0;
-						
-							// get data (from sensors)
-							DataToSend = GetSensorData(); 
-						
-							// encrypt data THEN add data
-							for (int i = 0; i < 3; i++) {
-								uint8_t CurrentDataByte = *(DataToSend + i);
-								printf("Sending byte: %i\r\n", CurrentDataByte);
-								DataPacket_Tx[DATA_BYTE_INDEX_TX+i] = CurrentDataByte^(*(EncryptionData + EncryptionIndex));
-								RunningSum += CurrentDataByte^(*(EncryptionData + EncryptionIndex));
-								// increment encryption index
-								EncryptionIndex++;
-								if (EncryptionIndex > 31) EncryptionIndex = 0;
-							}
-						
-							// add check sum
-							CheckSum = 0xFF - RunningSum;
-							DataPacket_Tx[DATA_BYTE_INDEX_TX + 3] = CheckSum; 
-						
-						  //set the frame length as event param
-							DataFrameLength_Tx = CTRL_LENGTH;
-							NewEvent.EventParam = CTRL_LENGTH;	
-							break;
-					}
-		
-					NewEvent.EventType = ES_START_XMIT;
-					//Post NewEvent to transmit service
-					PostTransmit_SM(NewEvent);
-					
+	// FARMER_SM compares the inputs against what this DOG was last sent
+	if (PacketType == FARMER_DOG_CTRL) {
+		memcpy(pPeer->LastCtrl, Payload, CTRL_DATA_LENGTH);
+		pPeer->LastCtrlTime = ES_Timer_GetTime();
+	} else if (PacketType == FARMER_DOG_CTRL_AGG) {
+		memcpy(pPeer->LastCtrl, &Payload[CTRL_AGG_NEWEST_INDEX], CTRL_DATA_LENGTH);
+		pPeer->LastCtrlTime = ES_Timer_GetTime();
+	}
+	
+	ES_Event NewEvent;
+	NewEvent.EventType = ES_START_XMIT;
+	//Post NewEvent to transmit service
+	PostTransmit_SM(NewEvent);
 }
 
 /****************************************************************************
@@ -297,74 +273,95 @@ static void ConstructPacket(uint8_t PacketType) {
     InterpretPacket
 
  Parameters
+    DataPacket_Rx (frame data, owned by us until RxQueue_Release)
     SizeOfData (length of data frame received [API ID -> all data]) 
 
  Returns
    none
 
+ Description
+   Packets from DOGs are matched to their PeerTable slot by source address.
+   ES_DOG_ACK_RECEIVED carries the source address (the DOG may not have a
+   slot yet), the other DOG events carry the slot. Packets from DOGs we
+   don't have a slot for are ignored.
+
  Author
    Sarah Cabreros
 ****************************************************************************/
-static void InterpretPacket(uint8_t SizeOfData) {
-	DataPacket_Rx	= GetDataPacket();
+static void InterpretPacket(const uint8_t *DataPacket_Rx, uint8_t SizeOfData) {
 	uint8_t API_Ident = *(DataPacket_Rx + API_IDENT_BYTE_INDEX_RX);
 	if (API_Ident == API_IDENTIFIER_Rx) {
 			printf("RECEIVED A DATAPACKET (Comm_Service) \n\r");
 			ES_Event NewEvent;
-			uint8_t PacketType = *(DataPacket_Rx + PACKET_TYPE_BYTE_INDEX_RX);
-			switch (PacketType) {
+			PacketView_t Packet;
+			
+			if (!Packet_Decode(DataPacket_Rx, SizeOfData, &Packet)) {
+				printf("packet not in the schema or too short, ignored\r\n");
+				return;
+			}
+			uint8_t Slot = PeerTable_Find(Packet.Source);
+			Peer_t* pPeer = PeerTable_Get(Slot);
+			LinkStats_FrameReceived(Slot, Packet.RSSI, SizeOfData, Packet.PacketType == DOG_FARMER_REPORT);
+			
+			if (Packet.PacketType == DOG_ACK) {
+				NewEvent.EventType = ES_DOG_ACK_RECEIVED;
+				NewEvent.EventParam = Packet.Source; // FARMER_SM decides whether to take it on
+				printf("Dog Ack\r\n");
+				PostFARMER_SM(NewEvent);
+				return;
+			}
+			
+			if (pPeer == NULL) {
+				printf("packet from unknown DOG %x ignored\r\n", Packet.Source);
+				return;
+			}
+			
+			switch (Packet.PacketType) {
 				case DOG_FARMER_REPORT :
 					NewEvent.EventType = ES_DOG_REPORT_RECEIVED;
-					// get IMU data
-					for (int i = 0; i < 12; i++ ) {
-						IMU_Data[i] = *(DataPacket_Rx + PACKET_TYPE_BYTE_INDEX_RX + i + 1); // IMU data starts AFTER packet type byte
-						printf("IMU data: %i\r\n", IMU_Data[i]);
-						//printf("Dog_Farmer_Report\r\n");
-					}
-					break;
-				case DOG_ACK :
-					NewEvent.EventType = ES_DOG_ACK_RECEIVED;
-					
-					// save source address to destination address)
-					DestMSB = *(DataPacket_Rx + SOURCE_ADDRESS_MSB_INDEX);
-					DestLSB = *(DataPacket_Rx + SOURCE_ADDRESS_LSB_INDEX);
-					printf("Dog Ack\r\n");
+					memcpy(pPeer->IMU_Data, Packet.Payload, Packet.PayloadLength);
 					break;
 				case DOG_FARMER_RESET_ENCR :
 					NewEvent.EventType = ES_DOG_RESET_ENCR_RECEIVED;
-				printf("Dog farmer reset encr\r\n");
+					LinkStats_KeyReset(Slot);
+					printf("Dog farmer reset encr\r\n");
 					break;
+				default :
+					return;
 			}
-			NewEvent.EventParam = SizeOfData; //the frame length
+			NewEvent.EventParam = Slot;
 			PostFARMER_SM(NewEvent);
 		} else if (API_Ident == API_IDENTIFIER_Tx_Result) { 
 			printf("RECEIVED A TRANSMISSION RESULT DATAPACKET (Comm_Service): ");
+			uint8_t TxFrameID = *(DataPacket_Rx + FRAME_ID_BYTE_INDEX_RX);
 			uint8_t TxStatusResult = *(DataPacket_Rx + TX_STATUS_BYTE_INDEX);
 			if (TxStatusResult == SUCCESS) {
 				printf("SUCCESS\n\r");
 			} else {
 				printf("FAILURE\n\r");
-				//RESEND THE TX DATA PACKET -- ADD CODE IN HERE
-							ES_Event NewEvent;
-							NewEvent.EventType = ES_START_XMIT;
-							NewEvent.EventParam = DataFrameLength_Tx;
-							PostTransmit_SM(NewEvent);
 			}
+			// settle the frame this status is for (a failure may queue it to be
+			// sent again), then kick Transmit_SM since the window has room now
+			TxQueue_TxStatus(TxFrameID, TxStatusResult == SUCCESS);
+			LinkStats_TxStatus(TxFrameID, TxStatusResult == SUCCESS);
+			ES_Event NewEvent;
+			NewEvent.EventType = ES_START_XMIT;
+			PostTransmit_SM(NewEvent);
+		} else if (API_Ident == API_IDENTIFIER_AT_Response) {
+			uint8_t ATFrameID = *(DataPacket_Rx + FRAME_ID_BYTE_INDEX_RX);
+			uint8_t ATStatus = *(DataPacket_Rx + AT_STATUS_BYTE_INDEX);
+			printf("AT %c%c response: %u\n\r", *(DataPacket_Rx + AT_COMMAND_BYTE_INDEX_RX),
+				*(DataPacket_Rx + AT_COMMAND_BYTE_INDEX_RX + 1), ATStatus);
+			// the AT frame went through the TxQueue, so this is its status too
+			TxQueue_TxStatus(ATFrameID, true);
+			ES_Event NewEvent;
+			NewEvent.EventType = ES_AT_RESPONSE;
+			NewEvent.EventParam = AT_RESPONSE_PARAM(ATFrameID, ATStatus);
+			PostXBeeLink(NewEvent);
+			NewEvent.EventType = ES_START_XMIT;
+			PostTransmit_SM(NewEvent);
 		} else if (API_Ident == API_IDENTIFIER_Reset) {
 			printf("Hardware Reset Status Message \n\r");
 		}
 }
 
-
-/******GETTER FUNCTIONS************/
-uint8_t* GetDataPacket_Tx (void) {
-  return &DataPacket_Tx[0];
-}
-
-uint8_t* GetIMUData (void) {
-	return &IMU_Data[0];
-}
-
-void ResetEncryptionIndex(void) {
-	EncryptionIndex = 0;
-}
@@ -0,0 +1,651 @@
+/****************************************************************************
+ Module
+   DogSim.c
+
+ Description
+   Host stand-in for the DOGs and their XBees, on the far end of the
+   virtual UART (VirtualUART.c). It reads the FARMER's API frames off the
+   transmit wire and answers the way the radios and the DOGs would:
+
+   - AT commands get an OK AT response, so XBeeLink finishes its setup
+   - every TX request gets a transmit status. Unicasts get up to
+     MAC_ATTEMPTS tries over the air and fail if all of them are lost,
+     broadcasts get one try and always report success
+   - a DOG answers a FARMER_DOG_REQ_2_PAIR for its tag with a DOG_ACK,
+     takes its key from FARMER_DOG_ENCR_KEY, decrypts every CTRL and
+     CTRL_AGG with it, and asks for DOG_FARMER_RESET_ENCR when one doesn't
+     decrypt
+   - paired DOGs send DOG_FARMER_REPORT every ReportPeriodMs, and drop the
+     pairing after LOST_COMM_TIME without a clean packet
+
+   Loss, latency, jitter, an outage and forced encryption resets come from
+   the scenario. So do other FARMERs on the same channel, which are not
+   simulated in full but hold the channel for OtherAirMs at a time, either
+   free running or in their TDMA slots. Any attempt, either way, that
+   overlaps one of them is lost and counted as a collision.
+   DogSim_RunScenario runs the FARMER stack against it one millisecond at
+   a time, presses the pair button whenever a DOG is left unpaired, and
+   reports time to pair, reconnect time, control packet gaps and latency
+   percentiles, and packet loss.
+
+ Notes
+   Only built with ES_HOST_BUILD. Host/DogSimMain.c links the FARMER stack
+   with VirtualUART.c and HostHardware.c and calls DogSim_RunScenario with
+   a step function that ticks the ES timers and runs the services; run it
+   with make -C Host run-dogsim. Simulated time comes from the runner, one
+   call to DogSim_Poll per ms.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+#ifdef ES_HOST_BUILD
+/*----------------------------- Include Files -----------------------------*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+
+#include "Constants.h"
+#include "DogSim.h"
+#include "VirtualUART.h"
+#include "XBeeParser.h"
+#include "PacketCodec.h"
+#include "TxQueue.h"
+#include "FARMER_SM.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define DOG_ADDRESS_BASE    0x2180  // DOG n is at this plus n
+#define MAC_ATTEMPTS        4       // first try and three MAC retries
+#define MAC_RETRY_MS        2       // backoff and ack wait per retry
+#define TX_STATUS_NO_ACK    0x01
+#define AT_STATUS_OK        0
+#define PENDING_SIZE        32      // frames in the air either way
+#define NO_DOG              0xFF
+
+typedef enum { DogUnpaired, DogAcked, DogPaired } SimDogState_t ;
+
+typedef struct {
+	uint16_t Address;
+	uint8_t Tag;
+	SimDogState_t State;
+	uint8_t Key[NUM_ENCRYPTION_BYTES];
+	uint8_t KeyIndex;
+	uint32_t PairRequestMs;  // when the REQ_2_PAIR we ACKed left the FARMER
+	uint32_t LastHeardMs;    // last clean packet from the FARMER
+	uint32_t LastCtrlMs;
+	bool HadCtrl;            // LastCtrlMs is good
+	uint32_t NextReportMs;
+	uint32_t NextResetMs;
+	uint8_t ReportCount;
+} SimDog_t;
+
+// a frame on its way, RF data for a DOG or a whole API frame for the FARMER
+typedef struct {
+	bool Used;
+	uint8_t Dog;             // NO_DOG for the FARMER
+	uint32_t DueMs;
+	uint32_t SentMs;         // when it left the FARMER's UART
+	uint32_t Order;          // keeps frames due on the same ms in order
+	uint8_t Length;
+	uint8_t Data[TX_FRAME_SIZE];
+} SimFrame_t;
+
+// another FARMER, only as far as when it is on the air
+typedef struct {
+	bool HasSent;            // LastMs is good
+	uint32_t LastMs;
+	uint32_t NextMs;
+} SimFarmer_t;
+
+typedef struct {
+	uint32_t Samples[DOGSIM_MAX_SAMPLES];
+	uint32_t Count;
+} SampleSet_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void HandleFarmerFrame(const uint8_t *pFrame, uint8_t Length, uint32_t NowMs);
+static void DogReceive(uint8_t Which, const uint8_t *pRF, uint8_t Length, uint32_t SentMs, uint32_t NowMs);
+static void RunDogs(uint32_t NowMs);
+static void RunOtherFarmers(uint32_t NowMs);
+static bool ChannelBusy(uint32_t NowMs);
+static bool SendToFarmer(uint8_t Which, uint8_t PacketType, const uint8_t *pPayload, uint8_t PayloadLength,
+	uint32_t NowMs);
+static void QueueAPIFrame(const uint8_t *pFrameData, uint8_t Length, uint32_t DueMs);
+static SimFrame_t* NewFrame(uint32_t DueMs);
+static void DeliverDue(uint32_t NowMs);
+static uint8_t AirAttempts(uint32_t NowMs, uint8_t MaxAttempts);
+static uint32_t AirDelay(uint8_t Attempts);
+static bool AnyUnpaired(void);
+static void AddSample(SampleSet_t *pSet, uint32_t Value);
+static void Summarize(SampleSet_t *pSet, DogSimPercentiles_t *pOut);
+static int CompareSamples(const void *pA, const void *pB);
+static uint32_t Random(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static DogSimScenario_t Scenario;
+static DogSimResult_t Stats;
+static SimDog_t Dogs[DOGSIM_MAX_DOGS];
+static SimFrame_t InAir[PENDING_SIZE];
+static SimFarmer_t Others[DOGSIM_MAX_FARMERS];
+static uint32_t NextOrder;
+static XBeeParser_t FarmerParser; // API frames coming off the FARMER's UART
+static uint32_t RandomState;
+
+static bool SawPairRequest;
+static uint32_t FirstPairRequestMs;
+static bool WaitingReconnect;
+
+static SampleSet_t PairTimes;
+static SampleSet_t CtrlGaps;
+static SampleSet_t CtrlLatencies;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     DogSim_Init
+
+ Parameters
+     const DogSimScenario_t * : the DOGs and the channel to simulate
+
+ Description
+     Starts every DOG unpaired with nothing in the air. The FARMER side
+     (InitUART) is left alone.
+****************************************************************************/
+void DogSim_Init(const DogSimScenario_t *pScenario) {
+	uint32_t CycleStart;
+	uint8_t i;
+
+	Scenario = *pScenario;
+	if ((Scenario.NumDogs == 0) || (Scenario.NumDogs > DOGSIM_MAX_DOGS)) {
+		Scenario.NumDogs = 1;
+	}
+	memset(&Stats, 0, sizeof(Stats));
+	memset(Dogs, 0, sizeof(Dogs));
+	memset(InAir, 0, sizeof(InAir));
+	for (i = 0; i < Scenario.NumDogs; i++) {
+		Dogs[i].Address = DOG_ADDRESS_BASE + i;
+		Dogs[i].Tag = Scenario.DogTags[i];
+		Dogs[i].State = DogUnpaired;
+	}
+	NextOrder = 0;
+	XBee_ParserInit(&FarmerParser);
+	RandomState = (Scenario.Seed != 0) ? Scenario.Seed : 1;
+
+	// the others' cycle starts wherever it likes relative to ours
+	if (Scenario.OtherFarmers > DOGSIM_MAX_FARMERS) {
+		Scenario.OtherFarmers = DOGSIM_MAX_FARMERS;
+	}
+	if (Scenario.OtherPeriodMs == 0) {
+		Scenario.OtherPeriodMs = TDMA_FRAME_TIME;
+	}
+	memset(Others, 0, sizeof(Others));
+	CycleStart = Random() % TDMA_FRAME_TIME;
+	for (i = 0; i < Scenario.OtherFarmers; i++) {
+		Others[i].NextMs = Scenario.OthersSlotted ? CycleStart + i * TDMA_SLOT_TIME : Random() % Scenario.OtherPeriodMs;
+	}
+	SawPairRequest = false;
+	FirstPairRequestMs = 0;
+	WaitingReconnect = (Scenario.OutageMs != 0);
+	PairTimes.Count = 0;
+	CtrlGaps.Count = 0;
+	CtrlLatencies.Count = 0;
+}
+
+/****************************************************************************
+ Function
+     DogSim_Poll
+
+ Parameters
+     uint32_t : simulated time in ms
+
+ Description
+     Takes whatever the FARMER has sent since the last call, delivers the
+     frames that have arrived at either end, and runs the DOGs' timers
+****************************************************************************/
+void DogSim_Poll(uint32_t NowMs) {
+	uint8_t Bytes[64];
+	uint16_t Count;
+	uint16_t i;
+
+	while ((Count = VUART_TakeTx(Bytes, sizeof(Bytes))) != 0) {
+		for (i = 0; i < Count; i++) {
+			if (XBee_ParseByte(&FarmerParser, Bytes[i]) == XBEE_FRAME_GOOD) {
+				do {
+					HandleFarmerFrame(FarmerParser.Frame, FarmerParser.FrameLength, NowMs);
+				} while (XBee_ParseMore(&FarmerParser) == XBEE_FRAME_GOOD);
+			}
+		}
+	}
+
+	RunOtherFarmers(NowMs);
+	DeliverDue(NowMs);
+	RunDogs(NowMs);
+}
+
+/****************************************************************************
+ Function
+     DogSim_RunScenario
+
+ Parameters
+     const DogSimScenario_t * : what to simulate
+     DogSimStep_t : runs the FARMER stack for one ms
+     DogSimResult_t * : filled in at the end
+
+ Description
+     Steps the FARMER, the virtual UART and the DOGs together for
+     DurationMs. ES_PAIR goes to FARMER_SM at the start and again every
+     PairRetryMs while any DOG is unpaired, like a pilot pressing the
+     button until everyone is on.
+****************************************************************************/
+void DogSim_RunScenario(const DogSimScenario_t *pScenario, DogSimStep_t Step, DogSimResult_t *pResult) {
+	uint16_t RetryMs = (pScenario->PairRetryMs != 0) ? pScenario->PairRetryMs : ONE_SEC;
+	uint32_t LastPressMs = 0;
+	bool Pressed = false;
+	uint32_t NowMs;
+	uint32_t Lost;
+	uint32_t Sent;
+
+	DogSim_Init(pScenario);
+
+	for (NowMs = 0; NowMs < Scenario.DurationMs; NowMs++) {
+		if (AnyUnpaired() && (!Pressed || (NowMs - LastPressMs >= RetryMs))) {
+			ES_Event ThisEvent;
+			ThisEvent.EventType = ES_PAIR;
+			PostFARMER_SM(ThisEvent);
+			LastPressMs = NowMs;
+			Pressed = true;
+		}
+		Step();
+		VUART_Advance(1000);
+		DogSim_Poll(NowMs);
+	}
+
+	Summarize(&PairTimes, &Stats.PairMs);
+	Summarize(&CtrlGaps, &Stats.CtrlGapMs);
+	Summarize(&CtrlLatencies, &Stats.CtrlLatencyMs);
+	Lost = ((Stats.CtrlSent > Stats.CtrlReceived) ? Stats.CtrlSent - Stats.CtrlReceived : 0) + Stats.ReportsLost;
+	Sent = Stats.CtrlSent + Stats.ReportsSent;
+	Stats.LossPercent = (Sent != 0) ? 100.0f * Lost / Sent : 0.0f;
+	*pResult = Stats;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// An API frame from the FARMER, as its XBee would take it
+static void HandleFarmerFrame(const uint8_t *pFrame, uint8_t Length, uint32_t NowMs) {
+	uint8_t Reply[AT_HEADER_LENGTH + 2];
+	const uint8_t *pRF;
+	uint8_t RFLength;
+	uint16_t Dest;
+	bool Delivered = false;
+	uint8_t i;
+
+	if ((pFrame[0] == API_IDENTIFIER_AT) || (pFrame[0] == API_IDENTIFIER_AT_Queue)) {
+		if (Length < AT_HEADER_LENGTH) {
+			return;
+		}
+		Reply[0] = API_IDENTIFIER_AT_Response;
+		Reply[1] = pFrame[1];
+		Reply[2] = pFrame[2];
+		Reply[3] = pFrame[3];
+		Reply[4] = AT_STATUS_OK;
+		// a query gets the value back, the baud rate is the only one asked for
+		if (Length == AT_HEADER_LENGTH) {
+			Reply[5] = LINK_TARGET_BD;
+			QueueAPIFrame(Reply, AT_HEADER_LENGTH + 2, NowMs + 1);
+		} else {
+			QueueAPIFrame(Reply, AT_HEADER_LENGTH + 1, NowMs + 1);
+		}
+		return;
+	}
+	if ((pFrame[0] != API_IDENTIFIER_Tx) || (Length <= TX_API_OVERHEAD)) {
+		return;
+	}
+
+	Dest = (pFrame[DEST_ADDRESS_MSB_INDEX - HEADER_LENGTH] << 8) | pFrame[DEST_ADDRESS_LSB_INDEX - HEADER_LENGTH];
+	pRF = &pFrame[TX_API_OVERHEAD];
+	RFLength = Length - TX_API_OVERHEAD;
+	Stats.FramesToDogs++;
+	if ((Length == PKT_LENGTH_CTRL) || (Length == PKT_LENGTH_CTRL_AGG)) {
+		Stats.CtrlSent++;
+	}
+	if (!SawPairRequest && (pRF[0] == FARMER_DOG_REQ_2_PAIR) && (Length == PKT_LENGTH_REQ_2_PAIR)) {
+		SawPairRequest = true;
+		FirstPairRequestMs = NowMs;
+	}
+
+	for (i = 0; i < Scenario.NumDogs; i++) {
+		if ((Dest == BROADCAST_ADDRESS) || (Dest == Dogs[i].Address)) {
+			uint8_t Attempts = AirAttempts(NowMs, (Dest == BROADCAST_ADDRESS) ? 1 : MAC_ATTEMPTS);
+			if (Attempts != 0) {
+				SimFrame_t *pAir = NewFrame(NowMs + AirDelay(Attempts));
+				if (pAir != NULL) {
+					pAir->Dog = i;
+					pAir->SentMs = NowMs;
+					pAir->Length = RFLength;
+					memcpy(pAir->Data, pRF, RFLength);
+				}
+				Delivered = true;
+			}
+		}
+	}
+
+	if (pFrame[FRAME_ID_BYTE_INDEX - HEADER_LENGTH] != 0) {
+		Reply[0] = API_IDENTIFIER_Tx_Result;
+		Reply[1] = pFrame[FRAME_ID_BYTE_INDEX - HEADER_LENGTH];
+		Reply[2] = SUCCESS;
+		if ((Dest != BROADCAST_ADDRESS) && !Delivered) {
+			Reply[2] = TX_STATUS_NO_ACK;
+			Stats.TxStatusFailed++;
+		}
+		QueueAPIFrame(Reply, 3, NowMs + AirDelay(MAC_ATTEMPTS));
+	}
+}
+
+// RF data that made it to a DOG. Plain packets are told apart from
+// encrypted ones by their length. A control packet with the clear key
+// index in front is decrypted from there, whatever the DOG expected
+static void DogReceive(uint8_t Which, const uint8_t *pRF, uint8_t Length, uint32_t SentMs, uint32_t NowMs) {
+	SimDog_t *pDog = &Dogs[Which];
+	uint8_t Plain;
+	uint8_t i;
+
+	if ((Length == 2) && (pRF[0] == FARMER_DOG_REQ_2_PAIR)) {
+		// a DOG that takes any tag only answers while it has no FARMER, one
+		// with its own tag answers again if the FARMER has forgotten it
+		if (((pDog->Tag == 0) && (pDog->State != DogPaired)) || ((pDog->Tag != 0) && (pRF[1] == pDog->Tag))) {
+			pDog->State = DogAcked;
+			pDog->PairRequestMs = SentMs;
+			SendToFarmer(Which, DOG_ACK, NULL, 0, NowMs);
+		}
+		return;
+	}
+	if ((Length == 1 + NUM_ENCRYPTION_BYTES) && (pRF[0] == FARMER_DOG_ENCR_KEY)) {
+		if (pDog->State == DogAcked) {
+			memcpy(pDog->Key, &pRF[1], NUM_ENCRYPTION_BYTES);
+			pDog->KeyIndex = 0;
+			pDog->State = DogPaired;
+			pDog->LastHeardMs = NowMs;
+			pDog->HadCtrl = false;
+			pDog->NextReportMs = NowMs + Scenario.ReportPeriodMs;
+			pDog->NextResetMs = NowMs + Scenario.ResetEncrEveryMs;
+			Stats.Pairings++;
+			AddSample(&PairTimes, NowMs - pDog->PairRequestMs);
+			if ((Stats.FirstPairMs == 0) && SawPairRequest) {
+				Stats.FirstPairMs = NowMs - FirstPairRequestMs;
+			}
+		}
+		return;
+	}
+	if (pDog->State != DogPaired) {
+		return;
+	}
+
+	if ((pRF[0] & KEY_INDEX_FLAG) &&
+			((Length == 2 + CTRL_DATA_LENGTH) || (Length == 2 + CTRL_AGG_LENGTH))) {
+		if ((pRF[0] & KEY_INDEX_MASK) != pDog->KeyIndex) {
+			Stats.CtrlIndexJumps++;
+			pDog->KeyIndex = pRF[0] & KEY_INDEX_MASK;
+		}
+		pRF++;
+		Length--;
+	}
+	Plain = pRF[0] ^ pDog->Key[pDog->KeyIndex];
+	if (((Plain == FARMER_DOG_CTRL) && (Length == 1 + CTRL_DATA_LENGTH)) ||
+			((Plain == FARMER_DOG_CTRL_AGG) && (Length == 1 + CTRL_AGG_LENGTH))) {
+		// step the key past the type byte and the payload
+		for (i = 0; i < Length; i++) {
+			if (++pDog->KeyIndex == NUM_ENCRYPTION_BYTES) pDog->KeyIndex = 0;
+		}
+		Stats.CtrlReceived++;
+		if (pDog->HadCtrl) {
+			AddSample(&CtrlGaps, NowMs - pDog->LastCtrlMs);
+		}
+		AddSample(&CtrlLatencies, NowMs - SentMs);
+		pDog->LastCtrlMs = NowMs;
+		pDog->HadCtrl = true;
+		pDog->LastHeardMs = NowMs;
+
+		if (WaitingReconnect && (NowMs >= Scenario.OutageStartMs + Scenario.OutageMs)) {
+			Stats.ReconnectMs = NowMs - (Scenario.OutageStartMs + Scenario.OutageMs);
+			WaitingReconnect = false;
+		}
+	} else {
+		Stats.CtrlBadKey++;
+		Stats.ResetEncrSent++;
+		pDog->KeyIndex = 0;
+		SendToFarmer(Which, DOG_FARMER_RESET_ENCR, NULL, 0, NowMs);
+	}
+}
+
+// Reports, forced key resets and lost communication on the DOG side
+static void RunDogs(uint32_t NowMs) {
+	uint8_t Report[IMU_DATA_LENGTH];
+	uint8_t i;
+	uint8_t j;
+
+	for (i = 0; i < Scenario.NumDogs; i++) {
+		SimDog_t *pDog = &Dogs[i];
+		if (pDog->State != DogPaired) {
+			continue;
+		}
+		if (NowMs - pDog->LastHeardMs >= LOST_COMM_TIME) {
+			pDog->State = DogUnpaired;
+			continue;
+		}
+		if ((Scenario.ReportPeriodMs != 0) && ((int32_t)(NowMs - pDog->NextReportMs) >= 0)) {
+			// something that looks like it is moving
+			for (j = 0; j < IMU_DATA_LENGTH; j++) {
+				Report[j] = pDog->ReportCount + j * 16;
+			}
+			pDog->ReportCount++;
+			Stats.ReportsSent++;
+			if (!SendToFarmer(i, DOG_FARMER_REPORT, Report, IMU_DATA_LENGTH, NowMs)) {
+				Stats.ReportsLost++;
+			}
+			pDog->NextReportMs += Scenario.ReportPeriodMs;
+		}
+		if ((Scenario.ResetEncrEveryMs != 0) && ((int32_t)(NowMs - pDog->NextResetMs) >= 0)) {
+			pDog->KeyIndex = 0;
+			Stats.ResetEncrSent++;
+			SendToFarmer(i, DOG_FARMER_RESET_ENCR, NULL, 0, NowMs);
+			pDog->NextResetMs += Scenario.ResetEncrEveryMs;
+		}
+	}
+}
+
+// Sends a DOG packet to the FARMER, false if every try was lost
+static bool SendToFarmer(uint8_t Which, uint8_t PacketType, const uint8_t *pPayload, uint8_t PayloadLength,
+	uint32_t NowMs) {
+	uint8_t FrameData[MAX_FRAME_LENGTH];
+	uint8_t Attempts = AirAttempts(NowMs, MAC_ATTEMPTS);
+
+	if (Attempts == 0) {
+		return false;
+	}
+	FrameData[API_IDENT_BYTE_INDEX_RX] = API_IDENTIFIER_Rx;
+	FrameData[SOURCE_ADDRESS_MSB_INDEX] = Dogs[Which].Address >> 8;
+	FrameData[SOURCE_ADDRESS_LSB_INDEX] = Dogs[Which].Address & 0xFF;
+	FrameData[RSSI_BYTE_INDEX] = 40 + Random() % 30;
+	FrameData[OPTIONS_BYTE_INDEX_RX] = OPTIONS;
+	FrameData[PACKET_TYPE_BYTE_INDEX_RX] = PacketType;
+	if (PayloadLength != 0) {
+		memcpy(&FrameData[PACKET_TYPE_BYTE_INDEX_RX + 1], pPayload, PayloadLength);
+	}
+	QueueAPIFrame(FrameData, RX_API_OVERHEAD + 1 + PayloadLength, NowMs + AirDelay(Attempts));
+	return true;
+}
+
+// Wraps frame data in delimiter, length and checksum, for the FARMER's UART
+static void QueueAPIFrame(const uint8_t *pFrameData, uint8_t Length, uint32_t DueMs) {
+	SimFrame_t *pAir = NewFrame(DueMs);
+	uint8_t Sum = 0;
+	uint8_t i;
+
+	if (pAir == NULL) {
+		return;
+	}
+	pAir->Dog = NO_DOG;
+	pAir->Data[START_BYTE_INDEX] = START_DELIMITER;
+	pAir->Data[LENGTH_MSB_BYTE_INDEX] = 0;
+	pAir->Data[LENGTH_LSB_BYTE_INDEX] = Length;
+	for (i = 0; i < Length; i++) {
+		pAir->Data[HEADER_LENGTH + i] = pFrameData[i];
+		Sum += pFrameData[i];
+	}
+	pAir->Data[HEADER_LENGTH + Length] = 0xFF - Sum;
+	pAir->Length = HEADER_LENGTH + Length + 1;
+}
+
+// A free slot in the air, NULL if there are PENDING_SIZE frames in flight
+static SimFrame_t* NewFrame(uint32_t DueMs) {
+	uint8_t i;
+
+	for (i = 0; i < PENDING_SIZE; i++) {
+		if (!InAir[i].Used) {
+			InAir[i].Used = true;
+			InAir[i].DueMs = DueMs;
+			InAir[i].SentMs = DueMs;
+			InAir[i].Order = NextOrder++;
+			return &InAir[i];
+		}
+	}
+	return NULL;
+}
+
+// Hands over every frame that has arrived, oldest first
+static void DeliverDue(uint32_t NowMs) {
+	for (;;) {
+		SimFrame_t *pNext = NULL;
+		uint8_t i;
+
+		for (i = 0; i < PENDING_SIZE; i++) {
+			SimFrame_t *pAir = &InAir[i];
+			if (pAir->Used && ((int32_t)(NowMs - pAir->DueMs) >= 0) &&
+					((pNext == NULL) || ((int32_t)(pAir->DueMs - pNext->DueMs) < 0) ||
+					((pAir->DueMs == pNext->DueMs) && ((int32_t)(pAir->Order - pNext->Order) < 0)))) {
+				pNext = pAir;
+			}
+		}
+		if (pNext == NULL) {
+			return;
+		}
+		pNext->Used = false;
+		if (pNext->Dog == NO_DOG) {
+			VUART_InjectRx(pNext->Data, pNext->Length);
+		} else {
+			DogReceive(pNext->Dog, pNext->Data, pNext->Length, pNext->SentMs, NowMs);
+		}
+	}
+}
+
+// Tries it took to get a frame across, 0 if all MaxAttempts were lost
+static uint8_t AirAttempts(uint32_t NowMs, uint8_t MaxAttempts) {
+	uint8_t Attempt;
+
+	if ((Scenario.OutageMs != 0) && (NowMs >= Scenario.OutageStartMs) &&
+			(NowMs - Scenario.OutageStartMs < Scenario.OutageMs)) {
+		return 0;
+	}
+	for (Attempt = 1; Attempt <= MaxAttempts; Attempt++) {
+		if (ChannelBusy(NowMs + (Attempt - 1) * MAC_RETRY_MS)) {
+			Stats.Collisions++;
+		} else if ((Random() % 1000) >= Scenario.LossPermille) {
+			return Attempt;
+		}
+	}
+	return 0;
+}
+
+// Moves the other FARMERs on to their next exchange once one has started
+static void RunOtherFarmers(uint32_t NowMs) {
+	uint8_t i;
+
+	for (i = 0; i < Scenario.OtherFarmers; i++) {
+		while (NowMs >= Others[i].NextMs) {
+			Others[i].LastMs = Others[i].NextMs;
+			Others[i].HasSent = true;
+			if (Scenario.OthersSlotted) {
+				Others[i].NextMs += TDMA_FRAME_TIME;
+			} else {
+				Others[i].NextMs += Scenario.OtherPeriodMs + Random() % (Scenario.OtherPeriodMs / 4 + 1);
+			}
+		}
+	}
+}
+
+// True if an attempt starting at NowMs, MAC_RETRY_MS long, overlaps
+// another FARMER's last or next exchange
+static bool ChannelBusy(uint32_t NowMs) {
+	uint8_t i;
+
+	for (i = 0; i < Scenario.OtherFarmers; i++) {
+		if (Others[i].HasSent && (NowMs < Others[i].LastMs + Scenario.OtherAirMs) &&
+				(Others[i].LastMs < NowMs + MAC_RETRY_MS)) {
+			return true;
+		}
+		if ((NowMs < Others[i].NextMs + Scenario.OtherAirMs) && (Others[i].NextMs < NowMs + MAC_RETRY_MS)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint32_t AirDelay(uint8_t Attempts) {
+	uint32_t Delay = Scenario.LatencyMs + (Attempts - 1) * MAC_RETRY_MS;
+
+	if (Scenario.JitterMs != 0) {
+		Delay += Random() % (Scenario.JitterMs + 1);
+	}
+	return (Delay != 0) ? Delay : 1;
+}
+
+static bool AnyUnpaired(void) {
+	uint8_t i;
+
+	for (i = 0; i < Scenario.NumDogs; i++) {
+		if (Dogs[i].State != DogPaired) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void AddSample(SampleSet_t *pSet, uint32_t Value) {
+	if (pSet->Count < DOGSIM_MAX_SAMPLES) {
+		pSet->Samples[pSet->Count++] = Value;
+	}
+}
+
+static void Summarize(SampleSet_t *pSet, DogSimPercentiles_t *pOut) {
+	memset(pOut, 0, sizeof(*pOut));
+	pOut->Count = pSet->Count;
+	if (pSet->Count == 0) {
+		return;
+	}
+	qsort(pSet->Samples, pSet->Count, sizeof(pSet->Samples[0]), CompareSamples);
+	pOut->P50 = pSet->Samples[(pSet->Count - 1) * 50 / 100];
+	pOut->P90 = pSet->Samples[(pSet->Count - 1) * 90 / 100];
+	pOut->P99 = pSet->Samples[(pSet->Count - 1) * 99 / 100];
+	pOut->Max = pSet->Samples[pSet->Count - 1];
+}
+
+static int CompareSamples(const void *pA, const void *pB) {
+	uint32_t A = *(const uint32_t *)pA;
+	uint32_t B = *(const uint32_t *)pB;
+	return (A > B) - (A < B);
+}
+
+// xorshift32, same as VirtualUART.c
+static uint32_t Random(void) {
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return RandomState;
+}
+
+#endif /* ES_HOST_BUILD */
@@ -300,6 +300,43 @@ ES_Return_t ES_Run( void ){
   }
 }
 
+#ifdef ES_HOST_BUILD
+/****************************************************************************
+ Function
+   ES_RunPending
+ Parameters
+   None
+ Returns
+   ES_Return_t : FailedRun if any of the run functions failed, Success once
+                 there is nothing left to do
+ Description
+   ES_Run for host builds, which drive time themselves: processes pending
+   ticks and runs the services until every queue is empty and the event
+   checkers find nothing new, then returns instead of spinning. The host
+   program calls it after each simulated tick.
+ Notes
+   only built with ES_HOST_BUILD
+****************************************************************************/
+ES_Return_t ES_RunPending( void ){
+  uint8_t HighestPrior;
+  static ES_Event ThisEvent;
+
+  do {
+    while( (_HW_Process_Pending_Ints()) && (Ready != 0)){
+      HighestPrior =  ES_GetMSBitSet(Ready);
+      if ( ES_DeQueue( EventQueues[HighestPrior].pMem, &ThisEvent ) == 0 ){
+        Ready &= BitNum2ClrMask[HighestPrior]; // mark queue as now empty
+      }
+      if( ServDescList[HighestPrior].RunFunc(ThisEvent).EventType != 
+                                                              ES_NO_EVENT) {
+              return FailedRun;
+      }
+    }
+  } while (ES_CheckUserEvents());
+  return Success;
+}
+#endif
+
 /****************************************************************************
  Function
    ES_PostAll
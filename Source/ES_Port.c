@@ -11,6 +11,9 @@
    as the file for the port to the Freescale MC9S12C32 processor.
 
  Notes
+   With ES_HOST_BUILD there is no SysTick: the host program calls
+   SysTickIntHandler once per simulated tick, and the PRIMASK and console
+   routines are stand-ins that do nothing.
 
  History
  When           Who     What/Why
@@ -23,6 +26,7 @@
 ****************************************************************************/
 #include <stdint.h>
 #include <stdbool.h>
+#ifndef ES_HOST_BUILD
 #include "inc/hw_memmap.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/interrupt.h"
@@ -31,14 +35,18 @@
 #include "driverlib/systick.h"
 #include "driverlib/gpio.h"
 #include "utils/uartstdio.h"
+#endif
 #include "ES_Port.h"
 #include "ES_Types.h"
 #include "ES_Timers.h"
+#include "ES_ShortTimer.h"
 
+#ifndef ES_HOST_BUILD
 #define UART_PORT 		0
 #define UART_BAUD		115200UL
 #define SRC_CLK_FREQ	16000000UL
 #define CLK_FREQ		40000000UL
+#endif
 
 // TickCount is used to track the number of timer ints that have occurred
 // since the last check. It should really never be more than 1, but just to
@@ -73,11 +81,15 @@ static volatile uint16_t SysTickCounter = 0;
 ****************************************************************************/
 void _HW_Timer_Init(TimerRate_t Rate)
 {
+#ifndef ES_HOST_BUILD
 	SysTickPeriodSet(Rate);			/* Set the SysTick Interrupt Rate */
 	SysTickIntEnable();				/* Enable the SysTick Interrupt */
 	SysTickEnable();				/* Enable SysTick */
+	ES_TimestampInit();				/* Start the free running cycle counter */
 	IntMasterEnable();				/* Make sure interrupts are enabled */
-
+#else
+	ES_TimestampInit();				/* ticks come from the host program */
+#endif
 }
 
 /****************************************************************************
@@ -145,16 +157,33 @@ uint16_t _HW_GetTickCount(void)
      run function is called and even when there are no queues with events.
      This routine could be expanded to process any other interrupt sources
      that you would like to use to post events to the framework services.
+     All of the timer bookkeeping and ES_TIMEOUT posting happens here, in
+     the context of ES_Run, so the SysTick ISR stays a fixed two increments
+     no matter how many timers expire together. If ES_Run was held off for
+     more than one tick, the accumulated ticks are handed to the timer module
+     as a single step rather than one call per tick.
  Author
      J. Edward Carryer, 08/13/13 13:27
 ****************************************************************************/
 bool _HW_Process_Pending_Ints( void )
 {
-   while (TickCount > 0)
+   uint8_t PendingTicks;
+
+   /* take the whole backlog of ticks in one step. A plain TickCount-- here
+      is a read-modify-write that can lose a tick if SysTick fires in the
+      middle of it */
+   EnterCritical();
+   PendingTicks = TickCount;
+   TickCount = 0;
+   ExitCritical();
+
+   if (PendingTicks > 0)
    {
+      /* keep the microsecond timestamp ahead of its 107 second cycle
+         counter wrap */
+      ES_GetMicros();
       /* call the framework tick response to actually run the timers */
-      ES_Timer_Tick_Resp();  
-      TickCount--;
+      ES_Timer_Tick_Resp(PendingTicks);
    }
    return true; // always return true to allow loop test in ES_Run to proceed
 }
@@ -175,6 +204,7 @@ bool _HW_Process_Pending_Ints( void )
  ****************************************************************************/
 void ConsoleInit(void)
 {
+#ifndef ES_HOST_BUILD
 	// Enable designated port that will be used for the UART
 	SysCtlPeripheralEnable( SYSCTL_PERIPH_GPIOA );
 
@@ -191,7 +221,7 @@ void ConsoleInit(void)
 
 	// Initialize the UART for console I/O
 	UARTStdioConfig(UART_PORT, UART_BAUD, SRC_CLK_FREQ);
-
+#endif
 }
 
 
@@ -273,3 +303,23 @@ inline void CPUsetFAULTMASK(uint32_t newFAULTMASK)
   }
 }
 #endif
+
+#ifdef ES_HOST_BUILD
+/* Host builds have no interrupts to hold off, EnterCritical/ExitCritical
+   only have to compile. There is no terminal either, so kbhit (termio.c
+   on the target) never has a key */
+uint32_t CPUgetPRIMASK_cpsid(void)
+{
+  return 0;
+}
+
+void CPUsetPRIMASK(uint32_t newPRIMASK)
+{
+  (void)newPRIMASK;
+}
+
+int kbhit(void)
+{
+  return 0;
+}
+#endif
@@ -14,7 +14,17 @@
    This module uses the Tiva Peripheral Driver Library functions and
    the ability that it provides to 'hook' a function into an interrupt
    response routine without modifying the vector table directly.
-   Uses timers A & B on 16/32 bit Timer Module 5
+   Any number (NUM_SHORT_TIMERS) of one-shot microsecond timers are kept in
+   a list sorted by deadline and multiplexed onto timer A of 16/32 bit 
+   Timer Module 5, which is always loaded for the earliest deadline. Each
+   timer can be aimed at any service and cancelled before it fires.
+   Deadlines are kept in ES_GetCycles() units, so timer A only has to get
+   us close; the list is checked against the timestamp when it fires.
+   Also home to the free running timestamp (ES_GetCycles/ES_GetMicros),
+   which uses timer A of 32/64 bit Wide Timer Module 5 counting up at the
+   system clock rate. Building with ES_HOST_BUILD defined leaves out all of
+   the hardware code and backs the timestamp with clock_gettime(), or with
+   the simulated clock a host program hands to ES_SetCycleSource().
    
  History
  When           Who     What/Why
@@ -27,6 +37,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+
+#ifndef ES_HOST_BUILD
 #include "BITDEFS.H"
 
 // the headers to access the GPIO subsystem
@@ -50,27 +62,62 @@
 // the framework headers
 #include "ES_Framework.h"
 #include "ES_Configure.h"
+#include "ES_Port.h"
 
 
-// module level functions
+// module level defines
 
 // define for the timer pre-scaler. this sets the resolution of the
 // timing functions
 // the current values are based on a 40mHz clock rate to give 1uS resolution
 #define PRE_1uS 40
 
+// timer A is 16 bits at 1uS, longer timeouts take more than one load
+#define MAX_LOAD_uS 0xFFFF
+
+// end of list marker for the deadline ordered list
+#define SHORT_TIMER_NONE 0xFF
+
+// deadlines are compared as signed differences of the cycle counter, so
+// keep the longest timeout well inside half of its 107 second range
+#define MAX_SHORT_TIMEOUT_uS 50000000UL
+
+// module level functions
 void ShortTimerAHandler(void);
 void ShortTimerBHandler(void);
+static void LinkTimer(uint8_t Num);
+static void UnlinkTimer(uint8_t Num);
+static void ProgramHardware(void);
+static ES_TimerReturn_t StartTimer(uint8_t Num, uint8_t WhichService,
+                                   uint32_t Micros, bool Legacy);
+
+// module level types
+typedef struct {
+  uint32_t Deadline;    // in ES_GetCycles() units
+  uint8_t Priority;     // service that gets the ES_SHORT_TIMEOUT
+  uint8_t Next;         // next timer in deadline order
+  bool Legacy;          // started by ES_ShortTimerStart, post TIMER_A/TIMER_B
+} ShortTimer_t;
 
 // module level variables
 
+static ShortTimer_t ShortTimers[NUM_SHORT_TIMERS];
+
+// first (earliest) timer in the list
+static uint8_t Head = SHORT_TIMER_NONE;
+
+// one bit per timer in the list
+static uint32_t ActiveFlags;
+
+// services bound to the 2 original channels by ES_ShortTimerInit
 static uint8_t Timer_A_Priority = SHORT_TIMER_UNUSED;
 static uint8_t Timer_B_Priority = SHORT_TIMER_UNUSED;
 
 //******************************
 // ES_ShortTimerInit()
 // Initialize the timer subsystem and log the services to which the timeout
-// messages will be posted
+// messages will be posted by ES_ShortTimerStart. Those 2 are carried on
+// short timers SHORT_TIMER_A and SHORT_TIMER_B.
 //******************************
 void ES_ShortTimerInit(uint8_t TimeAPrio, uint8_t TimeBPrio){
 #ifdef DEBUG
@@ -83,91 +130,287 @@ void ES_ShortTimerInit(uint8_t TimeAPrio, uint8_t TimeBPrio){
 
 // enable the clock to the timer module  
   SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER5); 
-// configure as 2 16 bit timers  
+  while(!SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER5))
+    ;
+// configure as 2 16 bit timers, only A is used  
   TimerConfigure(TIMER5_BASE, TIMER_CFG_SPLIT_PAIR | TIMER_CFG_A_ONE_SHOT | 
                  TIMER_CFG_B_ONE_SHOT);
 // set prescale to get 1uS resolution  
   TimerPrescaleSet(TIMER5_BASE, TIMER_BOTH, PRE_1uS);
+// local enable of the timeout, the NVIC enable follows the list contents
+  TimerIntEnable(TIMER5_BASE, TIMER_TIMA_TIMEOUT);
 // log the service to which the timeout will be posted
   Timer_A_Priority = TimeAPrio;
-  Timer_B_Priority = TimeAPrio;
+  Timer_B_Priority = TimeBPrio;
       
 }
 
+//******************************
+// ES_ShortTimerStart()
+// Original 2 channel interface, Which is TIMER_A or TIMER_B. The timeout
+// still carries TIMER_A or TIMER_B as its parameter, as it always has.
+//******************************
 void ES_ShortTimerStart( uint32_t Which, uint16_t TimeoutValue){
-  if ((Which != TIMER_A) && (Which != TIMER_B))
-    return;
-  // for very short delays. just immediatly post. There is 10us of overhead
-  if( TimeoutValue < 11){
-    if(Which == TIMER_A){
-      ShortTimerAHandler();
-    }else{
-      ShortTimerBHandler();
-    }
-  }
-  TimerLoadSet(TIMER5_BASE, Which, TimeoutValue);
-  
-  if(Which == TIMER_A)
-  { // local enable
-    TimerIntEnable(TIMER5_BASE, TIMER_TIMA_TIMEOUT);
-    // NVIC Enable
-    IntEnable(INT_TIMER5A_TM4C123);
-  }else{
-    // local enable
-    TimerIntEnable(TIMER5_BASE, TIMER_TIMB_TIMEOUT);
-    // NVIC Enable
-    IntEnable(INT_TIMER5B_TM4C123);
+  if (Which == TIMER_A)
+    StartTimer(SHORT_TIMER_A, Timer_A_Priority, TimeoutValue, true);
+  else if (Which == TIMER_B)
+    StartTimer(SHORT_TIMER_B, Timer_B_Priority, TimeoutValue, true);
+}
+
+//******************************
+// ES_ShortTimer_Start()
+// (Re)start short timer Num to post ES_SHORT_TIMEOUT, with a parameter of
+// Num, to the service at WhichService after Micros microseconds.
+// Restarting a running timer moves its deadline.
+//******************************
+ES_TimerReturn_t ES_ShortTimer_Start(uint8_t Num, uint8_t WhichService,
+                                     uint32_t Micros){
+  return StartTimer(Num, WhichService, Micros, false);
+}
+
+//******************************
+// ES_ShortTimer_Cancel()
+// Stop short timer Num. No event is posted. Cancelling a timer that is
+// not running is not an error.
+//******************************
+ES_TimerReturn_t ES_ShortTimer_Cancel(uint8_t Num){
+  bool WasHead;
+
+  if (Num >= NUM_SHORT_TIMERS)
+    return ES_Timer_ERR;
+
+  EnterCritical();
+  if (ActiveFlags & (1UL << Num)){
+    WasHead = (Head == Num);
+    UnlinkTimer(Num);
+    if (WasHead)
+      ProgramHardware();
   }
-  
-  TimerEnable(TIMER5_BASE, Which);
+  ExitCritical();
+  return ES_Timer_OK;
+}
 
-#ifdef DEBUG
-// raise I/O line to show we started
-  if( Which == TIMER_A)
-    GPIOPinWrite(GPIO_PORTB_BASE, BIT0HI, BIT0HI);
-  else
-    GPIOPinWrite(GPIO_PORTB_BASE, BIT1HI, BIT1HI);    
-#endif
-  return;
+//******************************
+// ES_ShortTimer_IsActive()
+//******************************
+bool ES_ShortTimer_IsActive(uint8_t Num){
+  return (Num < NUM_SHORT_TIMERS) && ((ActiveFlags & (1UL << Num)) != 0);
 }
 
 void ShortTimerAHandler(void){
   ES_Event ThisEvent;
+  uint8_t Expired = SHORT_TIMER_NONE;
+  uint8_t Num;
+  uint32_t Now;
 
 // start by clearing the source of the interrupt
-    TimerIntClear(TIMER5_BASE, TIMER_TIMA_TIMEOUT);
+  TimerIntClear(TIMER5_BASE, TIMER_TIMA_TIMEOUT);
 #ifdef DEBUG
 // lower I/O line to show we arrived
   GPIOPinWrite(GPIO_PORTB_BASE, BIT0HI, BIT0LO);  
 #endif
  
-// post the timeout for this timer  
+// pull everything that is due off the front of the list, chaining them
+// through Next so that the posts can happen outside of the list handling
+  Now = ES_GetCycles();
+  while ((Head != SHORT_TIMER_NONE) && 
+         ((int32_t)(ShortTimers[Head].Deadline - Now) < ES_CYCLES_PER_US)){
+    Num = Head;
+    UnlinkTimer(Num);
+    ShortTimers[Num].Next = Expired;
+    Expired = Num;
+  }
+// aim the hardware at whatever is left
+  ProgramHardware();
+
+// post the timeouts
   ThisEvent.EventType = ES_SHORT_TIMEOUT;
-  ThisEvent.EventParam = TIMER_A;
+  while (Expired != SHORT_TIMER_NONE){
+    Num = Expired;
+    Expired = ShortTimers[Num].Next;
+    if (ShortTimers[Num].Legacy)
+      ThisEvent.EventParam = (Num == SHORT_TIMER_A) ? TIMER_A : TIMER_B;
+    else
+      ThisEvent.EventParam = Num;
 // protect against timer that was not correctly initialized  
-  if (Timer_A_Priority != SHORT_TIMER_UNUSED)
-  {
-    ES_PostToService( Timer_A_Priority, ThisEvent);
+    if (ShortTimers[Num].Priority != SHORT_TIMER_UNUSED)
+    {
+      ES_PostToService( ShortTimers[Num].Priority, ThisEvent);
+    }
   }
 }
 
 void ShortTimerBHandler(void){
-  ES_Event ThisEvent;
+// timer B is no longer used, just make sure a stray interrupt can't stick
+  TimerIntClear(TIMER5_BASE, TIMER_TIMB_TIMEOUT);
+}
+
+//******************************
+// private functions
+//******************************
+
+// (re)start timer Num for the service at WhichService. Legacy timers post
+// TIMER_A/TIMER_B instead of their number.
+static ES_TimerReturn_t StartTimer(uint8_t Num, uint8_t WhichService,
+                                   uint32_t Micros, bool Legacy){
+  uint32_t Now;
+
+  if ((Num >= NUM_SHORT_TIMERS) || (WhichService >= NUM_SERVICES) ||
+      (Micros > MAX_SHORT_TIMEOUT_uS))
+    return ES_Timer_ERR;
+
+  Now = ES_GetCycles();
+  EnterCritical();
+  if (ActiveFlags & (1UL << Num))
+    UnlinkTimer(Num);
+  ShortTimers[Num].Deadline = Now + Micros * ES_CYCLES_PER_US;
+  ShortTimers[Num].Priority = WhichService;
+  ShortTimers[Num].Legacy = Legacy;
+  LinkTimer(Num);
+  // only touch the hardware if the front of the line changed
+  if (Head == Num)
+    ProgramHardware();
+  ExitCritical();
 
-// start by clearing the source of the interrupt
-    TimerIntClear(TIMER5_BASE, TIMER_TIMB_TIMEOUT);
 #ifdef DEBUG
-// lower I/O line to show we arrived
-  GPIOPinWrite(GPIO_PORTB_BASE, BIT1HI, BIT1LO);    
-#endif 
-  
-// post the timeout for this timer  
-  ThisEvent.EventType = ES_SHORT_TIMEOUT;
-  ThisEvent.EventParam = TIMER_B;
-// protect against timer that was not correctly initialized  
-  if (Timer_B_Priority != SHORT_TIMER_UNUSED)
-  {
-    ES_PostToService( Timer_B_Priority, ThisEvent);
+// raise I/O line to show we started
+  GPIOPinWrite(GPIO_PORTB_BASE, BIT0HI, BIT0HI);
+#endif
+  return ES_Timer_OK;
+}
+
+// put Num into the list in deadline order, behind any timer with the same
+// deadline. Call with interrupts off.
+static void LinkTimer(uint8_t Num){
+  uint8_t *pLink = &Head;
+  uint32_t Deadline = ShortTimers[Num].Deadline;
+
+  while ((*pLink != SHORT_TIMER_NONE) &&
+         ((int32_t)(ShortTimers[*pLink].Deadline - Deadline) <= 0))
+    pLink = &ShortTimers[*pLink].Next;
+  ShortTimers[Num].Next = *pLink;
+  *pLink = Num;
+  ActiveFlags |= (1UL << Num);
+}
+
+// take Num out of the list. Call with interrupts off.
+static void UnlinkTimer(uint8_t Num){
+  uint8_t *pLink = &Head;
+
+  while ((*pLink != SHORT_TIMER_NONE) && (*pLink != Num))
+    pLink = &ShortTimers[*pLink].Next;
+  if (*pLink == Num)
+    *pLink = ShortTimers[Num].Next;
+  ActiveFlags &= ~(1UL << Num);
+}
+
+// load timer A for the deadline at the front of the list, or shut it off
+// if the list is empty. Anything already due gets the shortest load so that
+// it is always delivered from the interrupt, never from the caller.
+static void ProgramHardware(void){
+  int32_t Remaining;
+  uint32_t LoadValue;
+
+  TimerDisable(TIMER5_BASE, TIMER_A);
+  if (Head == SHORT_TIMER_NONE){
+    IntDisable(INT_TIMER5A_TM4C123);
+    return;
   }
-  
+  Remaining = (int32_t)(ShortTimers[Head].Deadline - ES_GetCycles());
+  if (Remaining < ES_CYCLES_PER_US)
+    LoadValue = 1;
+  else if (Remaining / ES_CYCLES_PER_US > MAX_LOAD_uS)
+    LoadValue = MAX_LOAD_uS; // partway there, we will reload when it fires
+  else
+    LoadValue = Remaining / ES_CYCLES_PER_US;
+  TimerLoadSet(TIMER5_BASE, TIMER_A, LoadValue);
+  IntEnable(INT_TIMER5A_TM4C123);
+  TimerEnable(TIMER5_BASE, TIMER_A);
+}
+
+//******************************
+// ES_TimestampInit()
+// Start Wide Timer 5 A free running, counting up at the system clock rate.
+// At 40MHz it wraps every 107 seconds.
+//******************************
+void ES_TimestampInit(void){
+// enable the clock to the timer module
+  SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER5);
+  while(!SysCtlPeripheralReady(SYSCTL_PERIPH_WTIMER5))
+    ;
+// configure timer A as a 32 bit periodic up counter, no prescale
+  TimerConfigure(WTIMER5_BASE, TIMER_CFG_SPLIT_PAIR | TIMER_CFG_A_PERIODIC_UP);
+  TimerLoadSet(WTIMER5_BASE, TIMER_A, 0xFFFFFFFF);
+  TimerEnable(WTIMER5_BASE, TIMER_A);
+}
+
+//******************************
+// ES_GetCycles()
+// Returns the raw 32 bit count of system clock cycles. Differences between
+// two readings are correct (with unsigned arithmetic) across a wrap as long
+// as they are less than 107 seconds apart.
+//******************************
+uint32_t ES_GetCycles(void){
+  return HWREG(WTIMER5_BASE + TIMER_O_TAV);
+}
+
+#else /* ES_HOST_BUILD */
+
+#include <time.h>
+#include "ES_ShortTimer.h"
+
+static ES_CycleSource_t CycleSource;
+
+void ES_TimestampInit(void){
+  // nothing to set up, the monotonic clock is always running
+}
+
+// Replaces the monotonic clock with Source, NULL goes back to it. A
+// simulation needs this so that rand() seeds and byte gaps follow its time
+// and a run repeats exactly.
+void ES_SetCycleSource(ES_CycleSource_t Source){
+  CycleSource = Source;
+}
+
+uint32_t ES_GetCycles(void){
+  struct timespec Now;
+  if (CycleSource != NULL){
+    return CycleSource();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  // scale to the same 40MHz count that the target hardware produces
+  return (uint32_t)((uint64_t)Now.tv_sec * ES_CYCLES_PER_US * 1000000u +
+                    (uint64_t)Now.tv_nsec * ES_CYCLES_PER_US / 1000u);
+}
+
+#endif /* ES_HOST_BUILD */
+
+//******************************
+// ES_GetMicros()
+// Returns microseconds since the timestamp was started, wrapping at 2^32
+// (about 71 minutes) so that differences work with unsigned arithmetic.
+// The cycle count only holds 107 seconds, so this has to be called at least
+// that often to keep up. _HW_Process_Pending_Ints does that for us.
+//******************************
+uint32_t ES_GetMicros(void){
+  static uint32_t LastCycles;
+  static uint32_t LeftoverCycles;
+  static uint32_t Micros;
+  uint32_t Now;
+  uint32_t Delta;
+
+#ifndef ES_HOST_BUILD
+  // this may be called from ISRs too, keep the update in one piece
+  EnterCritical();
+#endif
+  Now = ES_GetCycles();
+  Delta = (Now - LastCycles) + LeftoverCycles;
+  LastCycles = Now;
+  Micros += Delta / ES_CYCLES_PER_US;
+  LeftoverCycles = Delta % ES_CYCLES_PER_US;
+  Now = Micros;
+#ifndef ES_HOST_BUILD
+  ExitCritical();
+#endif
+  return Now;
 }
@@ -90,6 +90,18 @@ static Timer_t TMR_TimerArray[sizeof(Tflag_t)*BITS_PER_BYTE]=
 
 static Tflag_t TMR_ActiveFlags;
 
+/* how late each timer is allowed to run, set when the timer is started */
+static uint16_t TMR_SlackArray[sizeof(Tflag_t)*BITS_PER_BYTE];
+
+/* timers that have reached their time but are riding out their slack,
+   for these TMR_TimerArray holds the slack that is left */
+static Tflag_t TMR_OverdueFlags;
+
+/* running totals of expirations, and of how many of them were pulled in
+   to go out together with another timer's expiration */
+static uint32_t TMR_NumExpired;
+static uint32_t TMR_NumCoalesced;
+
 static pPostFunc const Timer2PostFunc[sizeof(Tflag_t)*BITS_PER_BYTE] = 
                                             { TIMER0_RESP_FUNC,
                                               TIMER1_RESP_FUNC,
@@ -109,6 +121,17 @@ static pPostFunc const Timer2PostFunc[sizeof(Tflag_t)*BITS_PER_BYTE] =
                                               TIMER15_RESP_FUNC
                                               };
   
+#if NUM_TIMEOUT_SET_SERVICES > 0
+/* the services that take their timeouts batched as ES_TIMEOUT_SET */
+static pPostFunc const TimeoutSetFuncs[] = { TIMEOUT_SET_FUNCS };
+
+/* for each of those services, the mask of the timers that post to it.
+   Filled in from Timer2PostFunc by ES_Timer_Init */
+static Tflag_t TimeoutSetMasks[ARRAY_SIZE(TimeoutSetFuncs)];
+
+/* the union of TimeoutSetMasks */
+static Tflag_t TMR_BatchedFlags;
+#endif
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -129,6 +152,21 @@ static pPostFunc const Timer2PostFunc[sizeof(Tflag_t)*BITS_PER_BYTE] =
 ****************************************************************************/
 void ES_Timer_Init(TimerRate_t Rate)
 {
+#if NUM_TIMEOUT_SET_SERVICES > 0
+   uint8_t i, j;
+   // work out which timers belong to the services taking batched timeouts
+   TMR_BatchedFlags = 0;
+   for (i = 0; i < ARRAY_SIZE(TimeoutSetFuncs); i++)
+   {
+      TimeoutSetMasks[i] = 0;
+      for (j = 0; j < ARRAY_SIZE(Timer2PostFunc); j++)
+      {
+         if (Timer2PostFunc[j] == TimeoutSetFuncs[i])
+            TimeoutSetMasks[i] |= BitNum2SetMask[j];
+      }
+      TMR_BatchedFlags |= TimeoutSetMasks[i];
+   }
+#endif
    // call the hardware init routine
    _HW_Timer_Init(Rate);
 }
@@ -158,6 +196,7 @@ ES_TimerReturn_t ES_Timer_SetTimer(uint8_t Num, uint16_t NewTime)
        (NewTime == 0) ) /* no time being set */
       return ES_Timer_ERR;  
    TMR_TimerArray[Num] = NewTime;
+   TMR_SlackArray[Num] = 0;
    return ES_Timer_OK;
 }
 
@@ -183,6 +222,7 @@ ES_TimerReturn_t ES_Timer_StartTimer(uint8_t Num)
        /* tried to set a timer with no time on it */
        (TMR_TimerArray[Num] == 0) )
       return ES_Timer_ERR;  
+   TMR_OverdueFlags &= BitNum2ClrMask[Num];
    TMR_ActiveFlags |= BitNum2SetMask[Num]; /* set timer as active */
    return ES_Timer_OK;
 }
@@ -207,6 +247,7 @@ ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num)
    if( Num >= ARRAY_SIZE(TMR_TimerArray) )
       return ES_Timer_ERR;  /* tried to set a timer that doesn't exist */
    TMR_ActiveFlags &= BitNum2ClrMask[Num]; /* set timer as inactive */
+   TMR_OverdueFlags &= BitNum2ClrMask[Num];
    return ES_Timer_OK;
 }
 
@@ -222,11 +263,34 @@ ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num)
      sets the NewTime into the chosen timer and sets the timer active to 
      begin counting.
  Notes
-     None.
+     The timer expires on exactly NewTime ticks (no slack).
  Author
      J. Edward Carryer, 02/24/97 14:51
 ****************************************************************************/
 ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint16_t NewTime)
+{
+   return ES_Timer_InitTimerSlack(Num, NewTime, 0);
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_InitTimerSlack
+ Parameters
+     unsigned char Num, the number of the timer to start
+     unsigned int NewTime, the number of ticks to be counted
+     unsigned int Slack, how many ticks late the timeout may be delivered
+ Returns
+     ES_Timer_ERR if the requested timer does not exist, ES_Timer_OK otherwise.
+ Description
+     like ES_Timer_InitTimer, but lets the timer module hold the expiration
+     for up to Slack ticks past NewTime so that it can go out on the same
+     tick as another timer's expiration.
+ Notes
+     The timeout is never delivered early. If no other timer expires within
+     the slack window, it is delivered at NewTime + Slack.
+****************************************************************************/
+ES_TimerReturn_t ES_Timer_InitTimerSlack(uint8_t Num, uint16_t NewTime,
+                                         uint16_t Slack)
 {
    /* tried to set a timer that doesn't exist */
    if( (Num >= ARRAY_SIZE(TMR_TimerArray)) ||
@@ -236,10 +300,44 @@ ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint16_t NewTime)
        (NewTime == 0) )
       return ES_Timer_ERR;  
    TMR_TimerArray[Num] = NewTime;
+   TMR_SlackArray[Num] = Slack;
+   TMR_OverdueFlags &= BitNum2ClrMask[Num];
    TMR_ActiveFlags |= BitNum2SetMask[Num]; /* set timer as active */
    return ES_Timer_OK;
 }
 
+/****************************************************************************
+ Function
+     ES_Timer_GetExpiredCount
+ Parameters
+     None.
+ Returns
+     total number of timer expirations delivered since startup
+ Description
+     Used together with ES_Timer_GetCoalescedCount to see how much slack
+     is buying us.
+****************************************************************************/
+uint32_t ES_Timer_GetExpiredCount(void)
+{
+   return TMR_NumExpired;
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_GetCoalescedCount
+ Parameters
+     None.
+ Returns
+     number of expirations that were delivered early in their slack window
+     because another timer expired on the same tick
+ Description
+     Each of these is a tick that did not need its own timeout processing.
+****************************************************************************/
+uint32_t ES_Timer_GetCoalescedCount(void)
+{
+   return TMR_NumCoalesced;
+}
+
 
 /****************************************************************************
  Function
@@ -266,49 +364,133 @@ uint16_t ES_Timer_GetTime(void)
  Function
      ES_Timer_Tick_Resp
  Parameters
-     None.
+     uint8_t ElapsedTicks, the number of ticks since the last call
  Returns
      None.
  Description
      This is the new Tick response routine to support the timer module.
-     It will increment time, to maintain the functionality of the
-     GetTime() timer and it will check through the active timers,
-     decrementing each active timers count, if the count goes to 0, it
-     will post an event to the corresponding SM and clear the active flag to
-     prevent further counting.
+     It will check through the active timers, subtracting the elapsed ticks
+     from each active timers count, if the count goes to 0, it will post an
+     event to the corresponding SM and clear the active flag to prevent
+     further counting.
  Notes
-     Called from _Timer_Int_Resp in ES_Port.c.
+     Called from _HW_Process_Pending_Ints in ES_Port.c, which runs in the
+     context of ES_Run, not from the SysTick interrupt. The ISR only counts
+     ticks, so the posts below never happen at interrupt level.
+     A timer that would have gone past 0 during a multi-tick catch-up
+     expires on this call, it is not carried over.
+     A timer started with slack does not expire when its count reaches 0,
+     it goes overdue and counts down its slack instead. It expires when the
+     slack runs out or as soon as any other timer expires, whichever comes
+     first.
+     Timers belonging to a service in TIMEOUT_SET_FUNCS are collected while
+     scanning and posted afterwards, one event per service: ES_TIMEOUT if
+     only one of its timers expired, ES_TIMEOUT_SET with the mask otherwise.
+     That service never uses more than one queue slot per call.
  Author
      J. Edward Carryer, 02/24/97 15:06
 ****************************************************************************/
-void ES_Timer_Tick_Resp(void)
+void ES_Timer_Tick_Resp(uint8_t ElapsedTicks)
 {
 	static Tflag_t NeedsProcessing;
+	static Tflag_t Expired;
 	static uint8_t NextTimer2Process;
 	static ES_Event NewEvent;
+	uint16_t PastDue;
+#if NUM_TIMEOUT_SET_SERVICES > 0
+	static Tflag_t BatchedExpired;
+	uint8_t i;
 
-	if (TMR_ActiveFlags != 0) /* if !=0 , then at least 1 timer is active */
-	{
-		// start by getting a list of all the active timers
-		NeedsProcessing = TMR_ActiveFlags;
-		do{
-			// find the MSB that is set
-			NextTimer2Process = ES_GetMSBitSet(NeedsProcessing);
-			/* decrement that timer, check if timed out */
-			if(--TMR_TimerArray[NextTimer2Process] == 0)
-			{
-				NewEvent.EventType = ES_TIMEOUT;
-				NewEvent.EventParam = NextTimer2Process;
-				/* post the timeout event to the right Service */
-				Timer2PostFunc[NextTimer2Process](NewEvent);
-				/* and stop counting */
-				TMR_ActiveFlags &= BitNum2ClrMask[NextTimer2Process];
+	BatchedExpired = 0;
+#endif
+
+	if (TMR_ActiveFlags == 0) /* if ==0 , then no timer is active */
+		return;
+
+	// first pass, count down the active timers and find the expired ones
+	Expired = 0;
+	NeedsProcessing = TMR_ActiveFlags;
+	do{
+		// find the MSB that is set
+		NextTimer2Process = ES_GetMSBitSet(NeedsProcessing);
+		if(TMR_TimerArray[NextTimer2Process] <= ElapsedTicks)
+		{
+			PastDue = ElapsedTicks - TMR_TimerArray[NextTimer2Process];
+			if((TMR_OverdueFlags & BitNum2SetMask[NextTimer2Process]) ||
+			   (TMR_SlackArray[NextTimer2Process] <= PastDue))
+			{ /* out of time (or slack), this one goes now */
+				Expired |= BitNum2SetMask[NextTimer2Process];
+			}else
+			{ /* due, but it may wait for company */
+				TMR_TimerArray[NextTimer2Process] =
+				                  TMR_SlackArray[NextTimer2Process] - PastDue;
+				TMR_OverdueFlags |= BitNum2SetMask[NextTimer2Process];
 			}
-			// mark off the active timer that we just processed
-			NeedsProcessing &= BitNum2ClrMask[NextTimer2Process];
-		}while(NeedsProcessing != 0);
-      
+		}else
+		{
+			TMR_TimerArray[NextTimer2Process] -= ElapsedTicks;
+		}
+		// mark off the active timer that we just processed
+		NeedsProcessing &= BitNum2ClrMask[NextTimer2Process];
+	}while(NeedsProcessing != 0);
+
+	if (Expired == 0)
+		return;
+
+	// somebody is expiring anyway, so take every overdue timer along
+	NeedsProcessing = TMR_OverdueFlags & ~Expired;
+	while (NeedsProcessing != 0)
+	{
+		NextTimer2Process = ES_GetMSBitSet(NeedsProcessing);
+		TMR_NumCoalesced++;
+		NeedsProcessing &= BitNum2ClrMask[NextTimer2Process];
+	}
+	Expired |= TMR_OverdueFlags;
+
+	// second pass, stop the expired timers and post their events
+	TMR_ActiveFlags &= ~Expired;
+	TMR_OverdueFlags &= ~Expired;
+	NeedsProcessing = Expired;
+	do{
+		NextTimer2Process = ES_GetMSBitSet(NeedsProcessing);
+		TMR_TimerArray[NextTimer2Process] = 0;
+		TMR_NumExpired++;
+#if NUM_TIMEOUT_SET_SERVICES > 0
+		if (TMR_BatchedFlags & BitNum2SetMask[NextTimer2Process])
+		{
+			/* hold it to go out with the rest of this service's set */
+			BatchedExpired |= BitNum2SetMask[NextTimer2Process];
+		}else
+#endif
+		{
+			NewEvent.EventType = ES_TIMEOUT;
+			NewEvent.EventParam = NextTimer2Process;
+			/* post the timeout event to the right Service */
+			Timer2PostFunc[NextTimer2Process](NewEvent);
+		}
+		NeedsProcessing &= BitNum2ClrMask[NextTimer2Process];
+	}while(NeedsProcessing != 0);
+
+#if NUM_TIMEOUT_SET_SERVICES > 0
+	/* now one post for each batching service that had anything expire */
+	for (i = 0; (BatchedExpired != 0) && (i < ARRAY_SIZE(TimeoutSetFuncs)); i++)
+	{
+		Tflag_t ServiceExpired = BatchedExpired & TimeoutSetMasks[i];
+		if (ServiceExpired == 0)
+			continue;
+		BatchedExpired &= ~ServiceExpired;
+		if ((ServiceExpired & (ServiceExpired - 1)) == 0)
+		{ /* only one bit set, send it as a normal timeout */
+			NewEvent.EventType = ES_TIMEOUT;
+			NewEvent.EventParam = ES_GetMSBitSet(ServiceExpired);
+		}else
+		{
+			NewEvent.EventType = ES_TIMEOUT_SET;
+			NewEvent.EventParam = ServiceExpired;
+		}
+		TimeoutSetFuncs[i](NewEvent);
 	}
+#endif
 }
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
@@ -37,6 +37,7 @@
 
 #include "FARMER_SM.h"
 
+#ifndef ES_HOST_BUILD
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
 #include "inc/hw_gpio.h"
@@ -44,6 +45,9 @@
 #include "driverlib/sysctl.h"
 #include "driverlib/pin_map.h"	// Define PART_TM4C123GH6PM in project
 #include "driverlib/gpio.h"
+#else
+#include "HostHardware.h"
+#endif
 
 // Pair button on PB4
 #define TOUCHBUTTON GPIO_PIN_4
@@ -11,19 +11,30 @@
  05/13/2017			SC
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
+#include <stdlib.h>
+#include <string.h>
+
 #include "ES_Configure.h"
 #include "ES_Framework.h"
 #include "ES_DeferRecall.h"
+#include "ES_LookupTables.h"
+#include "ES_ShortTimer.h"
 
 #include "Constants.h"
 #include "Hardware.h"
 #include "FARMER_SM.h"
+#include "Transmit_SM.h"
+#include "TxQueue.h"
+#include "PeerTable.h"
+#include "LinkStats.h"
+#include "PacketCodec.h"
+#include "TxSlots.h"
+#include "XBeeLink.h"
 #include "Accelerometers.h"
 #include "ShiftRegModule.h"
 #include "EnablePA25_PB23_PD7_PF0.h"
 
 /*----------------------------- Module Defines ----------------------------*/
-#define NUM_ENCRYPTION_BYTES 32
 #define PERIPHERAL_PIN		BIT5HI
 #define BRAKE_PIN					BIT2HI
 #define DOGSEL1							BIT3HI
@@ -31,10 +42,41 @@
 #define GYROZ_MSB 10
 #define GYROZ_LSB 11
 
+#ifdef CTRL_AGGREGATE
+#define CTRL_PACKET_TYPE FARMER_DOG_CTRL_AGG
+#else
+#define CTRL_PACKET_TYPE FARMER_DOG_CTRL
+#endif
+
+// FARMER_DOG_CTRL_AGG wants a sample every CTRL_SAMPLE_TIME. CTRL_ON_CHANGE
+// takes one on each of its ticks, otherwise SAMPLE_TIMER is run for it
+#if defined(CTRL_AGGREGATE) && !defined(CTRL_ON_CHANGE)
+#define SAMPLE_ON_TIMER
+#endif
+
+// INTER_MESSAGE_TIMER ticks, pushed back to the start of our slot if slotted
+#ifdef CTRL_SLOTTED
+#define CTRL_TICK_DELAY(Wanted) TxSlots_Delay(ES_Timer_GetTime(), (Wanted))
+#else
+#define CTRL_TICK_DELAY(Wanted) (Wanted)
+#endif
+
 /*---------------------------- Module Functions ---------------------------*/
-static void CreateEncryptionKey(void);
-uint8_t* GetEncryptionKey(void);
+static void CreateEncryptionKey(uint8_t* Key);
+static void StartPairing(void);
+static void SendPairRequest(void);
+static void EndPairing(bool Paired);
+static bool AcceptPeer(uint16_t Address);
+static void HandlePeerEvent(ES_Event ThisEvent);
+static void SendResumeRequest(uint8_t Slot, uint16_t Now);
+static bool ResumePeer(uint8_t Slot, bool SendKey);
+static void UnpairAll(void);
 uint8_t* GetSensorData(void); // placeholder
+static void ReadInputs(uint8_t *Data);
+static void RecordSample(uint8_t *Inputs, uint16_t Now);
+#ifdef CTRL_ON_CHANGE
+static uint8_t PickCtrlSlot(uint16_t Now);
+#endif
 static void Eyes_On(void);
 static void Eyes_Off(void);
 static uint8_t IMU2LED( uint8_t* IMU_address );
@@ -44,8 +86,6 @@ static FARMERState_t CurrentState;
 
 static uint8_t MyPriority;
 
-static uint8_t EncryptionKey[NUM_ENCRYPTION_BYTES]; // array of 32 encryption keys 
-
 static uint8_t DogTag = 0x01;
 
 //static uint16_t GameTimerLength;
@@ -54,8 +94,6 @@ static uint8_t DogTag = 0x01;
 
 static bool Send_Pair = true;
 
-static uint8_t* IMU_Data;
-
 static uint8_t IMU_LED_value = 0;
 
 static uint8_t LED_values[8] = {BIT0HI, (BIT0HI | BIT1HI), (BIT0HI | BIT1HI | BIT2HI),
@@ -68,6 +106,39 @@ static uint16_t IMU_ranges[7] = {700, 1490, 2100, 2800, 3500, 4200, 4900};
 
 static bool Toggle_Periph = false;
 
+// the last CTRL_AGG_SAMPLES input samples, for FARMER_DOG_CTRL_AGG
+static uint8_t Samples[CTRL_AGG_SAMPLES][CTRL_DATA_LENGTH];
+static uint16_t SampleTimes[CTRL_AGG_SAMPLES];
+static uint8_t NewestSample;
+static uint8_t NumSamples;
+
+static bool RandomSeeded;        // rand() seeded, see StartPairing
+
+// the pairing window in progress
+static uint16_t PairStartTime;
+static uint8_t PairAttempts;     // REQ2PAIRs sent in it so far
+
+// pairing results, for the 'p' debug key
+static uint16_t Pairings;
+static uint16_t PairFailures;    // windows that ran out with no answer
+static uint16_t LastPairTime;    // ms from the first REQ2PAIR to the ACK
+static uint16_t MaxPairTime;
+static uint32_t TotalPairTime;
+static uint8_t LastPairAttempts;
+static uint8_t MaxPairAttempts;
+static uint32_t TotalPairAttempts;
+
+// session resumption results, also for 'p'
+static uint16_t Resumes;
+static uint16_t ResumeFailures;  // sessions that ran out of SESSION_GRACE_TIME
+static uint16_t LastResumeTime;  // ms from the last packet before the loss to the resume
+static uint16_t MaxResumeTime;
+
+#ifdef CTRL_ON_CHANGE
+// last slot PickCtrlSlot gave a CTRL to
+static uint8_t CtrlRoundRobin = MAX_PEERS - 1;
+#endif
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -103,9 +174,6 @@ bool InitFARMER_SM ( uint8_t Priority )
 	SR_Init();
 	SR_Write( 0 );
 	
-	// Get address to IMU data array
-	IMU_Data = GetIMUData();
-	
 	// Initialize LED/eyes pin
 	HWREG(SYSCTL_RCGCGPIO) |= SYSCTL_RCGCGPIO_R1;
 	while( (HWREG(SYSCTL_PRGPIO) & SYSCTL_PRGPIO_R1 ) != SYSCTL_PRGPIO_R1);
@@ -174,6 +242,30 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
   ES_Event ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
 
+	// several of our timers ran out on the same tick and the timer module 
+	// sent them as one event. Run them through the machine one at a time, 
+	// highest timer number first, the same order they used to be posted in.
+	// The one exception is LOST_COMM: when it ends the pairing window on the
+	// same tick as a PAIR_RETRY, it goes first and the retry is dropped, so
+	// no REQ2PAIR goes out after the window has closed
+	if (ThisEvent.EventType == ES_TIMEOUT_SET) {
+		uint16_t Expired = ThisEvent.EventParam;
+		ES_Event TimeoutEvent;
+		TimeoutEvent.EventType = ES_TIMEOUT;
+		if ((Expired & BitNum2SetMask[LOST_COMM_TIMER]) != 0) {
+			Expired &= BitNum2ClrMask[LOST_COMM_TIMER];
+			Expired &= BitNum2ClrMask[PAIR_RETRY_TIMER];
+			TimeoutEvent.EventParam = LOST_COMM_TIMER;
+			RunFARMER_SM(TimeoutEvent);
+		}
+		while (Expired != 0) {
+			TimeoutEvent.EventParam = ES_GetMSBitSet(Expired);
+			Expired &= BitNum2ClrMask[TimeoutEvent.EventParam];
+			RunFARMER_SM(TimeoutEvent);
+		}
+		return ReturnEvent;
+	}
+
   switch ( CurrentState )
   {
 
@@ -183,7 +275,7 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
 				//Get_AccelTail();
 				Get_FB();
 				Get_RL();
-				ES_Timer_InitTimer( DEBUG_TIMER, 950 );
+				ES_Timer_InitTimerSlack( DEBUG_TIMER, 950, 50 );
 			}
 			if (ThisEvent.EventType == ES_NEW_KEY){
 				if (ThisEvent.EventParam == 'f'){
@@ -218,6 +310,28 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
 				else if (ThisEvent.EventParam == '8' ){
 					SR_Write( 8 );
 				}
+				else if (ThisEvent.EventParam == 't' ){
+					printf("tx cycles/frame: last %u avg %u\r\n", GetTxFrameCycles(), GetTxAvgFrameCycles());
+				}
+				else if (ThisEvent.EventParam == 'q' ){
+					printf("tx queue: depth %u max %u drops pairing %u ctrl %u\r\n", TxQueue_GetDepth(), TxQueue_GetMaxDepth(),
+						TxQueue_GetDrops(TX_LANE_PAIRING), TxQueue_GetDrops(TX_LANE_CTRL));
+					printf("tx retries %u expired %u superseded %u gave up %u\r\n", TxQueue_GetRetransmits(),
+						TxQueue_GetExpired(), TxQueue_GetSuperseded(), TxQueue_GetGaveUp());
+				}
+				else if (ThisEvent.EventParam == 'l' ){
+					LinkStats_Print();
+				}
+				else if (ThisEvent.EventParam == 'p' ){
+					printf("pairing: %u ok %u failed, last %u ms in %u tries, worst %u ms %u tries\r\n",
+						Pairings, PairFailures, LastPairTime, LastPairAttempts, MaxPairTime, MaxPairAttempts);
+					if (Pairings != 0) {
+						printf("pairing average %u ms %u.%02u tries\r\n", (uint16_t)(TotalPairTime / Pairings),
+							(uint16_t)(TotalPairAttempts / Pairings), (uint16_t)(TotalPairAttempts * 100 / Pairings % 100));
+					}
+					printf("resumed %u given up %u, last %u ms worst %u ms\r\n", Resumes, ResumeFailures,
+						LastResumeTime, MaxResumeTime);
+				}
 			}
 			if (ThisEvent.EventType == DB_TOUCHBUTTONUP){
 				Eyes_On();
@@ -245,75 +359,60 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
 			}
 		
 			if ( ThisEvent.EventType == ES_PAIR) {
-				// read DOGTAG number
-				//DogTag = ;
-				
-				// send a REQ2PAIR packet 
-				ES_Event NewEvent;
-				NewEvent.EventType = ES_SENDPACKET;
-				NewEvent.EventParam = FARMER_DOG_REQ_2_PAIR; // type of data packet to construct
-				PostComm_Service(NewEvent);
-				
-				// start LOST_COMM timer
-				ES_Timer_InitTimer(LOST_COMM_TIMER, LOST_COMM_TIME);
-				
-				// go to Wait4PairResponse
-				CurrentState = Wait4PairResponse;
+				if (!XBeeLink_IsReady()) {
+					// the radio's rate is still being set up, press again in a moment
+					printf("XBee link not ready, not pairing yet\r\n");
+				} else {
+					StartPairing();
+					
+					// go to Wait4PairResponse
+					CurrentState = Wait4PairResponse;
+				}
 			}
       
     break;
 
 		case Wait4PairResponse:
+			// DOGs we already have keep getting their control packets
+			HandlePeerEvent(ThisEvent);
 
 			if (ThisEvent.EventType == ES_UNPAIR) {
 				printf("UNPAIRED\r\n");
 				//if there is ever a place where we want to unpair, send this event to farmer_sm
 				//most likeley for debugging - add in a key-press event that sends this event
-				Eyes_Off();
-				SR_Write( 0 );
+				EndPairing(false);
+				UnpairAll();
 				CurrentState = Wait2Pair;
 			}
 			
+			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == PAIR_RETRY_TIMER ) {
+				SendPairRequest();
+			}
+			
 			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LOST_COMM_TIMER ) {
-				printf("Lost communication, No ACK\r\n");
+				printf("Lost communication, No ACK after %u tries\r\n", PairAttempts);
+				EndPairing(false);
 				
-				Eyes_Off();
-				SR_Write( 0 );
-				
-				// go back to Wait2Pair state
-				CurrentState = Wait2Pair;
+				// back to whatever we were doing before
+				CurrentState = (PeerTable_NumPaired() + PeerTable_NumResuming() > 0) ? Paired : Wait2Pair;
+				if (CurrentState == Wait2Pair) {
+					UnpairAll();
+				}
 			}
 			
 			if (ThisEvent.EventType == ES_DOG_ACK_RECEIVED ) {
-				printf("PAIRED\r\n");
-				
-				Eyes_On();
-				
-				// generate ecryption key 
-				CreateEncryptionKey();
-				
-				// send an ENCR_KEY packet 
-				ES_Event NewEvent;
-				NewEvent.EventType = ES_SENDPACKET;
-				NewEvent.EventParam = FARMER_DOG_ENCR_KEY;
-				PostComm_Service(NewEvent);
-				// set encryption index to zero
-				ResetEncryptionIndex();
-				
-				// start LOST_COMM timer
-				ES_Timer_InitTimer(LOST_COMM_TIMER, LOST_COMM_TIME);
-				
-				// start INTER_MESSAGE timer
-				ES_Timer_InitTimer(INTER_MESSAGE_TIMER, INTER_MESSAGE_TIME);
-				
-				// start GameTimer
-				//ES_Timer_InitTimer(GAME_TIMER, 10000);
-				
-				// switch Pair bool state 
-				Send_Pair = false;
-				
-				// go to Paired state
-				CurrentState = Paired;
+				// one we lost answering takes its old session back, and we keep
+				// waiting for the new one
+				if (ResumePeer(PeerTable_Find(ThisEvent.EventParam), true)) {
+					printf("RESUMED\r\n");
+				} else if (AcceptPeer(ThisEvent.EventParam)) {
+					printf("PAIRED\r\n");
+					ES_Timer_StopTimer(LOST_COMM_TIMER);
+					EndPairing(true);
+					
+					// go to Paired state
+					CurrentState = Paired;
+				}
 			}
 		
     break;
@@ -362,76 +461,43 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
 		break;*/
 			
 		case Paired:      
-			
-			if (ThisEvent.EventType == TOGGLE_PERIPHERAL){
-				//flip peripheral toggle flag
-				Toggle_Periph = true;}
+			HandlePeerEvent(ThisEvent);
 			
 			if (ThisEvent.EventType == ES_UNPAIR) {
 				printf("UNPAIRED\r\n");
 				
-				Eyes_Off();
-				SR_Write( 0 );
-				
-				// switch Pair bool state 
-				Send_Pair = true;
-				
 				//if there is ever a place where we want to unpair, send this event to farmer_sm
 				//most likeley for debugging - add in a key-press event that sends this event
+				UnpairAll();
 				CurrentState = Wait2Pair;
 			}
 			
+			if (ThisEvent.EventType == ES_DOG_ACK_RECEIVED ) {
+				// a DOG we lost answering its unicast REQ2PAIR
+				if (ResumePeer(PeerTable_Find(ThisEvent.EventParam), true)) {
+					printf("RESUMED\r\n");
+				}
+			}
+			
+			if ( ThisEvent.EventType == ES_PAIR) {
+				// add another DOG
+				StartPairing();
+				CurrentState = Wait4PairResponse;
+			}
+			
 			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == GAME_TIMER ) {
 				printf("GAME OVER\r\n");
 				
-				Eyes_Off();
-				SR_Write( 0 );
-
-				// switch Pair bool state 
-				Send_Pair = true;
+				UnpairAll();
 				
 				// go back to Wait2Pair state
 				CurrentState = Wait2Pair;
 			}
-		
-			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LOST_COMM_TIMER ) {
-				printf("Lost communication\r\n");
-				
-				Eyes_Off();
-				SR_Write( 0 );
-				
-				// switch Pair bool state 
-				Send_Pair = true;
-				
-				// go back to Wait2Pair state
-				CurrentState = Wait2Pair;
-			}
-			
-			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == INTER_MESSAGE_TIMER ) {
-				// send a CTRL packet
-				ES_Event NewEvent;
-				NewEvent.EventType = ES_SENDPACKET;
-				NewEvent.EventParam = FARMER_DOG_CTRL;
-				PostComm_Service(NewEvent);		
-
-				// start inter message timer
-				ES_Timer_InitTimer(INTER_MESSAGE_TIMER, INTER_MESSAGE_TIME);
-			}
-			
-			if ( ThisEvent.EventType == ES_DOG_REPORT_RECEIVED ) {
-				// change LED display values
-				IMU_LED_value = IMU2LED( IMU_Data );
-				SR_Write( IMU_LED_value );
-				
-				// start LOST_COMM timer
-				ES_Timer_InitTimer(LOST_COMM_TIMER, LOST_COMM_TIME);
-			}
 			
-			if ( ThisEvent.EventType == ES_DOG_RESET_ENCR_RECEIVED ) {
-				ResetEncryptionIndex();
-				
-				// start LOST_COMM timer
-				ES_Timer_InitTimer(LOST_COMM_TIMER, LOST_COMM_TIME);
+			// the last DOG dropped off and its session ran out
+			if ((CurrentState == Paired) && (PeerTable_NumPaired() + PeerTable_NumResuming() == 0)) {
+				UnpairAll();
+				CurrentState = Wait2Pair;
 			}
 		
     break;		
@@ -447,41 +513,388 @@ ES_Event RunFARMER_SM( ES_Event ThisEvent )
      CreateEncryptionKey
 
  Parameters
-     none
+     uint8_t* : where to put the key
 
  Returns
      none
 
  Description
-     Populates EncryptionKey array with 32 randomly-generated encryption bytes
+     Populates a DOG's key with 32 randomly-generated encryption bytes
 
  Author
      Sarah Cabreros
 ****************************************************************************/
-static void CreateEncryptionKey(void) {
+static void CreateEncryptionKey(uint8_t* Key) {
 	for (int i = 0; i < NUM_ENCRYPTION_BYTES; i++) {
-		EncryptionKey[i] = rand() % 255; // generate a random integer between 0 and 255
+		Key[i] = rand() % 255; // generate a random integer between 0 and 255
+	}
+}
+
+/****************************************************************************
+ Function
+     StartPairing
+
+ Description
+     Broadcasts a REQ2PAIR for the DOG selected on the dog tag switches and
+     gives it PAIR_WINDOW_TIME to answer, repeating the REQ2PAIR in the
+     meantime (see SendPairRequest)
+     The first press also seeds rand(), which the retry backoff, the keys
+     and the TxSlots hops all come from. Unseeded every FARMER would draw
+     the same numbers; the cycle count when someone first presses the
+     button is different on every unit and every power up.
+****************************************************************************/
+static void StartPairing(void) {
+	if (!RandomSeeded) {
+		srand(ES_GetCycles());
+		RandomSeeded = true;
+	}
+	PairStartTime = ES_Timer_GetTime();
+	PairAttempts = 0;
+	SendPairRequest();
+	
+	// start LOST_COMM timer for the whole window
+	ES_Timer_InitTimerSlack(LOST_COMM_TIMER, PAIR_WINDOW_TIME, LOST_COMM_SLACK);
+}
+
+/****************************************************************************
+ Function
+     SendPairRequest
+
+ Description
+     Sends one REQ2PAIR and sets PAIR_RETRY_TIMER for the next. The wait
+     starts at PAIR_RETRY_BASE_TIME and doubles with each try up to
+     PAIR_RETRY_MAX_TIME; a random amount of up to half of it is taken off,
+     so that FARMERs that started together don't keep colliding.
+****************************************************************************/
+static void SendPairRequest(void) {
+	uint16_t Backoff = PAIR_RETRY_BASE_TIME;
+	uint8_t i;
+	
+	// send a REQ2PAIR packet 
+	ES_Event NewEvent;
+	NewEvent.EventType = ES_SENDPACKET;
+	NewEvent.EventParam = SENDPACKET_PARAM(FARMER_DOG_REQ_2_PAIR, NO_PEER); // type of data packet to construct
+	PostComm_Service(NewEvent);
+	
+	for (i = 0; (i < PairAttempts) && (Backoff < PAIR_RETRY_MAX_TIME); i++) {
+		Backoff *= 2;
+	}
+	if (Backoff > PAIR_RETRY_MAX_TIME) {
+		Backoff = PAIR_RETRY_MAX_TIME;
 	}
+	if (PairAttempts < 0xFF) {
+		PairAttempts++;
+	}
+	ES_Timer_InitTimer(PAIR_RETRY_TIMER, Backoff - rand() % (Backoff / 2 + 1));
 }
 
 /****************************************************************************
  Function
-     GetEncryptionKey
+     EndPairing
 
  Parameters
-     none
+     bool : true if a DOG answered, false if the window ran out or was
+            called off
+
+ Description
+     Stops the retries and keeps the time to pair and the number of tries
+****************************************************************************/
+static void EndPairing(bool Paired) {
+	ES_Timer_StopTimer(PAIR_RETRY_TIMER);
+	
+	if (!Paired) {
+		PairFailures++;
+		return;
+	}
+	LastPairTime = ES_Timer_GetTime() - PairStartTime;
+	LastPairAttempts = PairAttempts;
+	if (LastPairTime > MaxPairTime) {
+		MaxPairTime = LastPairTime;
+	}
+	if (LastPairAttempts > MaxPairAttempts) {
+		MaxPairAttempts = LastPairAttempts;
+	}
+	TotalPairTime += LastPairTime;
+	TotalPairAttempts += LastPairAttempts;
+	Pairings++;
+}
+
+/****************************************************************************
+ Function
+     AcceptPeer
+
+ Parameters
+     uint16_t : source address of the DOG that answered our REQ2PAIR
+
+ Returns
+     bool, false if there is no room for another DOG
+
+ Description
+     Gives the DOG a slot and its own encryption key, sends it the key and
+     starts its lost communication deadline. The first DOG also starts the
+     control packets going.
+****************************************************************************/
+static bool AcceptPeer(uint16_t Address) {
+	uint8_t Slot = PeerTable_Add(Address);
+	Peer_t* pPeer = PeerTable_Get(Slot);
+	
+	if (pPeer == NULL) {
+		printf("no room for DOG %x\r\n", Address);
+		return false;
+	}
+	
+	// generate ecryption key 
+	CreateEncryptionKey(pPeer->EncryptionKey);
+	
+	// send an ENCR_KEY packet 
+	ES_Event NewEvent;
+	NewEvent.EventType = ES_SENDPACKET;
+	NewEvent.EventParam = SENDPACKET_PARAM(FARMER_DOG_ENCR_KEY, Slot);
+	PostComm_Service(NewEvent);
+	// set encryption index to zero
+	pPeer->EncryptionIndex = 0;
+	pPeer->DogTag = DogTag;
+	
+	// start its lost comm deadline and link stats
+	LinkStats_ResetPeer(Slot);
+	pPeer->LostCommDeadline = ES_Timer_GetTime() + LOST_COMM_TIME;
+	
+	// its first CTRL is due straight away
+	pPeer->LastCtrlTime = ES_Timer_GetTime() - CTRL_HEARTBEAT_TIME;
+	
+	// start INTER_MESSAGE timer if this is the first one
+	if (PeerTable_NumPaired() == 0) {
+#ifdef CTRL_SLOTTED
+		TxSlots_Init(DogTag, ES_Timer_GetTime());
+#endif
+#ifdef CTRL_ON_CHANGE
+		ES_Timer_InitTimer(INTER_MESSAGE_TIMER, CTRL_TICK_DELAY(CTRL_SAMPLE_TIME));
+#else
+		ES_Timer_InitTimer(INTER_MESSAGE_TIMER, CTRL_TICK_DELAY(LinkStats_GetInterMessageTime()));
+#endif
+#ifdef SAMPLE_ON_TIMER
+		ES_Timer_InitTimer(SAMPLE_TIMER, CTRL_SAMPLE_TIME);
+#endif
+	}
+	pPeer->State = PeerPaired;
+	
+	Eyes_On();
+	
+	// switch Pair bool state 
+	Send_Pair = false;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     HandlePeerEvent
+
+ Parameters
+     ES_Event : the event to process
+
+ Description
+     The part of the Paired state that is about the DOGs themselves, also
+     run while pairing another one. Lost communication is checked against
+     each DOG's deadline on every INTER_MESSAGE_TIMER tick.
+
+     A DOG we lose is not forgotten straight away. It goes to PeerResuming
+     with its address, key and key index kept for SESSION_GRACE_TIME, and
+     gets a unicast REQ2PAIR every RESUME_RETRY_TIME. If it ACKs, it is
+     sent the key it already had and carries on. If it turns out it never
+     lost us (a report or a reset request comes in), it carries on with the
+     key index as it was. Either way no new pairing is needed.
+
+     With CTRL_ON_CHANGE the tick comes every CTRL_SAMPLE_TIME and a DOG
+     gets a control packet when the inputs have moved past the deadband
+     since its last one (but not sooner than half the LinkStats interval
+     after it), or when CTRL_HEARTBEAT_TIME has gone by without one. At
+     most one goes out per tick.
+
+     Without it, one control packet goes out per LinkStats interval, handed
+     to the paired DOGs in turn. With CTRL_AGGREGATE the inputs are still
+     sampled every CTRL_SAMPLE_TIME, on SAMPLE_TIMER.
+
+     With CTRL_SLOTTED every tick is moved on to the start of our TxSlots
+     slot, so CTRL_ON_CHANGE samples once per TDMA_FRAME_TIME and the
+     interval is rounded up to a whole number of cycles.
+****************************************************************************/
+static void HandlePeerEvent(ES_Event ThisEvent) {
+	Peer_t* pPeer;
+	uint8_t Slot;
+	
+	if (ThisEvent.EventType == TOGGLE_PERIPHERAL){
+		//flip peripheral toggle flag
+		Toggle_Periph = true;}
+	
+#ifdef SAMPLE_ON_TIMER
+	if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SAMPLE_TIMER ) {
+		uint8_t Inputs[CTRL_DATA_LENGTH];
+		ReadInputs(Inputs);
+		RecordSample(Inputs, ES_Timer_GetTime());
+		if (PeerTable_NumPaired() + PeerTable_NumResuming() != 0) {
+			ES_Timer_InitTimer(SAMPLE_TIMER, CTRL_SAMPLE_TIME);
+		}
+	}
+#endif
+	
+	if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == INTER_MESSAGE_TIMER ) {
+		uint16_t Now = ES_Timer_GetTime();
+		
+		// hold the session of anyone we haven't heard from in LOST_COMM_TIME,
+		// and drop the ones that didn't come back in SESSION_GRACE_TIME
+		for (Slot = 0; Slot < MAX_PEERS; Slot++) {
+			pPeer = PeerTable_Get(Slot);
+			if ((pPeer->State == PeerPaired) && ((int16_t)(Now - pPeer->LostCommDeadline) >= 0)) {
+				printf("Lost communication with DOG %d, holding its session\r\n", pPeer->DogTag);
+				pPeer->State = PeerResuming;
+				pPeer->SessionDeadline = Now + SESSION_GRACE_TIME;
+				SendResumeRequest(Slot, Now);
+			} else if (pPeer->State == PeerResuming) {
+				if ((int16_t)(Now - pPeer->SessionDeadline) >= 0) {
+					printf("DOG %d did not come back\r\n", pPeer->DogTag);
+					PeerTable_Remove(Slot);
+					ResumeFailures++;
+				} else if ((uint16_t)(Now - pPeer->LastResumeTry) >= RESUME_RETRY_TIME) {
+					SendResumeRequest(Slot, Now);
+				}
+			}
+		}
+		
+		LinkStats_Update();
+		
+#ifdef CTRL_ON_CHANGE
+		// look at the inputs again soon, whether or not anyone needs a CTRL now
+		Slot = PickCtrlSlot(Now);
+		if (PeerTable_NumPaired() + PeerTable_NumResuming() != 0) {
+			ES_Timer_InitTimer(INTER_MESSAGE_TIMER, CTRL_TICK_DELAY(CTRL_SAMPLE_TIME));
+		}
+#else
+		Slot = PeerTable_NextPaired();
+		if ((Slot != NO_PEER) || (PeerTable_NumResuming() != 0)) {
+			// start inter message timer, at whatever rate the link can take
+			ES_Timer_InitTimer(INTER_MESSAGE_TIMER, CTRL_TICK_DELAY(LinkStats_GetInterMessageTime()));
+		}
+#endif
+		if (Slot != NO_PEER) {
+			// send a CTRL packet
+			ES_Event NewEvent;
+			NewEvent.EventType = ES_SENDPACKET;
+			NewEvent.EventParam = SENDPACKET_PARAM(CTRL_PACKET_TYPE, Slot);
+			PostComm_Service(NewEvent);		
+		}
+	}
+	
+	pPeer = PeerTable_Get(ThisEvent.EventParam);
+	
+	// still talking to us, so it never lost its key
+	if (((ThisEvent.EventType == ES_DOG_REPORT_RECEIVED) || (ThisEvent.EventType == ES_DOG_RESET_ENCR_RECEIVED)) &&
+			(pPeer != NULL) && (pPeer->State == PeerResuming)) {
+		ResumePeer(ThisEvent.EventParam, false);
+	}
+	
+	if ( ThisEvent.EventType == ES_DOG_REPORT_RECEIVED && pPeer != NULL ) {
+		// change LED display values
+		IMU_LED_value = IMU2LED( pPeer->IMU_Data );
+		SR_Write( IMU_LED_value );
+		
+		// restart its lost comm deadline
+		pPeer->LostCommDeadline = ES_Timer_GetTime() + LOST_COMM_TIME;
+	}
+	
+	if ( ThisEvent.EventType == ES_DOG_RESET_ENCR_RECEIVED && pPeer != NULL ) {
+		pPeer->EncryptionIndex = 0;
+		
+		// restart its lost comm deadline
+		pPeer->LostCommDeadline = ES_Timer_GetTime() + LOST_COMM_TIME;
+	}
+}
+
+/****************************************************************************
+ Function
+     SendResumeRequest
+
+ Parameters
+     uint8_t : slot of a DOG in PeerResuming
+     uint16_t : ES_Timer_GetTime() now
+
+ Description
+     Asks the DOG to come back with a REQ2PAIR sent to it alone
+****************************************************************************/
+static void SendResumeRequest(uint8_t Slot, uint16_t Now) {
+	ES_Event NewEvent;
+	NewEvent.EventType = ES_SENDPACKET;
+	NewEvent.EventParam = SENDPACKET_PARAM(FARMER_DOG_REQ_2_PAIR, Slot);
+	PostComm_Service(NewEvent);
+	PeerTable_Get(Slot)->LastResumeTry = Now;
+}
+
+/****************************************************************************
+ Function
+     ResumePeer
+
+ Parameters
+     uint8_t : slot the DOG was found in, may be NO_PEER
+     bool : true to send the DOG its key again (it ACKed a REQ2PAIR, so it
+            has dropped it) and start the key index over
 
  Returns
-     Pointer to first element in EncryptionKey array
+     bool, false if the slot isn't a session waiting to be resumed
 
  Description
-     Getter function to access EncryptionKey array
+     Puts the DOG back in PeerPaired with the key it had and restarts its
+     lost comm deadline. Its first CTRL is due straight away.
+****************************************************************************/
+static bool ResumePeer(uint8_t Slot, bool SendKey) {
+	Peer_t* pPeer = PeerTable_Get(Slot);
+	uint16_t Now = ES_Timer_GetTime();
+	
+	if ((pPeer == NULL) || (pPeer->State != PeerResuming)) {
+		return false;
+	}
+	
+	if (SendKey) {
+		ES_Event NewEvent;
+		NewEvent.EventType = ES_SENDPACKET;
+		NewEvent.EventParam = SENDPACKET_PARAM(FARMER_DOG_ENCR_KEY, Slot);
+		PostComm_Service(NewEvent);
+		pPeer->EncryptionIndex = 0;
+	}
+	
+	// time since we last heard from it
+	LastResumeTime = Now - (uint16_t)(pPeer->LostCommDeadline - LOST_COMM_TIME);
+	if (LastResumeTime > MaxResumeTime) {
+		MaxResumeTime = LastResumeTime;
+	}
+	Resumes++;
+	
+	pPeer->State = PeerPaired;
+	pPeer->LostCommDeadline = Now + LOST_COMM_TIME;
+	pPeer->LastCtrlTime = Now - CTRL_HEARTBEAT_TIME;
+	Eyes_On();
+	return true;
+}
 
- Author
-     Sarah Cabreros
+/****************************************************************************
+ Function
+     UnpairAll
+
+ Description
+     Forgets every DOG and goes dark
 ****************************************************************************/
-uint8_t* GetEncryptionKey(void) {
-	return &EncryptionKey[0];
+static void UnpairAll(void) {
+	for (uint8_t Slot = 0; Slot < MAX_PEERS; Slot++) {
+		PeerTable_Remove(Slot);
+	}
+	ES_Timer_StopTimer(INTER_MESSAGE_TIMER);
+#ifdef SAMPLE_ON_TIMER
+	ES_Timer_StopTimer(SAMPLE_TIMER);
+#endif
+	
+	Eyes_Off();
+	SR_Write( 0 );
+	
+	// switch Pair bool state 
+	Send_Pair = true;
 }
 
 /****************************************************************************
@@ -530,7 +943,67 @@ uint8_t GetDogTag(void) {
 }
 
 uint8_t* GetSensorData(void) {
-	static uint8_t Data[3];
+	static uint8_t Data[CTRL_DATA_LENGTH];
+	
+	ReadInputs(Data);
+	
+	// the toggle goes out once
+	Toggle_Periph = false;
+	
+	return &Data[0];
+}
+
+/****************************************************************************
+ Function
+     GetSensorSamples
+
+ Returns
+     uint8_t * : a FARMER_DOG_CTRL_AGG payload (CTRL_AGG_LENGTH bytes)
+     holding the last CTRL_AGG_SAMPLES input samples
+
+ Description
+     The samples are the ones taken every CTRL_SAMPLE_TIME, by PickCtrlSlot
+     or on SAMPLE_TIMER, plus a fresh one if the newest is older than that. A pending
+     peripheral toggle goes out once, with the newest sample.
+****************************************************************************/
+uint8_t* GetSensorSamples(void) {
+	static uint8_t Payload[CTRL_AGG_LENGTH];
+	uint16_t Now = ES_Timer_GetTime();
+	uint8_t* pOut = &Payload[CTRL_AGG_SAMPLE_INDEX];
+	uint8_t Which;
+	uint8_t i;
+	
+	if ((NumSamples == 0) || ((uint16_t)(Now - SampleTimes[NewestSample]) >= CTRL_SAMPLE_TIME)) {
+		uint8_t Inputs[CTRL_DATA_LENGTH];
+		ReadInputs(Inputs);
+		RecordSample(Inputs, Now);
+	}
+	
+	memset(Payload, 0, sizeof(Payload));
+	Payload[CTRL_AGG_COUNT_INDEX] = NumSamples;
+	Payload[CTRL_AGG_TIME_INDEX] = SampleTimes[NewestSample] >> 8;
+	Payload[CTRL_AGG_TIME_INDEX + 1] = SampleTimes[NewestSample] & 0xFF;
+	
+	Which = NewestSample;
+	for (i = 0; i < NumSamples; i++) {
+		uint16_t Age = SampleTimes[NewestSample] - SampleTimes[Which];
+		*pOut++ = (Age > 0xFF) ? 0xFF : Age;
+		memcpy(pOut, Samples[Which], CTRL_DATA_LENGTH);
+		pOut += CTRL_DATA_LENGTH;
+		Which = (Which + CTRL_AGG_SAMPLES - 1) % CTRL_AGG_SAMPLES;
+	}
+	
+	if( Toggle_Periph ){
+		Payload[CTRL_AGG_NEWEST_INDEX + 2] |= BIT0HI;
+		Toggle_Periph = false;
+	}
+	
+	return &Payload[0];
+}
+
+// Reads the inputs into a CTRL_DATA_LENGTH byte buffer without using up the
+// peripheral toggle
+static void ReadInputs(uint8_t *Data) {
 	//static uint8_t CurrPeriphState;
 	Data[0] = Get_FB();
 	Data[1] = Get_RL();
@@ -546,10 +1019,9 @@ uint8_t* GetSensorData(void) {
 		DigitalByte |= BIT0HI;
 	} 
 	LastPeriphState = CurrPeriphState;*/
-	// if the toggle flag is high, set the byte and clear the flag
+	// if the toggle flag is high, set the bit
 	if( Toggle_Periph ){
 		DigitalByte |= BIT0HI;
-		Toggle_Periph = false;
 	}
 	// otherwise do nothing
 	
@@ -559,9 +1031,54 @@ uint8_t* GetSensorData(void) {
 	} // else leave bit 1 low	
 	
 	Data[2] = DigitalByte;
+}
+
+// Adds a sample to the ring GetSensorSamples reads. The toggle bit is left
+// out, it isn't part of the trajectory.
+static void RecordSample(uint8_t *Inputs, uint16_t Now) {
+	NewestSample = (NewestSample + 1) % CTRL_AGG_SAMPLES;
+	memcpy(Samples[NewestSample], Inputs, CTRL_DATA_LENGTH);
+	Samples[NewestSample][2] &= ~BIT0HI;
+	SampleTimes[NewestSample] = Now;
+	if (NumSamples < CTRL_AGG_SAMPLES) {
+		NumSamples++;
+	}
+}
+
+#ifdef CTRL_ON_CHANGE
+// Picks the paired DOG that should get a CTRL on this tick, NO_PEER if none
+// does. Goes round the DOGs in turn so one busy DOG can't starve the rest.
+static uint8_t PickCtrlSlot(uint16_t Now) {
+	uint8_t Inputs[CTRL_DATA_LENGTH];
+	uint16_t MinInterval = LinkStats_GetInterMessageTime() / 2;
+	uint8_t Slot = CtrlRoundRobin;
+	uint8_t i;
 	
-	return &Data[0];
+	ReadInputs(Inputs);
+	RecordSample(Inputs, Now);
+	
+	for (i = 0; i < MAX_PEERS; i++) {
+		Slot = (Slot + 1) % MAX_PEERS;
+		Peer_t* pPeer = PeerTable_Get(Slot);
+		if (pPeer->State != PeerPaired) {
+			continue;
+		}
+		
+		uint16_t Since = Now - pPeer->LastCtrlTime;
+		bool Changed = Toggle_Periph ||
+			(abs(Inputs[0] - pPeer->LastCtrl[0]) > CTRL_DEADBAND) ||
+			(abs(Inputs[1] - pPeer->LastCtrl[1]) > CTRL_DEADBAND) ||
+			// bit 0 is the toggle, handled above
+			(((Inputs[2] ^ pPeer->LastCtrl[2]) & ~BIT0HI) != 0);
+		
+		if ((Since >= CTRL_HEARTBEAT_TIME) || (Changed && (Since >= MinInterval))) {
+			CtrlRoundRobin = Slot;
+			return Slot;
+		}
+	}
+	return NO_PEER;
 }
+#endif
 
 bool Get_PairCommand( void ){
 	return Send_Pair;
@@ -0,0 +1,172 @@
+/****************************************************************************
+ Module
+   HostHardware.c
+
+ Description
+   Host stand-in for the Tiva GPIO and ADC, so the FARMER's services can be
+   built and run on a PC along with VirtualUART.c:
+
+   - HWREG reads and writes go to a small register file. The GPIO clock
+     ready bits (SYSCTL_PRGPIO) always read as set, so the init loops that
+     wait on them fall straight through
+   - input pins read whatever the host program last set with
+     HostHW_SetInputs, in the port's GPIO_O_DATA + ALL_BITS register
+   - ADC_MultiInit and ADC_MultiRead (ADMulti.c on the target) return the
+     levels set with HostHW_SetAnalog
+   - PortFunctionInit (EnablePA25_PB23_PD7_PF0.c on the target) has no pin
+     muxing to do
+
+ Notes
+   Only built with ES_HOST_BUILD, in place of ADMulti.c and
+   EnablePA25_PB23_PD7_PF0.c. Every register starts at 0 and outputs are
+   only remembered, nothing drives them.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+#ifdef ES_HOST_BUILD
+/*----------------------------- Include Files -----------------------------*/
+#include "HostHardware.h"
+#include "Constants.h"
+#include "ADMulti.h"
+#include "EnablePA25_PB23_PD7_PF0.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define HOST_REGISTERS      32    // distinct register addresses touched
+#define ALL_GPIO_READY      0x3F  // ports A to F
+
+typedef struct {
+	uint32_t Address;
+	uint32_t Value;
+} HostRegister_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+
+/*---------------------------- Module Variables ---------------------------*/
+static HostRegister_t Registers[HOST_REGISTERS];
+static uint8_t NumRegisters;
+static volatile uint32_t Spare;  // absorbs accesses once the file is full
+
+static uint16_t Analog[HOST_ADC_CHANNELS];
+static uint8_t NumChannels;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     HostHW_Register
+
+ Parameters
+     uint32_t : register address, as it would be on the Tiva
+
+ Returns
+     volatile uint32_t * : where the register is kept
+
+ Description
+     What HWREG expands to in host builds. A register is added to the
+     file the first time it is used.
+****************************************************************************/
+volatile uint32_t* HostHW_Register(uint32_t Address) {
+	uint8_t i;
+
+	for (i = 0; i < NumRegisters; i++) {
+		if (Registers[i].Address == Address) {
+			break;
+		}
+	}
+	if (i == NumRegisters) {
+		if (NumRegisters == HOST_REGISTERS) {
+			return &Spare;
+		}
+		Registers[i].Address = Address;
+		Registers[i].Value = 0;
+		NumRegisters++;
+	}
+	if (Address == SYSCTL_PRGPIO) {
+		Registers[i].Value = ALL_GPIO_READY;
+	}
+	return &Registers[i].Value;
+}
+
+/****************************************************************************
+ Function
+     HostHW_SetInputs
+
+ Parameters
+     uint32_t : GPIO port base, GPIO_PORTA_BASE ..
+     uint8_t : pins to set
+     uint8_t : their levels, a 1 bit for high
+
+ Description
+     Drives input pins, as a switch or a jumper on the board would
+****************************************************************************/
+void HostHW_SetInputs(uint32_t PortBase, uint8_t Pins, uint8_t Levels) {
+	volatile uint32_t *pData = HostHW_Register(PortBase + GPIO_O_DATA + ALL_BITS);
+
+	*pData = (*pData & ~Pins) | (Levels & Pins);
+}
+
+/****************************************************************************
+ Function
+     HostHW_SetAnalog
+
+ Parameters
+     uint8_t : ADC_MultiRead channel, 0 for PE0
+     uint16_t : 12 bit level it converts to
+
+ Description
+     Sets what an analog input (the accelerometers) reads
+****************************************************************************/
+void HostHW_SetAnalog(uint8_t Channel, uint16_t Value) {
+	if (Channel < HOST_ADC_CHANNELS) {
+		Analog[Channel] = Value & 0xFFF;
+	}
+}
+
+/****************************************************************************
+ Function
+     ADC_MultiInit
+
+ Parameters
+     uint8_t : channels to convert, 1-4
+
+ Description
+     Stands in for the ADMulti.c version, there is nothing to set up
+****************************************************************************/
+void ADC_MultiInit(uint8_t HowMany) {
+	if ((HowMany == 0) || (HowMany > HOST_ADC_CHANNELS)) {
+		return;
+	}
+	NumChannels = HowMany;
+}
+
+/****************************************************************************
+ Function
+     ADC_MultiRead
+
+ Parameters
+     uint32_t[4] : filled in with the level of each channel converted
+
+ Description
+     Stands in for the ADMulti.c version, returns the HostHW_SetAnalog
+     levels straight away
+****************************************************************************/
+void ADC_MultiRead(uint32_t data[4]) {
+	uint8_t i;
+
+	for (i = 0; i < NumChannels; i++) {
+		data[i] = Analog[i];
+	}
+}
+
+/****************************************************************************
+ Function
+     PortFunctionInit
+
+ Description
+     Stands in for the PinMux Utility's version, no pins to configure
+****************************************************************************/
+void PortFunctionInit(void) {
+}
+
+#endif /* ES_HOST_BUILD */
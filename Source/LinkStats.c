@@ -0,0 +1,368 @@
+/****************************************************************************
+ Module
+   LinkStats.c
+
+ Description
+   Keeps track of how the radio link to each DOG is doing, and sets the
+   control packet rate from it.
+
+   Per DOG: a moving average of the RSSI of its packets, a moving average
+   of the time between its reports, and the transmit status results of
+   the frames sent to it.
+
+   Overall: the estimated air time used by everything sent and received,
+   taken over LINK_WINDOW, the UART receive errors and the receive queue
+   overruns.
+
+   Once every LINK_WINDOW the interval between control packets is adjusted
+   AIMD style. A clean, quiet window takes LINK_RATE_STEP off it, and a
+   window with failed or dropped frames or a busy channel doubles it. It is
+   kept within INTER_MESSAGE_MIN_TIME and INTER_MESSAGE_MAX_TIME.
+
+ Notes
+   Only used from service context.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdio.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+
+#include "Constants.h"
+#include "LinkStats.h"
+#include "PacketCodec.h"
+#include "TxQueue.h"
+#include "RxQueue.h"
+#include "TxSlots.h"
+#include "UART.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// moving averages take 1/2^AVG_SHIFT of each new sample
+#define AVG_SHIFT           3
+
+// frames sent whose transmit status we may still get, to find their DOG
+#define SENT_MAP_SIZE       8
+
+#define LINK_WINDOW         ONE_SEC
+#define LINK_RATE_STEP      20  // ms taken off the interval after a clean window
+#define LINK_BUSY_PERMILLE  300 // air time above this is congestion
+#define LINK_IDLE_PERMILLE  150 // and below this leaves room to speed up
+#define LINK_FAIL_PERCENT   20  // failed transmit statuses above this back off
+#define LINK_CLEAN_PERCENT  5   // and below this allow speeding up
+
+// 802.15.4 at 250 kbps: 32 us a byte, 6 bytes of PHY header and 11 of MAC
+// header and FCS around each RF payload, and an 11 byte MAC ack after it
+#define AIR_US_PER_BYTE     32
+#define AIR_OVERHEAD_BYTES  (6 + 11)
+#define AIR_ACK_BYTES       11
+
+/*---------------------------- Module Functions ---------------------------*/
+static void AddAirtime(uint8_t RFBytes);
+
+/*---------------------------- Module Variables ---------------------------*/
+static LinkPeerStats_t PeerStats[MAX_PEERS];
+
+static struct {
+	uint8_t FrameID;
+	uint8_t Slot;
+} SentMap[SENT_MAP_SIZE];
+static uint8_t SentMapNext;
+
+static uint16_t InterMessageTime;
+
+// the current window
+static uint16_t WindowStart;
+static uint32_t WindowAirtimeUs;
+static uint16_t WindowTxOK;
+static uint16_t WindowTxFail;
+static uint16_t LastQueueLosses; // TxQueue drops and expiries at the start of it
+
+// result of the last full window
+static uint16_t AirtimePermille;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     LinkStats_Init
+
+ Description
+     Clears everything and starts at INTER_MESSAGE_TIME
+****************************************************************************/
+void LinkStats_Init(void) {
+	uint8_t i;
+
+	for (i = 0; i < MAX_PEERS; i++) {
+		LinkStats_ResetPeer(i);
+	}
+	for (i = 0; i < SENT_MAP_SIZE; i++) {
+		SentMap[i].Slot = NO_PEER;
+	}
+	SentMapNext = 0;
+	InterMessageTime = INTER_MESSAGE_TIME;
+	WindowStart = ES_Timer_GetTime();
+	WindowAirtimeUs = 0;
+	WindowTxOK = 0;
+	WindowTxFail = 0;
+	LastQueueLosses = 0;
+	AirtimePermille = 0;
+}
+
+/****************************************************************************
+ Function
+     LinkStats_ResetPeer
+
+ Parameters
+     uint8_t : slot that has just been given to a DOG
+****************************************************************************/
+void LinkStats_ResetPeer(uint8_t Slot) {
+	if (Slot >= MAX_PEERS) {
+		return;
+	}
+	PeerStats[Slot].RSSIAvg16 = 0;
+	PeerStats[Slot].ReportIntervalAvg = 0;
+	PeerStats[Slot].LastReportTime = ES_Timer_GetTime();
+	PeerStats[Slot].Reports = 0;
+	PeerStats[Slot].TxSuccesses = 0;
+	PeerStats[Slot].TxFailures = 0;
+	PeerStats[Slot].KeyResets = 0;
+}
+
+/****************************************************************************
+ Function
+     LinkStats_FrameSent
+
+ Parameters
+     uint8_t : frame ID the frame went out with
+     uint8_t : slot of the DOG it is for, NO_PEER for a broadcast
+     uint8_t : frame data length
+****************************************************************************/
+void LinkStats_FrameSent(uint8_t FrameID, uint8_t Slot, uint8_t FrameLength) {
+	SentMap[SentMapNext].FrameID = FrameID;
+	SentMap[SentMapNext].Slot = Slot;
+	SentMapNext = (SentMapNext + 1) % SENT_MAP_SIZE;
+
+	AddAirtime(FrameLength - TX_API_OVERHEAD);
+}
+
+/****************************************************************************
+ Function
+     LinkStats_TxStatus
+
+ Parameters
+     uint8_t : frame ID from the transmit status
+     bool : true if it was delivered
+****************************************************************************/
+void LinkStats_TxStatus(uint8_t FrameID, bool Success) {
+	uint8_t i;
+
+	if (Success) {
+		WindowTxOK++;
+	} else {
+		WindowTxFail++;
+	}
+
+	for (i = 0; i < SENT_MAP_SIZE; i++) {
+		if ((SentMap[i].FrameID == FrameID) && (SentMap[i].Slot < MAX_PEERS)) {
+			if (Success) {
+				PeerStats[SentMap[i].Slot].TxSuccesses++;
+			} else {
+				PeerStats[SentMap[i].Slot].TxFailures++;
+			}
+#ifdef CTRL_SLOTTED
+			TxSlots_TxStatus(Success);
+#endif
+			return;
+		}
+	}
+}
+
+/****************************************************************************
+ Function
+     LinkStats_FrameReceived
+
+ Parameters
+     uint8_t : slot of the DOG it came from, NO_PEER if we don't know it
+     uint8_t : RSSI byte of the frame (-dBm)
+     uint8_t : frame data length
+     bool : true for a status report
+****************************************************************************/
+void LinkStats_FrameReceived(uint8_t Slot, uint8_t RSSI, uint8_t FrameLength, bool IsReport) {
+	AddAirtime(FrameLength - RX_API_OVERHEAD);
+
+	if (Slot >= MAX_PEERS) {
+		return;
+	}
+
+	LinkPeerStats_t *pStats = &PeerStats[Slot];
+	uint16_t Now = ES_Timer_GetTime();
+
+	// start the average at the first sample rather than creeping up from 0
+	if (pStats->RSSIAvg16 == 0) {
+		pStats->RSSIAvg16 = (uint16_t)RSSI << 4;
+	} else {
+		pStats->RSSIAvg16 += (int16_t)(((uint16_t)RSSI << 4) - pStats->RSSIAvg16) >> AVG_SHIFT;
+	}
+
+	if (IsReport) {
+		uint16_t Interval = Now - pStats->LastReportTime;
+		if (pStats->Reports == 0) {
+			pStats->ReportIntervalAvg = Interval;
+		} else {
+			pStats->ReportIntervalAvg += (int16_t)(Interval - pStats->ReportIntervalAvg) >> AVG_SHIFT;
+		}
+		pStats->LastReportTime = Now;
+		pStats->Reports++;
+#ifdef CTRL_SLOTTED
+		TxSlots_ReportReceived(Now);
+#endif
+	}
+}
+
+/****************************************************************************
+ Function
+     LinkStats_KeyReset
+
+ Parameters
+     uint8_t : slot of the DOG that asked for an encryption reset
+
+ Description
+     Counts a key index mismatch the DOG found. With CTRL_KEY_INDEX there
+     should be none.
+****************************************************************************/
+void LinkStats_KeyReset(uint8_t Slot) {
+	if (Slot < MAX_PEERS) {
+		PeerStats[Slot].KeyResets++;
+	}
+}
+
+/****************************************************************************
+ Function
+     LinkStats_Update
+
+ Description
+     Closes the window once LINK_WINDOW has gone by and adjusts the control
+     packet interval from what happened in it.
+****************************************************************************/
+void LinkStats_Update(void) {
+	uint16_t Now = ES_Timer_GetTime();
+	uint16_t Elapsed = Now - WindowStart;
+	uint16_t QueueLosses;
+	uint16_t Statuses;
+	uint8_t i;
+
+	if (Elapsed < LINK_WINDOW) {
+		return;
+	}
+
+	AirtimePermille = WindowAirtimeUs / Elapsed;
+
+	QueueLosses = TxQueue_GetExpired() + TxQueue_GetGaveUp();
+	for (i = 0; i < NUM_TX_LANES; i++) {
+		QueueLosses += TxQueue_GetDrops((TxLane_t)i);
+	}
+
+	Statuses = WindowTxOK + WindowTxFail;
+	if ((QueueLosses != LastQueueLosses) || (AirtimePermille > LINK_BUSY_PERMILLE) ||
+			(WindowTxFail * 100 > Statuses * LINK_FAIL_PERCENT)) {
+		// congested, back off hard
+		InterMessageTime *= 2;
+		if (InterMessageTime > INTER_MESSAGE_MAX_TIME) {
+			InterMessageTime = INTER_MESSAGE_MAX_TIME;
+		}
+	} else if ((Statuses != 0) && (AirtimePermille < LINK_IDLE_PERMILLE) &&
+			(WindowTxFail * 100 <= Statuses * LINK_CLEAN_PERCENT)) {
+		// clean, creep up the rate
+		if (InterMessageTime >= INTER_MESSAGE_MIN_TIME + LINK_RATE_STEP) {
+			InterMessageTime -= LINK_RATE_STEP;
+		} else {
+			InterMessageTime = INTER_MESSAGE_MIN_TIME;
+		}
+	}
+
+	LastQueueLosses = QueueLosses;
+	WindowStart = Now;
+	WindowAirtimeUs = 0;
+	WindowTxOK = 0;
+	WindowTxFail = 0;
+}
+
+/****************************************************************************
+ Function
+     LinkStats_GetInterMessageTime
+
+ Returns
+     uint16_t : ms between control packets
+****************************************************************************/
+uint16_t LinkStats_GetInterMessageTime(void) {
+	return InterMessageTime;
+}
+
+/****************************************************************************
+ Function
+     LinkStats_GetPeer
+
+ Returns
+     const LinkPeerStats_t * : stats for a slot, NULL if out of range
+****************************************************************************/
+const LinkPeerStats_t* LinkStats_GetPeer(uint8_t Slot) {
+	if (Slot >= MAX_PEERS) {
+		return NULL;
+	}
+	return &PeerStats[Slot];
+}
+
+/****************************************************************************
+ Function
+     LinkStats_GetAirtimePermille
+
+ Returns
+     uint16_t : estimated share of the channel in use over the last window
+****************************************************************************/
+uint16_t LinkStats_GetAirtimePermille(void) {
+	return AirtimePermille;
+}
+
+/****************************************************************************
+ Function
+     LinkStats_Print
+
+ Description
+     Dumps everything to the terminal, for the debug keys
+****************************************************************************/
+void LinkStats_Print(void) {
+	uint8_t Slot;
+
+	printf("link: interval %u ms airtime %u/1000 uart errors oe %u fe %u pe %u be %u\r\n",
+		InterMessageTime, AirtimePermille, UART_GetErrorCount(UART_ERR_OVERRUN),
+		UART_GetErrorCount(UART_ERR_FRAMING), UART_GetErrorCount(UART_ERR_PARITY),
+		UART_GetErrorCount(UART_ERR_BREAK));
+	printf("rx queue: frames %u most waiting %u overruns %u rts holds %u for %lu ms\r\n",
+		RxQueue_GetFrames(), RxQueue_GetMaxDepth(), RxQueue_GetOverruns(), UART_GetRxHolds(),
+		(unsigned long)UART_GetRxHeldMs());
+#ifdef CTRL_SLOTTED
+	printf("slots: slot %u of %u collisions %u hops %u reports in slot %u\r\n", TxSlots_GetSlot(),
+		TDMA_SLOTS, TxSlots_GetCollisions(), TxSlots_GetHops(), TxSlots_GetReportsInSlot());
+#endif
+	for (Slot = 0; Slot < MAX_PEERS; Slot++) {
+		Peer_t *pPeer = PeerTable_Get(Slot);
+		LinkPeerStats_t *pStats = &PeerStats[Slot];
+		if (pPeer->State == PeerFree) {
+			continue;
+		}
+		printf("DOG %u: rssi -%u dBm reports %u every %u ms tx ok %u failed %u key resets %u\r\n",
+			pPeer->DogTag, pStats->RSSIAvg16 >> 4, pStats->Reports, pStats->ReportIntervalAvg,
+			pStats->TxSuccesses, pStats->TxFailures, pStats->KeyResets);
+	}
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+static void AddAirtime(uint8_t RFBytes) {
+	WindowAirtimeUs += (uint32_t)(RFBytes + AIR_OVERHEAD_BYTES + AIR_ACK_BYTES) * AIR_US_PER_BYTE;
+}
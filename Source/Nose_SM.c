@@ -20,6 +20,7 @@
 #include "ES_ShortTimer.h"
 #include "Nose_SM.h"
 
+#ifndef ES_HOST_BUILD
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
 #include "inc/hw_gpio.h"
@@ -27,6 +28,9 @@
 #include "driverlib/sysctl.h"
 #include "driverlib/pin_map.h"	// Define PART_TM4C123GH6PM in project
 #include "driverlib/gpio.h"
+#else
+#include "HostHardware.h"
+#endif
 
 /*----------------------------- Module Defines ----------------------------*/
 // these times assume a 1.000mS/tick timing
@@ -36,6 +40,9 @@
 #define FIVE_SEC (ONE_SEC*5)
 #define QUARTER_SEC (ONE_SEC/4)
 #define DEBOUNCE_DELAY (ONE_SEC/4)
+// the debounce delay does not need to be exact, let the timer module line it
+// up with other timeouts that are due around the same time
+#define DEBOUNCE_SLACK (ONE_SEC/40)
 
 // Data pins
 // Pair button on PB4
@@ -95,7 +102,7 @@ bool InitNose_SM ( uint8_t Priority )
 	//LastButtonState = ( HWREG(GPIO_PORTB_BASE + ( GPIO_O_DATA + ALL_BITS )) & TOUCHBUTTON_HI );
 	CurrentState = DebouncingNose;
 	
-	ES_Timer_InitTimer(NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY);
+	ES_Timer_InitTimerSlack( NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY, DEBOUNCE_SLACK );
 	
   // Post Event ES_Init to ButtonDebounce queue (this service)
   ThisEvent.EventType = ES_INIT;
@@ -166,7 +173,7 @@ ES_Event RunNose_SM( ES_Event ThisEvent ) {
 				ES_Event Button_Event;
 				case NOSEBUTTON_UP :
 					printf("nose button up in TBD\r\n");
-					ES_Timer_InitTimer( NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY );
+					ES_Timer_InitTimerSlack( NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY, DEBOUNCE_SLACK );
 					CurrentState = DebouncingNose;
 					//Button_Event.EventType = DB_TOUCHBUTTONUP;
 					Button_Event.EventParam = ES_Timer_GetTime();
@@ -175,7 +182,7 @@ ES_Event RunNose_SM( ES_Event ThisEvent ) {
 					break;
 				case NOSEBUTTON_DOWN :
 					//printf("touch button down in TBD\r\n");
-					ES_Timer_InitTimer( NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY);
+					ES_Timer_InitTimerSlack( NOSEDEBOUNCE_TIMER, DEBOUNCE_DELAY, DEBOUNCE_SLACK );
 					CurrentState = DebouncingNose;	
 					break;
 				default :
@@ -0,0 +1,387 @@
+/****************************************************************************
+ Module
+   PacketCodec.c
+
+ Description
+   Builds and takes apart the FARMER/DOG packets described by PACKET_SCHEMA
+   in PacketCodec.h. The lengths all come from the schema at compile time,
+   and the encoder sums the checksum as it writes the frame so it is
+   finished in a single pass. The payload is copied or encrypted and summed
+   a word at a time by PacketKernel.
+
+   Packet_RunBench (host builds only) sends every packet in the schema
+   through a round trip, from every key index, and times Packet_Encode and
+   Packet_Decode per packet type.
+
+ Notes
+   Has no hardware or framework dependencies so that it can be run from a
+   test program on a PC.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stddef.h>
+
+#include "PacketCodec.h"
+#include "PacketKernel.h"
+
+#ifdef ES_HOST_BUILD
+#include <string.h>
+#include <time.h>
+#endif
+
+/*----------------------------- Module Defines ----------------------------*/
+#define PKT_SPEC_ENTRY(Name, Type, Sender, Payload, Cipher) \
+	[Type] = { (Sender), (Payload), PKT_LENGTH_##Name, (Cipher) },
+
+#ifdef ES_HOST_BUILD
+#define BENCH_ROUNDS       16      // random payloads per packet type and key index
+#define BENCH_FRAME_SIZE   (HEADER_LENGTH + MAX_FRAME_LENGTH + 1)
+#define BENCH_DOG_ADDRESS  0x2180
+#endif
+
+/*---------------------------- Module Functions ---------------------------*/
+#ifdef ES_HOST_BUILD
+static bool CheckFarmerPacket(uint8_t PacketType, uint8_t StartIndex, const uint8_t *Key);
+static bool CheckDogPacket(uint8_t PacketType);
+static uint8_t BuildDogFrame(uint8_t *Frame, uint8_t PacketType, const uint8_t *Payload);
+static bool ChecksumGood(const uint8_t *Frame, uint8_t FrameLength);
+static uint32_t Random(void);
+#endif
+
+/*---------------------------- Module Variables ---------------------------*/
+static const PacketSpec_t PacketSpecs[NUM_PACKET_TYPES] = { PACKET_SCHEMA(PKT_SPEC_ENTRY) };
+
+#ifdef ES_HOST_BUILD
+static uint32_t RandomState;
+#endif
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Packet_GetSpec
+
+ Parameters
+     uint8_t : packet type code
+
+ Returns
+     const PacketSpec_t * : its schema entry, NULL if it isn't one we know
+****************************************************************************/
+const PacketSpec_t* Packet_GetSpec(uint8_t PacketType) {
+	if ((PacketType >= NUM_PACKET_TYPES) || (PacketSpecs[PacketType].FrameLength == 0)) {
+		return NULL;
+	}
+	return &PacketSpecs[PacketType];
+}
+
+/****************************************************************************
+ Function
+     Packet_Encode
+
+ Parameters
+     uint8_t * : buffer of TX_FRAME_SIZE bytes to build the frame in
+     uint8_t : packet type, must be one the FARMER sends
+     uint8_t : frame ID for the transmit status
+     uint16_t : destination address
+     const uint8_t * : the payload, as many bytes as the schema says
+     const uint8_t * : the DOG's key, only needed for encrypted packets
+     uint8_t * : index of the next key byte to use, moved on past the bytes
+                 used; only needed for encrypted packets
+
+ Returns
+     uint8_t : frame data length to commit, 0 if nothing was built
+
+ Description
+     Writes the whole API frame, delimiter through checksum.
+****************************************************************************/
+uint8_t Packet_Encode(uint8_t *Frame, uint8_t PacketType, uint8_t FrameID, uint16_t Dest,
+	const uint8_t *Payload, const uint8_t *Key, uint8_t *pKeyIndex) {
+	const PacketSpec_t *pSpec = Packet_GetSpec(PacketType);
+	uint8_t *pOut;
+	uint8_t Sum;
+
+	if ((pSpec == NULL) || (pSpec->Sender != PKT_FROM_FARMER)) {
+		return 0;
+	}
+	if ((pSpec->Cipher != PKT_CLEAR) && ((Key == NULL) || (pKeyIndex == NULL))) {
+		return 0;
+	}
+
+	// delimiter and length are not part of the checksum
+	Frame[START_BYTE_INDEX] = START_DELIMITER;
+	Frame[LENGTH_MSB_BYTE_INDEX] = 0x00;
+	Frame[LENGTH_LSB_BYTE_INDEX] = pSpec->FrameLength;
+
+	Frame[API_IDENT_BYTE_INDEX_TX] = API_IDENTIFIER_Tx;
+	Frame[FRAME_ID_BYTE_INDEX] = FrameID;
+	Frame[DEST_ADDRESS_MSB_INDEX] = Dest >> 8;
+	Frame[DEST_ADDRESS_LSB_INDEX] = Dest & 0xFF;
+	Frame[OPTIONS_BYTE_INDEX_TX] = OPTIONS;
+	Sum = API_IDENTIFIER_Tx + FrameID + (Dest >> 8) + (Dest & 0xFF) + OPTIONS;
+
+	pOut = &Frame[PACKET_TYPE_BYTE_INDEX_TX];
+	if (pSpec->Cipher != PKT_CLEAR) {
+		uint8_t KeyIndex = *pKeyIndex;
+
+		if (pSpec->Cipher == PKT_XOR_INDEXED) {
+			*pOut = KEY_INDEX_FLAG | KeyIndex;
+			Sum += *pOut++;
+		}
+
+		*pOut = PacketType ^ Key[KeyIndex];
+		Sum += *pOut++;
+		*pKeyIndex = (KeyIndex + 1) & KEY_INDEX_MASK;
+		Sum += PacketKernel_XorSum(pOut, Payload, pSpec->PayloadLength, Key, pKeyIndex);
+	} else {
+		*pOut = PacketType;
+		Sum += *pOut++;
+		Sum += PacketKernel_CopySum(pOut, Payload, pSpec->PayloadLength);
+	}
+	pOut += pSpec->PayloadLength;
+	*pOut = 0xFF - Sum;
+
+	return pSpec->FrameLength;
+}
+
+/****************************************************************************
+ Function
+     Packet_Decode
+
+ Parameters
+     const uint8_t * : frame data (API ID -> RF data) from the parser, its
+                       checksum has already been checked
+     uint8_t : frame data length
+     PacketView_t * : filled in with what was found
+
+ Returns
+     bool, true for a DOG packet we know that is long enough to hold its
+     payload
+****************************************************************************/
+bool Packet_Decode(const uint8_t *Frame, uint8_t FrameLength, PacketView_t *pView) {
+	const PacketSpec_t *pSpec;
+
+	if ((FrameLength <= PACKET_TYPE_BYTE_INDEX_RX) || (Frame[API_IDENT_BYTE_INDEX_RX] != API_IDENTIFIER_Rx)) {
+		return false;
+	}
+	pSpec = Packet_GetSpec(Frame[PACKET_TYPE_BYTE_INDEX_RX]);
+	if ((pSpec == NULL) || (pSpec->Sender != PKT_FROM_DOG) || (FrameLength < pSpec->FrameLength)) {
+		return false;
+	}
+
+	pView->PacketType = Frame[PACKET_TYPE_BYTE_INDEX_RX];
+	pView->Source = (Frame[SOURCE_ADDRESS_MSB_INDEX] << 8) | Frame[SOURCE_ADDRESS_LSB_INDEX];
+	pView->RSSI = Frame[RSSI_BYTE_INDEX];
+	pView->Payload = &Frame[PACKET_TYPE_BYTE_INDEX_RX + 1];
+	pView->PayloadLength = pSpec->PayloadLength;
+	return true;
+}
+
+#ifdef ES_HOST_BUILD
+/****************************************************************************
+ Function
+     Packet_RunBench
+
+ Parameters
+     uint32_t : calls to time per packet type
+     uint32_t : seed for the payloads and the key
+     PacketBenchResult_t * : filled in
+
+ Description
+     Round trips every packet in PACKET_SCHEMA, BENCH_ROUNDS random
+     payloads at a time. FARMER packets are built with Packet_Encode from
+     every key index and taken apart the way a DOG does it: the length,
+     the header, the checksum, the clear key index byte of PKT_XOR_INDEXED
+     packets, the decrypted type and payload and the key index left behind
+     are all checked. DOG packets are built the way a DOG sends them and
+     must come back out of Packet_Decode as they went in, and be turned
+     away one byte short. Then times both directions per packet type.
+****************************************************************************/
+void Packet_RunBench(uint32_t Iterations, uint32_t Seed, PacketBenchResult_t *pResult) {
+	uint8_t Frame[BENCH_FRAME_SIZE];
+	uint8_t Payload[MAX_FRAME_LENGTH];
+	uint8_t Key[NUM_ENCRYPTION_BYTES];
+	volatile uint8_t Sink = 0;
+	uint8_t Type;
+	uint8_t Round;
+	uint8_t Start;
+	uint8_t i;
+
+	memset(pResult, 0, sizeof(*pResult));
+	RandomState = (Seed != 0) ? Seed : 1;
+	for (i = 0; i < NUM_ENCRYPTION_BYTES; i++) {
+		Key[i] = Random();
+	}
+
+	for (Type = 0; Type < NUM_PACKET_TYPES; Type++) {
+		const PacketSpec_t *pSpec = Packet_GetSpec(Type);
+
+		for (Round = 0; Round < BENCH_ROUNDS; Round++) {
+			if (pSpec->Sender == PKT_FROM_DOG) {
+				if (!CheckDogPacket(Type)) {
+					pResult->Mismatches++;
+				}
+				pResult->Cases++;
+				continue;
+			}
+			// the key index only matters to encrypted packets, but it costs nothing
+			for (Start = 0; Start < NUM_ENCRYPTION_BYTES; Start++) {
+				if (!CheckFarmerPacket(Type, Start, Key)) {
+					pResult->Mismatches++;
+				}
+				pResult->Cases++;
+			}
+		}
+	}
+
+	for (i = 0; i < MAX_FRAME_LENGTH; i++) {
+		Payload[i] = Random();
+	}
+	for (Type = 0; Type < NUM_PACKET_TYPES; Type++) {
+		const PacketSpec_t *pSpec = Packet_GetSpec(Type);
+		uint8_t KeyIndex = 0;
+		clock_t StartTime;
+		uint32_t n;
+
+		if (pSpec->Sender == PKT_FROM_FARMER) {
+			StartTime = clock();
+			for (n = 0; n < Iterations; n++) {
+				Sink += Packet_Encode(Frame, Type, n, BENCH_DOG_ADDRESS, Payload, Key, &KeyIndex);
+			}
+			pResult->EncodeNs[Type] = 1e9 * (double)(clock() - StartTime) / CLOCKS_PER_SEC / Iterations;
+		} else {
+			uint8_t FrameLength = BuildDogFrame(Frame, Type, Payload);
+			PacketView_t View;
+
+			memset(&View, 0, sizeof(View));
+			StartTime = clock();
+			for (n = 0; n < Iterations; n++) {
+				Frame[RSSI_BYTE_INDEX + HEADER_LENGTH] = n;
+				Sink += Packet_Decode(&Frame[HEADER_LENGTH], FrameLength, &View);
+				Sink += View.RSSI;
+			}
+			pResult->DecodeNs[Type] = 1e9 * (double)(clock() - StartTime) / CLOCKS_PER_SEC / Iterations;
+		}
+	}
+	(void)Sink;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Builds a FARMER packet from StartIndex and takes it apart as a DOG would
+static bool CheckFarmerPacket(uint8_t PacketType, uint8_t StartIndex, const uint8_t *Key) {
+	const PacketSpec_t *pSpec = Packet_GetSpec(PacketType);
+	uint8_t Frame[BENCH_FRAME_SIZE];
+	uint8_t Payload[MAX_FRAME_LENGTH];
+	uint8_t FrameID = 1 + Random() % 255;
+	uint8_t KeyIndex = StartIndex;
+	uint8_t DogIndex = StartIndex;
+	uint8_t FrameLength;
+	uint8_t Pos = PACKET_TYPE_BYTE_INDEX_TX;
+	uint8_t i;
+
+	for (i = 0; i < pSpec->PayloadLength; i++) {
+		Payload[i] = Random();
+	}
+	memset(Frame, 0xA5, sizeof(Frame));
+	FrameLength = Packet_Encode(Frame, PacketType, FrameID, BENCH_DOG_ADDRESS, Payload, Key, &KeyIndex);
+
+	if ((FrameLength != pSpec->FrameLength) || (Frame[START_BYTE_INDEX] != START_DELIMITER) ||
+			(Frame[LENGTH_MSB_BYTE_INDEX] != 0) || (Frame[LENGTH_LSB_BYTE_INDEX] != FrameLength) ||
+			!ChecksumGood(Frame, FrameLength) ||
+			(Frame[HEADER_LENGTH + FrameLength + 1] != 0xA5) ||
+			(Frame[API_IDENT_BYTE_INDEX_TX] != API_IDENTIFIER_Tx) || (Frame[FRAME_ID_BYTE_INDEX] != FrameID) ||
+			(Frame[DEST_ADDRESS_MSB_INDEX] != (BENCH_DOG_ADDRESS >> 8)) ||
+			(Frame[DEST_ADDRESS_LSB_INDEX] != (BENCH_DOG_ADDRESS & 0xFF))) {
+		return false;
+	}
+
+	if (pSpec->Cipher == PKT_CLEAR) {
+		return (KeyIndex == StartIndex) && (Frame[Pos] == PacketType) &&
+			(memcmp(&Frame[Pos + 1], Payload, pSpec->PayloadLength) == 0);
+	}
+
+	// the DOG takes the key index from the packet when there is one
+	if (pSpec->Cipher == PKT_XOR_INDEXED) {
+		if (Frame[Pos] != (KEY_INDEX_FLAG | StartIndex)) {
+			return false;
+		}
+		DogIndex = Frame[Pos++] & KEY_INDEX_MASK;
+	}
+	if ((Frame[Pos++] ^ Key[DogIndex]) != PacketType) {
+		return false;
+	}
+	DogIndex = (DogIndex + 1) & KEY_INDEX_MASK;
+	for (i = 0; i < pSpec->PayloadLength; i++) {
+		if ((Frame[Pos++] ^ Key[DogIndex]) != Payload[i]) {
+			return false;
+		}
+		DogIndex = (DogIndex + 1) & KEY_INDEX_MASK;
+	}
+	return KeyIndex == DogIndex;
+}
+
+// Sends a DOG packet with a random payload through Packet_Decode
+static bool CheckDogPacket(uint8_t PacketType) {
+	const PacketSpec_t *pSpec = Packet_GetSpec(PacketType);
+	uint8_t Frame[BENCH_FRAME_SIZE];
+	uint8_t Payload[MAX_FRAME_LENGTH];
+	uint8_t FrameLength;
+	PacketView_t View;
+	uint8_t i;
+
+	for (i = 0; i < pSpec->PayloadLength; i++) {
+		Payload[i] = Random();
+	}
+	FrameLength = BuildDogFrame(Frame, PacketType, Payload);
+
+	if ((FrameLength != pSpec->FrameLength) || !ChecksumGood(Frame, FrameLength) ||
+			!Packet_Decode(&Frame[HEADER_LENGTH], FrameLength, &View) ||
+			Packet_Decode(&Frame[HEADER_LENGTH], FrameLength - 1, &View)) {
+		return false;
+	}
+	// the short one may have written to View, decode it again
+	Packet_Decode(&Frame[HEADER_LENGTH], FrameLength, &View);
+	return (View.PacketType == PacketType) && (View.Source == BENCH_DOG_ADDRESS) &&
+		(View.RSSI == Frame[HEADER_LENGTH + RSSI_BYTE_INDEX]) &&
+		(View.PayloadLength == pSpec->PayloadLength) &&
+		(memcmp(View.Payload, Payload, pSpec->PayloadLength) == 0);
+}
+
+// A whole receive API frame as the XBee hands it over for a DOG packet,
+// returns the frame data length
+static uint8_t BuildDogFrame(uint8_t *Frame, uint8_t PacketType, const uint8_t *Payload) {
+	const PacketSpec_t *pSpec = Packet_GetSpec(PacketType);
+	uint8_t *pData = &Frame[HEADER_LENGTH];
+	uint8_t Length = RX_API_OVERHEAD + 1 + pSpec->PayloadLength;
+
+	Frame[START_BYTE_INDEX] = START_DELIMITER;
+	Frame[LENGTH_MSB_BYTE_INDEX] = 0;
+	Frame[LENGTH_LSB_BYTE_INDEX] = Length;
+	pData[API_IDENT_BYTE_INDEX_RX] = API_IDENTIFIER_Rx;
+	pData[SOURCE_ADDRESS_MSB_INDEX] = BENCH_DOG_ADDRESS >> 8;
+	pData[SOURCE_ADDRESS_LSB_INDEX] = BENCH_DOG_ADDRESS & 0xFF;
+	pData[RSSI_BYTE_INDEX] = Random();
+	pData[OPTIONS_BYTE_INDEX_RX] = 0;
+	pData[PACKET_TYPE_BYTE_INDEX_RX] = PacketType;
+	memcpy(&pData[PACKET_TYPE_BYTE_INDEX_RX + 1], Payload, pSpec->PayloadLength);
+	pData[Length] = 0xFF - PacketKernel_Sum(pData, Length);
+	return Length;
+}
+
+// Frame data and checksum add up to 0xFF
+static bool ChecksumGood(const uint8_t *Frame, uint8_t FrameLength) {
+	return (uint8_t)(PacketKernel_Sum(&Frame[HEADER_LENGTH], FrameLength) + Frame[HEADER_LENGTH + FrameLength]) == 0xFF;
+}
+
+// xorshift32
+static uint32_t Random(void) {
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return RandomState;
+}
+#endif
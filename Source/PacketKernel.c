@@ -0,0 +1,346 @@
+/****************************************************************************
+ Module
+   PacketKernel.c
+
+ Description
+   The byte crunching under PacketCodec and XBeeParser, done a 32 bit word
+   at a time instead of a byte at a time:
+
+   - PacketKernel_Sum adds up the bytes of a frame for its checksum
+   - PacketKernel_CopySum copies a clear payload into a frame and sums it
+   - PacketKernel_XorSum XORs a payload with the DOG's key into a frame,
+     sums what it wrote, and moves the key index on
+
+   On the M4 (and anything else with the ARM SIMD extension) four bytes
+   are summed with one USADA8. Elsewhere the sum is split into two 16 bit
+   lanes, which cannot carry into each other for the 255 bytes a frame can
+   have. The keystream for four bytes is cut out of two key words with a
+   shift, with the key index wrapped by a mask, so there is no test for
+   the end of the key per byte. Up to three bytes left over at the end go
+   a byte at a time.
+
+   PacketKernel_RunBench (host builds only) checks the kernel bit for bit
+   against the byte at a time loops it replaced, and times both across
+   frame sizes.
+
+ Notes
+   Words are little endian, as on the M4 and the host. Loads and stores
+   go through memcpy, which the compilers turn into single (unaligned)
+   LDR/STR, so frames and keys need no particular alignment.
+   NUM_ENCRYPTION_BYTES must be a power of two and a whole number of words.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <string.h>
+
+#include "PacketKernel.h"
+#include "PeerTable.h"
+
+#ifdef ES_HOST_BUILD
+#include <time.h>
+#endif
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
+/*----------------------------- Module Defines ----------------------------*/
+#define KEY_BYTE_MASK   (NUM_ENCRYPTION_BYTES - 1)
+#define KEY_WORD_MASK   (NUM_ENCRYPTION_BYTES / 4 - 1)
+
+#if ((NUM_ENCRYPTION_BYTES & KEY_BYTE_MASK) != 0) || ((NUM_ENCRYPTION_BYTES % 4) != 0)
+#error "PacketKernel needs NUM_ENCRYPTION_BYTES to be a power of two of at least 4"
+#endif
+
+// Acc += the four bytes of Word, SUM_FOLD gives the 8 bit sum back
+#if defined(__ARM_FEATURE_SIMD32) || (defined(__ARMCC_VERSION) && defined(__TARGET_FEATURE_DSPMUL))
+#define SUM4(Acc, Word)   ((Acc) = __usada8((Word), 0, (Acc)))
+#define SUM_FOLD(Acc)     ((uint8_t)(Acc))
+#else
+#define SUM4(Acc, Word)   ((Acc) += ((Word) & 0x00FF00FFu) + (((Word) >> 8) & 0x00FF00FFu))
+#define SUM_FOLD(Acc)     ((uint8_t)((Acc) + ((Acc) >> 16)))
+#endif
+
+#ifdef ES_HOST_BUILD
+#define BENCH_MAX_LENGTH  255
+#endif
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint32_t LoadWord(const uint8_t *p);
+static void StoreWord(uint8_t *p, uint32_t Word);
+#ifdef ES_HOST_BUILD
+static uint8_t ByteSum(const uint8_t *pData, uint8_t Length);
+static uint8_t ByteXorSum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length,
+	const uint8_t *Key, uint8_t *pKeyIndex);
+static uint32_t Random(void);
+#endif
+
+/*---------------------------- Module Variables ---------------------------*/
+#ifdef ES_HOST_BUILD
+static const uint8_t KernelBenchLengths[KERNEL_BENCH_SIZES] = { 1, 4, 7, 13, 19, 32, 64, 128 };
+static uint32_t RandomState;
+#endif
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     PacketKernel_Sum
+
+ Parameters
+     const uint8_t * : bytes to add up
+     uint8_t : how many
+
+ Returns
+     uint8_t : their sum, modulo 256
+****************************************************************************/
+uint8_t PacketKernel_Sum(const uint8_t *pData, uint8_t Length) {
+	uint32_t Acc = 0;
+	uint8_t Sum;
+
+	for (; Length >= 4; Length -= 4) {
+		uint32_t Word = LoadWord(pData);
+		SUM4(Acc, Word);
+		pData += 4;
+	}
+	Sum = SUM_FOLD(Acc);
+	while (Length-- != 0) {
+		Sum += *pData++;
+	}
+	return Sum;
+}
+
+/****************************************************************************
+ Function
+     PacketKernel_CopySum
+
+ Parameters
+     uint8_t * : where to write
+     const uint8_t * : bytes to copy, must not overlap pOut
+     uint8_t : how many
+
+ Returns
+     uint8_t : sum of the bytes copied, modulo 256
+****************************************************************************/
+uint8_t PacketKernel_CopySum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length) {
+	uint32_t Acc = 0;
+	uint8_t Sum;
+
+	for (; Length >= 4; Length -= 4) {
+		uint32_t Word = LoadWord(pIn);
+		StoreWord(pOut, Word);
+		SUM4(Acc, Word);
+		pIn += 4;
+		pOut += 4;
+	}
+	Sum = SUM_FOLD(Acc);
+	while (Length-- != 0) {
+		*pOut = *pIn++;
+		Sum += *pOut++;
+	}
+	return Sum;
+}
+
+/****************************************************************************
+ Function
+     PacketKernel_XorSum
+
+ Parameters
+     uint8_t * : where to write, may be the same as pIn
+     const uint8_t * : bytes to encrypt
+     uint8_t : how many
+     const uint8_t * : the DOG's key, NUM_ENCRYPTION_BYTES of it
+     uint8_t * : key index of the first byte, moved on past the bytes used
+
+ Returns
+     uint8_t : sum of the bytes written, modulo 256
+
+ Description
+     Byte n goes out as pIn[n] ^ Key[(index + n) % NUM_ENCRYPTION_BYTES],
+     exactly as the byte loop in Packet_Encode used to do it
+****************************************************************************/
+uint8_t PacketKernel_XorSum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length,
+	const uint8_t *Key, uint8_t *pKeyIndex) {
+	uint8_t KeyIndex = *pKeyIndex & KEY_BYTE_MASK;
+	uint8_t KeyWord = KeyIndex >> 2;
+	uint32_t Shift = (KeyIndex & 3) * 8;
+	uint32_t KeyLo = LoadWord(&Key[KeyWord * 4]);
+	uint32_t Acc = 0;
+	uint8_t Sum;
+
+	*pKeyIndex = (KeyIndex + Length) & KEY_BYTE_MASK;
+
+	for (; Length >= 4; Length -= 4) {
+		uint32_t KeyHi = LoadWord(&Key[(++KeyWord & KEY_WORD_MASK) * 4]);
+		// the four key bytes from KeyIndex on; split in two shifts so that a
+		// Shift of 0 takes nothing from KeyHi instead of shifting by 32
+		uint32_t Stream = (KeyLo >> Shift) | ((KeyHi << 1) << (31 - Shift));
+		uint32_t Word = LoadWord(pIn) ^ Stream;
+
+		StoreWord(pOut, Word);
+		SUM4(Acc, Word);
+		KeyLo = KeyHi;
+		KeyIndex += 4;
+		pIn += 4;
+		pOut += 4;
+	}
+	Sum = SUM_FOLD(Acc);
+	while (Length-- != 0) {
+		*pOut = *pIn++ ^ Key[KeyIndex++ & KEY_BYTE_MASK];
+		Sum += *pOut++;
+	}
+	return Sum;
+}
+
+#ifdef ES_HOST_BUILD
+/****************************************************************************
+ Function
+     PacketKernel_RunBench
+
+ Parameters
+     uint32_t : calls to time per frame size and function
+     uint32_t : seed for the data and the key
+     PacketKernelBenchResult_t * : filled in
+
+ Description
+     First runs every length up to BENCH_MAX_LENGTH, from every key index
+     and every input and output alignment, through both the kernel and the
+     byte loops and compares the sums, the bytes written and the key index
+     left behind. Then times PacketKernel_Sum and PacketKernel_XorSum
+     against the byte loops at each of KernelBenchLengths.
+****************************************************************************/
+void PacketKernel_RunBench(uint32_t Iterations, uint32_t Seed, PacketKernelBenchResult_t *pResult) {
+	static uint8_t In[BENCH_MAX_LENGTH + 4];
+	static uint8_t OutKernel[BENCH_MAX_LENGTH + 4];
+	static uint8_t OutByte[BENCH_MAX_LENGTH + 4];
+	uint8_t Key[NUM_ENCRYPTION_BYTES];
+	volatile uint8_t Sink = 0;
+	uint16_t Length;
+	uint8_t Start;
+	uint8_t Align;
+	uint8_t i;
+
+	memset(pResult, 0, sizeof(*pResult));
+	RandomState = (Seed != 0) ? Seed : 1;
+	for (i = 0; i < NUM_ENCRYPTION_BYTES; i++) {
+		Key[i] = Random();
+	}
+
+	for (Length = 0; Length <= BENCH_MAX_LENGTH; Length++) {
+		for (Start = 0; Start < NUM_ENCRYPTION_BYTES; Start++) {
+			for (Align = 0; Align < 4; Align++) {
+				uint8_t KernelIndex = Start;
+				uint8_t ByteIndex = Start;
+				uint8_t KernelSum;
+				uint8_t ByteSumOut;
+				uint16_t n;
+
+				for (n = 0; n < Length; n++) {
+					In[Align + n] = Random();
+				}
+				memset(OutKernel, 0xA5, sizeof(OutKernel));
+				memset(OutByte, 0xA5, sizeof(OutByte));
+				KernelSum = PacketKernel_XorSum(&OutKernel[3 - Align], &In[Align], Length, Key, &KernelIndex);
+				ByteSumOut = ByteXorSum(&OutByte[3 - Align], &In[Align], Length, Key, &ByteIndex);
+				if ((KernelSum != ByteSumOut) || (KernelIndex != ByteIndex) ||
+						(memcmp(OutKernel, OutByte, sizeof(OutKernel)) != 0) ||
+						(PacketKernel_Sum(&In[Align], Length) != ByteSum(&In[Align], Length)) ||
+						(PacketKernel_CopySum(&OutKernel[Align], &In[Align], Length) != ByteSum(&In[Align], Length)) ||
+						(memcmp(&OutKernel[Align], &In[Align], Length) != 0)) {
+					pResult->Mismatches++;
+				}
+				pResult->Cases++;
+			}
+		}
+	}
+
+	for (i = 0; i < KERNEL_BENCH_SIZES; i++) {
+		uint8_t Size = KernelBenchLengths[i];
+		uint8_t KeyIndex = 0;
+		uint32_t n;
+		clock_t Start;
+
+		pResult->Sum[i].Length = Size;
+		pResult->XorSum[i].Length = Size;
+
+		Start = clock();
+		for (n = 0; n < Iterations; n++) {
+			In[n & 3] = n;
+			Sink += ByteSum(In, Size);
+		}
+		pResult->Sum[i].ByteNs = 1e9 * (double)(clock() - Start) / CLOCKS_PER_SEC / Iterations;
+		Start = clock();
+		for (n = 0; n < Iterations; n++) {
+			In[n & 3] = n;
+			Sink += PacketKernel_Sum(In, Size);
+		}
+		pResult->Sum[i].KernelNs = 1e9 * (double)(clock() - Start) / CLOCKS_PER_SEC / Iterations;
+
+		Start = clock();
+		for (n = 0; n < Iterations; n++) {
+			Sink += ByteXorSum(OutByte, In, Size, Key, &KeyIndex);
+		}
+		pResult->XorSum[i].ByteNs = 1e9 * (double)(clock() - Start) / CLOCKS_PER_SEC / Iterations;
+		Start = clock();
+		for (n = 0; n < Iterations; n++) {
+			Sink += PacketKernel_XorSum(OutKernel, In, Size, Key, &KeyIndex);
+		}
+		pResult->XorSum[i].KernelNs = 1e9 * (double)(clock() - Start) / CLOCKS_PER_SEC / Iterations;
+	}
+	(void)Sink;
+}
+#endif
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+static uint32_t LoadWord(const uint8_t *p) {
+	uint32_t Word;
+
+	memcpy(&Word, p, sizeof(Word));
+	return Word;
+}
+
+static void StoreWord(uint8_t *p, uint32_t Word) {
+	memcpy(p, &Word, sizeof(Word));
+}
+
+#ifdef ES_HOST_BUILD
+// The byte at a time loops the kernel replaced, as the reference
+
+static uint8_t ByteSum(const uint8_t *pData, uint8_t Length) {
+	uint8_t Sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < Length; i++) {
+		Sum += pData[i];
+	}
+	return Sum;
+}
+
+static uint8_t ByteXorSum(uint8_t *pOut, const uint8_t *pIn, uint8_t Length,
+	const uint8_t *Key, uint8_t *pKeyIndex) {
+	uint8_t KeyIndex = *pKeyIndex;
+	uint8_t Sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < Length; i++) {
+		*pOut = pIn[i] ^ Key[KeyIndex];
+		Sum += *pOut++;
+		if (++KeyIndex == NUM_ENCRYPTION_BYTES) KeyIndex = 0;
+	}
+	*pKeyIndex = KeyIndex;
+	return Sum;
+}
+
+// xorshift32
+static uint32_t Random(void) {
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return RandomState;
+}
+#endif
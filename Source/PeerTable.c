@@ -0,0 +1,283 @@
+/****************************************************************************
+ Module
+   PeerTable.c
+
+ Description
+   Session state for every DOG the FARMER is paired with (or pairing with),
+   so that one FARMER can drive several of them. Entries live in a fixed
+   array of MAX_PEERS slots; the slot number is what gets passed around in
+   event parameters. Incoming packets are matched to their slot through a
+   small open addressed hash on the 16 bit source address, so the lookup in
+   InterpretPacket costs the same however many DOGs there are.
+
+ Notes
+   Only used from service context.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stddef.h>
+
+#include "PeerTable.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// power of two, at least twice MAX_PEERS so the probe runs stay short
+#define PEER_HASH_SIZE  8
+#define PEER_HASH_MASK  (PEER_HASH_SIZE - 1)
+#define EMPTY           NO_PEER
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint8_t HashOf(uint16_t Address);
+static uint8_t FindBucket(uint16_t Address);
+
+/*---------------------------- Module Variables ---------------------------*/
+static Peer_t Peers[MAX_PEERS];
+
+// slot number for each address, EMPTY where there is none
+static uint8_t Buckets[PEER_HASH_SIZE];
+
+// last slot handed out by PeerTable_NextPaired
+static uint8_t RoundRobin;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     PeerTable_Init
+
+ Description
+     Frees every slot
+****************************************************************************/
+void PeerTable_Init(void) {
+	uint8_t i;
+
+	for (i = 0; i < MAX_PEERS; i++) {
+		Peers[i].State = PeerFree;
+	}
+	for (i = 0; i < PEER_HASH_SIZE; i++) {
+		Buckets[i] = EMPTY;
+	}
+	RoundRobin = MAX_PEERS - 1;
+}
+
+/****************************************************************************
+ Function
+     PeerTable_Find
+
+ Parameters
+     uint16_t : source address of a DOG
+
+ Returns
+     uint8_t : its slot, NO_PEER if we don't know it
+****************************************************************************/
+uint8_t PeerTable_Find(uint16_t Address) {
+	uint8_t Bucket = FindBucket(Address);
+
+	if (Bucket == EMPTY) {
+		return NO_PEER;
+	}
+	return Buckets[Bucket];
+}
+
+/****************************************************************************
+ Function
+     PeerTable_Add
+
+ Parameters
+     uint16_t : source address of a DOG
+
+ Returns
+     uint8_t : slot for the address, NO_PEER if the table is full
+
+ Description
+     Returns the existing slot if the address is already known, otherwise
+     claims a free one and puts it in PeerPairing with its index cleared.
+     With no free slot left, a session waiting to be resumed is given up
+     to make room.
+****************************************************************************/
+uint8_t PeerTable_Add(uint16_t Address) {
+	uint8_t Slot = PeerTable_Find(Address);
+	uint8_t Bucket;
+
+	if (Slot != NO_PEER) {
+		return Slot;
+	}
+	for (Slot = 0; Slot < MAX_PEERS; Slot++) {
+		if (Peers[Slot].State == PeerFree) {
+			break;
+		}
+	}
+	if (Slot == MAX_PEERS) {
+		for (Slot = 0; Slot < MAX_PEERS; Slot++) {
+			if (Peers[Slot].State == PeerResuming) {
+				PeerTable_Remove(Slot);
+				break;
+			}
+		}
+		if (Slot == MAX_PEERS) {
+			return NO_PEER;
+		}
+	}
+
+	// there are always more buckets than slots, so this finds an empty one
+	Bucket = HashOf(Address);
+	while (Buckets[Bucket] != EMPTY) {
+		Bucket = (Bucket + 1) & PEER_HASH_MASK;
+	}
+	Buckets[Bucket] = Slot;
+
+	Peers[Slot].Address = Address;
+	Peers[Slot].State = PeerPairing;
+	Peers[Slot].EncryptionIndex = 0;
+	return Slot;
+}
+
+/****************************************************************************
+ Function
+     PeerTable_Remove
+
+ Parameters
+     uint8_t : slot to free
+
+ Description
+     Frees the slot and takes its address out of the hash. The entries
+     after it in the same probe run are moved back so lookups never need
+     tombstones.
+****************************************************************************/
+void PeerTable_Remove(uint8_t Slot) {
+	uint8_t Hole;
+	uint8_t Next;
+
+	if ((Slot >= MAX_PEERS) || (Peers[Slot].State == PeerFree)) {
+		return;
+	}
+	Hole = FindBucket(Peers[Slot].Address);
+	Peers[Slot].State = PeerFree;
+	if (Hole == EMPTY) {
+		return;
+	}
+	Buckets[Hole] = EMPTY;
+
+	// backward shift: pull later entries of the run into the hole if their
+	// home bucket is not between the hole and where they sit now
+	Next = (Hole + 1) & PEER_HASH_MASK;
+	while (Buckets[Next] != EMPTY) {
+		uint8_t Home = HashOf(Peers[Buckets[Next]].Address);
+		if (((Next - Home) & PEER_HASH_MASK) >= ((Next - Hole) & PEER_HASH_MASK)) {
+			Buckets[Hole] = Buckets[Next];
+			Buckets[Next] = EMPTY;
+			Hole = Next;
+		}
+		Next = (Next + 1) & PEER_HASH_MASK;
+	}
+}
+
+/****************************************************************************
+ Function
+     PeerTable_Get
+
+ Parameters
+     uint8_t : slot
+
+ Returns
+     Peer_t * : the entry, NULL for a slot number out of range
+****************************************************************************/
+Peer_t* PeerTable_Get(uint8_t Slot) {
+	if (Slot >= MAX_PEERS) {
+		return NULL;
+	}
+	return &Peers[Slot];
+}
+
+/****************************************************************************
+ Function
+     PeerTable_NextPaired
+
+ Returns
+     uint8_t : the next paired slot after the one returned last time,
+     wrapping around, NO_PEER if nobody is paired
+
+ Description
+     Used to hand out control packets to the DOGs in turn.
+****************************************************************************/
+uint8_t PeerTable_NextPaired(void) {
+	uint8_t i;
+	uint8_t Slot = RoundRobin;
+
+	for (i = 0; i < MAX_PEERS; i++) {
+		Slot++;
+		if (Slot == MAX_PEERS) {
+			Slot = 0;
+		}
+		if (Peers[Slot].State == PeerPaired) {
+			RoundRobin = Slot;
+			return Slot;
+		}
+	}
+	return NO_PEER;
+}
+
+/****************************************************************************
+ Function
+     PeerTable_NumPaired
+
+ Returns
+     uint8_t : number of slots in PeerPaired
+****************************************************************************/
+uint8_t PeerTable_NumPaired(void) {
+	uint8_t i;
+	uint8_t Count = 0;
+
+	for (i = 0; i < MAX_PEERS; i++) {
+		if (Peers[i].State == PeerPaired) {
+			Count++;
+		}
+	}
+	return Count;
+}
+
+/****************************************************************************
+ Function
+     PeerTable_NumResuming
+
+ Returns
+     uint8_t : number of slots in PeerResuming
+****************************************************************************/
+uint8_t PeerTable_NumResuming(void) {
+	uint8_t i;
+	uint8_t Count = 0;
+
+	for (i = 0; i < MAX_PEERS; i++) {
+		if (Peers[i].State == PeerResuming) {
+			Count++;
+		}
+	}
+	return Count;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+static uint8_t HashOf(uint16_t Address) {
+	// mix both bytes in, addresses tend to differ only in the low one
+	return (uint8_t)((Address ^ (Address >> 5) ^ (Address >> 11)) & PEER_HASH_MASK);
+}
+
+// bucket holding Address, EMPTY if it isn't in the table
+static uint8_t FindBucket(uint16_t Address) {
+	uint8_t Bucket = HashOf(Address);
+	uint8_t i;
+
+	for (i = 0; i < PEER_HASH_SIZE; i++) {
+		if (Buckets[Bucket] == EMPTY) {
+			return EMPTY;
+		}
+		if (Peers[Buckets[Bucket]].Address == Address) {
+			return Bucket;
+		}
+		Bucket = (Bucket + 1) & PEER_HASH_MASK;
+	}
+	return EMPTY;
+}
@@ -3,7 +3,9 @@
    Receive_SM.c
 
  Description
-   Receiving state machine 
+   Receiving service. Bytes are parsed into XBee API frames in the UART
+   interrupt; every good frame goes into the RxQueue and Comm_Service gets
+   one event per frame.
 
  History
  When           Who     What/Why
@@ -14,36 +16,30 @@
 #include "ES_Configure.h"
 #include "ES_Framework.h"
 #include "ES_DeferRecall.h"
+#include "ES_ShortTimer.h"
 
 #include "Constants.h"
-#include "Hardware.h"
+#include "Receive_SM.h"
+#include "Comm_Service.h"
+#include "UART.h"
+#include "RxQueue.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 
-#define RECEIVE_TIMER_LENGTH 10 // based off of 9600 baud rate (each character takes ~1.04ms to send)
-
-#define MAX_FRAME_LENGTH 40 // max number of bytes we expect to receive for any data type 
+// a gap this many character times inside a frame means we lost the rest of
+// it; follows the UART rate, which XBeeLink may change after boot
+#define RECEIVE_GAP_BYTES 10
+#define RECEIVE_GAP_CYCLES (RECEIVE_GAP_BYTES*UART_GetByteTimeUs()*ES_CYCLES_PER_US)
 
 
 /*---------------------------- Module Functions ---------------------------*/
 
 
 /*---------------------------- Module Variables ---------------------------*/
-static ReceiveState_t CurrentState;
-
 static uint8_t MyPriority;
 
-static uint8_t MSBLength = 0;
-static uint8_t LSBLength = 0;
-static uint8_t FrameLength = 0; // num bytes in data frame
-static uint8_t BytesLeft = 0;
-static uint8_t CheckSum = 0;
-
-static uint8_t DataPacket[MAX_FRAME_LENGTH]; // array containing all bytes in data packet
-static uint8_t ArrayIndex = 0;
-
-static uint8_t *outgoingDataPacket; //pointer to data packet
-
+static XBeeParser_t Parser; // only touched from the UART ISR after init
+static uint32_t LastByteTime; // ES_GetCycles() when the last byte came in
 
 
 /*------------------------------ Module Code ------------------------------*/
@@ -58,8 +54,8 @@ static uint8_t *outgoingDataPacket; //pointer to data packet
      bool, false if error in initialization, true otherwise
 
  Description
-     Saves away the priority, sets up the initial transition and does any
-     other required initialization for this state machine
+     Saves away the priority, sets up the frame parser, the receive queue
+     and the UART
  Notes
 
  Author
@@ -70,12 +66,12 @@ bool InitReceive_SM ( uint8_t Priority )
 
   MyPriority = Priority;
   
-	// initialize UART
-	InitUART();
-
-	outgoingDataPacket = &DataPacket[0]; // address of first entry in data packet array
+	RxQueue_Init();
+	XBee_ParserInit(&Parser);
+	LastByteTime = ES_GetCycles();
 	
-	CurrentState = Wait4Start;
+	// initialize UART last, bytes can start arriving as soon as it is up
+	InitUART();
 	
   return true;
 }
@@ -113,9 +109,9 @@ bool PostReceive_SM( ES_Event ThisEvent )
    ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
 
  Description
-   add your description here
- Notes
-   uses nested switch/case to implement the machine.
+   Frames are now assembled in the UART ISR (ProcessReceivedByte), so there
+   is nothing left for the service itself to do. Kept so that the service
+   numbering in ES_Configure.h stays put.
  Author
    Sarah Cabreros
 ****************************************************************************/
@@ -124,145 +120,56 @@ ES_Event RunReceive_SM( ES_Event ThisEvent )
   ES_Event ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
 
-  switch ( CurrentState )
-  {
-
-    case Wait4Start:      
-			// waiting to receive 0x7E 
-			if ( ThisEvent.EventType == ES_BYTE_RECEIVED ) {
-				//printf("wait4start : %i\r\n", ThisEvent.EventParam);
-				// check if byte received is 0x7E 
-				if ( ThisEvent.EventParam == START_DELIMITER ) {
-					//printf("------------RECEIVING-------------------\n\r");
-					//printf("Start: %i\n\r", ThisEvent.EventParam);
-					// start timer 
-					ES_Timer_InitTimer(RECEIVE_TIMER, RECEIVE_TIMER_LENGTH);
-					
-					// set current state to Wait4MSB
-					CurrentState = Wait4MSBLength;
-				}
-			}
-      
-    break;
-
-		case Wait4MSBLength:      
-			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == RECEIVE_TIMER ) {
-				// go back to Wait4Start
-				CurrentState = Wait4Start;
-			}
-			
-			if ( ThisEvent.EventType == ES_BYTE_RECEIVED ) {
-				//printf("wait4msb : %i\r\n", ThisEvent.EventParam);
-				// store MSB in data packet 
-				MSBLength = ThisEvent.EventParam; 
-				// start receive timer
-				ES_Timer_InitTimer(RECEIVE_TIMER, RECEIVE_TIMER_LENGTH);
-				// set current state to Wait4LSB
-				CurrentState = Wait4LSBLength;
-			}
-		
-    break;
-		
-		case Wait4LSBLength: 
-			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == RECEIVE_TIMER ) {
-				// go back to Wait4Start
-				CurrentState = Wait4Start;
-			}		
-
-			if ( ThisEvent.EventType == ES_BYTE_RECEIVED ) {
-				//printf("wait4lsb : %i\r\n", ThisEvent.EventParam);
-				// store LSB in data packet 
-				LSBLength = ThisEvent.EventParam; 
-				
-				// update FrameLength and BytesLeft
-				FrameLength = MSBLength + LSBLength;
-				BytesLeft = FrameLength;
-				
-				// start receive timer
-				ES_Timer_InitTimer(RECEIVE_TIMER, RECEIVE_TIMER_LENGTH);
-				
-				// set ArrayIndex to 0 
-				ArrayIndex = 0;
-				
-				// initialize CheckSum to 0
-				CheckSum = 0;
-				
-				// set current state to ReceivingData
-				CurrentState = ReceivingData;
-			}			
-      
-    break;
-		
-		case ReceivingData: 
-			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == RECEIVE_TIMER ) {
-				// go back to Wait4Start
-				CurrentState = Wait4Start;
-			}		
-			
-			if ( ThisEvent.EventType == ES_BYTE_RECEIVED ) {
-				//printf("receivingdata : %i\r\n", ThisEvent.EventParam);
-				// if BytesLeft = 0, then we just received the checksum 
-				if (BytesLeft == 0) {
-					//printf("CheckSum: %i\n\r", ThisEvent.EventParam);
-					if (ThisEvent.EventParam == (0xFF - CheckSum)) {
-						// if good checksum, post PacketReceived event to Comm_Service
-						ES_Event ThisEvent;         
-						ThisEvent.EventType = ES_DATAPACKET_RECEIVED;
-						ThisEvent.EventParam = FrameLength; 
-						PostComm_Service(ThisEvent);
-						//printf("data packet received (good checksum)\r\n");
-					} else {
-						// if bad checksum, don't do anything? 
-					}
-					
-					// go back to Wait4Start
-					CurrentState = Wait4Start;
-				}
-
-				// else if BytesLeft > 0, then we're still receiving data bytes
-				// store current data byte 
-				uint8_t CurrentByte = ThisEvent.EventParam;
-				
-				// add byte to DataPacket
-				DataPacket[ArrayIndex] = CurrentByte;
-				
-				// increment ArrayIndex
-				ArrayIndex++;
-				
-				// update check sum
-				CheckSum += CurrentByte;
-				
-				// decrement Bytes left 
-				BytesLeft--;
-				
-				// start receive timer 
-				ES_Timer_InitTimer(RECEIVE_TIMER, RECEIVE_TIMER_LENGTH);
-				
-			}
-      
-    break;
-		
-    default :
-      ;
-  }                                   // end switch on Current State
   return ReturnEvent;
 }
 
 /****************************************************************************
  Function
-    GetMessage
+    ProcessReceivedByte
 
  Parameters
-   none
+   uint8_t : byte just read out of the UART data register
 
  Returns
-   pointer to array that has data packet received from Xbee
+   nothing
 
- Author
-   Sarah Cabreros
+ Description
+   Called from UART_ISR for every received byte. Runs the byte through the
+   frame parser. Each frame with a good checksum is copied into the RxQueue
+   and an ES_DATAPACKET_RECEIVED (param is its sequence number) posted to
+   Comm_Service. Bad frames are rescanned by the parser for a frame starting
+   inside them, which can turn up several frames at once; all of them are
+   queued. A full queue drops the frame and counts an overrun there, unless
+   UART_RX_FLOW has held the XBee off in time.
+   A frame that stalls for more than RECEIVE_GAP_BYTES character times is
+   dropped as bad and rescanned like any other.
+ Notes
+   Runs at interrupt level
 ****************************************************************************/
-uint8_t* GetDataPacket(void) {
-	return outgoingDataPacket;
+void ProcessReceivedByte( uint8_t DataByte )
+{
+	uint32_t Now = ES_GetCycles();
+	
+	// if the line went quiet partway through a frame, that frame is bad,
+	// but a real one may have started inside it
+	if ((Parser.State != Wait4Start) && ((Now - LastByteTime) > RECEIVE_GAP_CYCLES)) {
+		XBee_ParserGap(&Parser);
+	}
+	LastByteTime = Now;
+	
+	if (XBee_ParseByte(&Parser, DataByte) == XBEE_FRAME_GOOD) {
+		// the parser buffer gets reused as soon as the next frame starts, so
+		// each frame is copied out to a queue slot Comm_Service owns
+		do {
+			uint16_t Seq;
+			if (RxQueue_Put(Parser.Frame, Parser.FrameLength, &Seq)) {
+				ES_Event ThisEvent;
+				ThisEvent.EventType = ES_DATAPACKET_RECEIVED;
+				ThisEvent.EventParam = Seq;
+				PostComm_Service(ThisEvent);
+			}
+			UART_UpdateRxFlow();
+		} while (XBee_ParseMore(&Parser) == XBEE_FRAME_GOOD);
+	}
 }
 
-
@@ -0,0 +1,189 @@
+/****************************************************************************
+ Module
+   RxQueue.c
+
+ Description
+   Ring of completed receive frames, between the frame parser in the UART
+   interrupt and Comm_Service. The parser copies every good frame into a
+   slot of its own here, so a frame that arrives right behind another (a
+   DOG report straight after a transmit status, or several frames turned up
+   by one rescan) cannot overwrite one Comm_Service has not read yet.
+
+   Every frame gets a sequence number as it is put, including frames lost
+   to a full ring, so a gap in the numbers Comm_Service sees is an overrun.
+
+ Notes
+   One producer (the UART interrupt) and one consumer (Comm_Service), so no
+   critical sections are needed. Written is only changed by the producer and
+   Read only by the consumer, both free running and compared modulo 256. The
+   producer fills a slot before moving Written past it, and never touches
+   the slot at Read, which Comm_Service owns from RxQueue_Take until
+   RxQueue_Release.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <string.h>
+
+#include "RxQueue.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+typedef struct {
+	uint8_t Frame[MAX_FRAME_LENGTH];
+	uint8_t FrameLength; // frame data length, API ID -> RF data
+	uint16_t Seq;
+} RxSlot_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+
+/*---------------------------- Module Variables ---------------------------*/
+static RxSlot_t Slots[RX_QUEUE_FRAMES];
+
+static volatile uint8_t Written; // frames put, producer only
+static volatile uint8_t Read;    // frames released, consumer only
+
+static volatile uint16_t NextSeq;
+static volatile uint8_t MaxDepth;
+static volatile uint16_t Overruns;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     RxQueue_Init
+
+ Description
+     Empties the ring and clears the statistics, call before the UART is up
+****************************************************************************/
+void RxQueue_Init(void) {
+	Written = 0;
+	Read = 0;
+	NextSeq = 0;
+	MaxDepth = 0;
+	Overruns = 0;
+}
+
+/****************************************************************************
+ Function
+     RxQueue_Put
+
+ Parameters
+     const uint8_t * : frame data (API ID -> RF data)
+     uint8_t : its length, at most MAX_FRAME_LENGTH
+     uint16_t * : set to the sequence number the frame was given
+
+ Returns
+     bool : false if the ring was full and the frame was dropped
+
+ Description
+     Producer side, called from the UART interrupt
+****************************************************************************/
+bool RxQueue_Put(const uint8_t *pFrame, uint8_t FrameLength, uint16_t *pSeq) {
+	uint8_t Depth = (uint8_t)(Written - Read);
+	RxSlot_t *pSlot;
+
+	*pSeq = NextSeq++;
+	if (Depth >= RX_QUEUE_FRAMES) {
+		Overruns++;
+		return false;
+	}
+
+	pSlot = &Slots[Written & RX_QUEUE_MASK];
+	memcpy(pSlot->Frame, pFrame, FrameLength);
+	pSlot->FrameLength = FrameLength;
+	pSlot->Seq = *pSeq;
+
+	// publish only once the slot is filled in
+	Written++;
+	if (Depth + 1 > MaxDepth) {
+		MaxDepth = Depth + 1;
+	}
+	return true;
+}
+
+/****************************************************************************
+ Function
+     RxQueue_Take
+
+ Parameters
+     const uint8_t ** : set to the oldest frame's data
+     uint8_t * : set to its length
+     uint16_t * : set to its sequence number
+
+ Returns
+     bool : false if there is no frame waiting
+
+ Description
+     Consumer side. The frame stays put until RxQueue_Release, which must
+     come before the next call.
+****************************************************************************/
+bool RxQueue_Take(const uint8_t **ppFrame, uint8_t *pFrameLength, uint16_t *pSeq) {
+	RxSlot_t *pSlot;
+
+	if (Written == Read) {
+		return false;
+	}
+	pSlot = &Slots[Read & RX_QUEUE_MASK];
+	*ppFrame = pSlot->Frame;
+	*pFrameLength = pSlot->FrameLength;
+	*pSeq = pSlot->Seq;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     RxQueue_Release
+
+ Description
+     Hands the frame from RxQueue_Take back to the producer
+****************************************************************************/
+void RxQueue_Release(void) {
+	if (Written != Read) {
+		Read++;
+	}
+}
+
+/****************************************************************************
+ Function
+     RxQueue_GetDepth
+
+ Returns
+     uint8_t : frames waiting now
+****************************************************************************/
+uint8_t RxQueue_GetDepth(void) {
+	return (uint8_t)(Written - Read);
+}
+
+/****************************************************************************
+ Function
+     RxQueue_GetMaxDepth
+
+ Returns
+     uint8_t : most frames that have been waiting at once
+****************************************************************************/
+uint8_t RxQueue_GetMaxDepth(void) {
+	return MaxDepth;
+}
+
+/****************************************************************************
+ Function
+     RxQueue_GetOverruns
+
+ Returns
+     uint16_t : good frames dropped because the ring was full
+****************************************************************************/
+uint16_t RxQueue_GetOverruns(void) {
+	return Overruns;
+}
+
+/****************************************************************************
+ Function
+     RxQueue_GetFrames
+
+ Returns
+     uint16_t : good frames handed to the ring, dropped ones included
+****************************************************************************/
+uint16_t RxQueue_GetFrames(void) {
+	return NextSeq;
+}
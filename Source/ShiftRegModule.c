@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifndef ES_HOST_BUILD
 // the headers to access the GPIO subsystem
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
@@ -34,6 +35,9 @@
 #include "driverlib/gpio.h"
 #include "driverlib/timer.h"
 #include "driverlib/interrupt.h"
+#else
+#include "HostHardware.h"
+#endif
 
 #include "BITDEFS.H"
 #include "termio.h"
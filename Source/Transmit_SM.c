@@ -3,7 +3,10 @@
    Transmit_SM.c
 
  Description
-   Transmit state machine 
+   Transmit state machine. Takes frames off the TxQueue one at a time and
+   sends each one either through the uDMA (UART_TX_DMA
+   in Constants.h) or one byte per ES_BYTE_SENT, and keeps track of the CPU
+   cycles each frame cost.
 
  History
  When           Who     What/Why
@@ -15,24 +18,21 @@
 #include "ES_Framework.h"
 #include "ES_DeferRecall.h"
 
-#include "inc/hw_memmap.h"
-#include "inc/hw_types.h"
-#include "inc/hw_gpio.h"
-#include "inc/hw_sysctl.h"
-#include "inc/hw_nvic.h"
-#include "inc/hw_uart.h"
-#include "driverlib/sysctl.h"
-#include "driverlib/pin_map.h"	// Define PART_TM4C123GH6PM in project
-#include "driverlib/gpio.h"
-
 #include "Comm_Service.h"
 #include "Transmit_SM.h"
 #include "Receive_SM.h"
 #include "UART.h"
+#include "TxQueue.h"
+#include "ES_ShortTimer.h"
 #include "Constants.h"
 
 /*----------------------------- Module Defines ----------------------------*/
-#define TRANSMIT_TIMER_LENGTH 10 // based off of 9600 baud rate (each character takes ~1.04ms to send)
+// timeouts follow the UART rate, which XBeeLink may change after boot
+// one character, with plenty of room (10ms at 9600 baud)
+#define TRANSMIT_TIMER_LENGTH ((10*UART_GetByteTimeUs())/1000 + 1)
+// a whole frame of DataPacketLength bytes plus half again (~70ms for a
+// 44 byte frame at 9600 baud)
+#define TRANSMIT_FRAME_TIMER_LENGTH ((DataPacketLength*UART_GetByteTimeUs()*3)/2000 + 2)
 
 #define MAX_FRAME_LENGTH 40 // max number of bytes we expect to receive for any data type (including frame overhead)
 
@@ -40,6 +40,7 @@
 /*---------------------------- Module Functions ---------------------------*/
 bool IsLastByte(void);
 static void SendByte(uint8_t DataByte);
+static bool StartNextFrame(void);
 
 /*---------------------------- Module Variables ---------------------------*/
 static TransmitState_t CurrentState;
@@ -47,11 +48,16 @@ static TransmitState_t CurrentState;
 static uint8_t MyPriority;
 
 
-static uint8_t* DataToSend; // pointer to array containing all bytes in data packet
+static uint8_t* DataToSend; // pointer to the TxQueue buffer being sent
 static uint8_t DataPacketLength = 0;
 static uint8_t index = 0;
 static bool LastByteFlag = 0;
 
+static uint32_t FrameCycles = 0;      // cycles spent on the frame in progress
+static uint32_t LastFrameCycles = 0;  // cycles the last completed frame took
+static uint32_t TotalFrameCycles = 0; // running totals for the average
+static uint32_t FramesSent = 0;
+
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -78,9 +84,6 @@ bool InitTransmit_SM ( uint8_t Priority )
 	
   // set index to zero
   index = 0; 
-
-  // get pointer to array of message
-  DataToSend = GetDataPacket_Tx(); // function from Comm_Service
 	
 	CurrentState = Idle;
 	
@@ -130,43 +133,39 @@ ES_Event RunTransmit_SM( ES_Event ThisEvent )
 {
   ES_Event ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
+  uint32_t EntryCycles = ES_GetCycles();
+  bool FrameDone = false;
 
   switch ( CurrentState )
   {
 
     case Idle:      
-			// waiting to receive Start_Xmit event from Comm_Service
+			// waiting to receive Start_Xmit event from Comm_Service, or from
+			// ourselves when more frames were queued behind the last one
 			if ( ThisEvent.EventType == ES_START_XMIT ) {
-				
-				// clear LastByteFlag
-        LastByteFlag = 0;
-				
-				// get length of array 
-				DataPacketLength = ThisEvent.EventParam /*framelength*/ + HEADER_LENGTH + 1 /*checksum bit*/; 
-				
-				// send first byte of array 
-				uint8_t CurrentByte = *(DataToSend+index);
-				SendByte(CurrentByte);
-				//printf("start xmit: %i\n\r ", CurrentByte);
-
-				// increment index 
-				index++;
-
-				// enable TXIM interrupts
-				HWREG(UART5_BASE + UART_O_IM) |= UART_IM_TXIM; 
-
-				// start timer 
-				ES_Timer_InitTimer(TRANSMIT_TIMER, TRANSMIT_TIMER_LENGTH);
-					
-				// set current state to SendingData
-				CurrentState = SendingData;
+				if (StartNextFrame()) {
+					// set current state to SendingData
+					CurrentState = SendingData;
+				}
 			}
 			
     break;
 
 		case SendingData:      
 			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == TRANSMIT_TIMER ) {
-				// go back to Idle
+				// go back to Idle, the frame never made it out so don't count it.
+				// Stop the UART reading from it first, the slot is about to be
+				// reused. No transmit status will come for it, so it is retried
+				// (or dropped) now rather than waiting in the outstanding window
+				UART_AbortTx();
+				CurrentState = Idle;
+				FrameCycles = 0;
+				UART_TakeTxISRCycles();
+				TxQueue_SendFailed();
+			}
+			
+			if ( ThisEvent.EventType == ES_TX_COMPLETE ) { // from UART ISR, DMA mode
+				FrameDone = true;
 				CurrentState = Idle;
 			}
 			
@@ -181,6 +180,7 @@ ES_Event RunTransmit_SM( ES_Event ThisEvent )
 
 					// set index back to 0
 					index = 0;
+					FrameDone = true;
 					
 					// go back to Idle 
 					CurrentState = Idle;
@@ -204,16 +204,105 @@ ES_Event RunTransmit_SM( ES_Event ThisEvent )
     default :
       ;
   }                                   // end switch on Current State
+
+  // charge this event to the frame it belonged to
+  if ((CurrentState == SendingData) || FrameDone) {
+    FrameCycles += ES_GetCycles() - EntryCycles;
+  }
+  if (FrameDone) {
+    LastFrameCycles = FrameCycles + UART_TakeTxISRCycles();
+    TotalFrameCycles += LastFrameCycles;
+    FramesSent++;
+    FrameCycles = 0;
+    TxQueue_Release();
+  }
+
+  // back in Idle with frames waiting, go get the next one
+  if ((CurrentState == Idle) && (TxQueue_GetDepth() > 0) &&
+      (ThisEvent.EventType != ES_START_XMIT)) {
+    ES_Event NewEvent;
+    NewEvent.EventType = ES_START_XMIT;
+    PostTransmit_SM(NewEvent);
+  }
   return ReturnEvent;
 }
 
+/****************************************************************************
+ Function
+    GetTxFrameCycles
+
+ Returns
+   CPU cycles (service plus ISR) the last transmitted frame took
+
+ Author
+   Sarah Cabreros
+****************************************************************************/
+uint32_t GetTxFrameCycles(void) {
+	return LastFrameCycles;
+}
+
+/****************************************************************************
+ Function
+    GetTxAvgFrameCycles
+
+ Returns
+   average CPU cycles per transmitted frame since startup, 0 if none sent
+
+ Author
+   Sarah Cabreros
+****************************************************************************/
+uint32_t GetTxAvgFrameCycles(void) {
+	if (FramesSent == 0) {
+		return 0;
+	}
+	return TotalFrameCycles / FramesSent;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Pulls the next frame off the TxQueue and gets it going. Returns false if
+// there was nothing to send.
+static bool StartNextFrame(void) {
+	uint8_t FrameLength;
+
+	if (!TxQueue_StartNext(&DataToSend, &FrameLength)) {
+		return false;
+	}
+	
+	// clear LastByteFlag
+	LastByteFlag = 0;
+	
+	// get length of array 
+	DataPacketLength = FrameLength + HEADER_LENGTH + 1 /*checksum bit*/; 
+	
+#ifdef UART_TX_DMA
+	// the uDMA sends the whole frame, UART_ISR posts ES_TX_COMPLETE
+	UART_StartTxDMA(DataToSend, DataPacketLength);
+	
+	// start timer 
+	ES_Timer_InitTimer(TRANSMIT_TIMER, TRANSMIT_FRAME_TIMER_LENGTH);
+#else
+	// send first byte of array 
+	index = 0;
+	SendByte(*(DataToSend+index));
+
+	// increment index 
+	index++;
+
+	// enable TXIM interrupts
+	UART_EnableTxInt();
+
+	// start timer 
+	ES_Timer_InitTimer(TRANSMIT_TIMER, TRANSMIT_TIMER_LENGTH);
+#endif
+	return true;
+}
+
 static void SendByte(uint8_t DataByte) {
-	// Check if room in FIFO
-	if((HWREG(UART5_BASE + UART_O_FR)&UART_FR_TXFE) != 0){
-		// write data to DR 
-		HWREG(UART5_BASE + UART_O_DR) = DataByte; 
-		//printf("Sending byte: %i\r\n", DataByte);
-	}else{
+	// only goes in if there is room in the FIFO
+	if (!UART_SendByte(DataByte)) {
 		printf("Fifo not empty\r\n");
 	}	
 }
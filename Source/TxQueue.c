@@ -0,0 +1,527 @@
+/****************************************************************************
+ Module
+   TxQueue.c
+
+ Description
+   Pool of outgoing frame buffers with one FIFO per priority lane. Comm_Service
+   builds each frame directly in a buffer it acquires from here and commits
+   it to a lane; Transmit_SM takes frames off the front of the highest
+   priority lane that has one. Because the frame on the wire has a buffer of
+   its own, the next frame can be built while the last one is still being
+   sent.
+
+ Notes
+   Only called from service context (Comm_Service and Transmit_SM), never
+   from an interrupt, so no critical sections are needed. The uDMA reads the
+   in-flight buffer, which nobody else touches until TxQueue_Release.
+
+   Every frame gets its own frame ID (1-255, rotating) so the XBee's transmit
+   status (0x89) can be matched to it. A sent frame is held in the
+   outstanding window until its status comes back. On a failure it goes
+   back to the front of its lane, unchanged, up to TX_RETRY_BUDGET times.
+   A frame that never left the UART is treated the same way at once.
+   A CTRL frame is never retried once a newer CTRL frame has been built
+   for the same DOG (PeerTable slot); it is dropped as superseded, since
+   resending stale control data is worse than losing it (the dog asks for
+   an encryption reset if it has fallen out of step). A CTRL frame for one
+   DOG says nothing about another's, so those are retried as usual.
+   Outstanding frames whose status has not arrived within TX_STATUS_TIMEOUT
+   are expired lazily, whenever the window is looked at. While TX_WINDOW
+   frames are outstanding nothing new is started. If the pool runs dry the
+   oldest outstanding frame is the first buffer given up.
+
+   When the pool is empty, a frame for a higher priority lane pushes out the
+   oldest waiting frame of the lowest priority lane that has one; otherwise
+   the new frame is dropped. Both count as a drop against the lane that lost
+   the frame.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stddef.h>
+
+#include "ES_Configure.h"
+#include "ES_Timers.h"
+
+#include "TxQueue.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define NO_BUFFER 0xFF
+
+typedef struct {
+	uint8_t Frame[TX_FRAME_SIZE];
+	uint8_t FrameLength; // frame data length, as carried in the length field
+	uint8_t Lane;
+	uint8_t Slot;        // PeerTable slot it is for, NO_PEER if none
+	uint8_t FrameID;
+	uint8_t Retries;     // times this frame has been resent
+	uint16_t SentTime;   // ES_Timer_GetTime() when it was sent
+	uint8_t Next;        // next buffer in the same list (lane, window or free)
+} TxBuffer_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void FreeBuffer(uint8_t Which);
+static uint8_t TakeFreeBuffer(void);
+static void PushFront(uint8_t Which);
+static void ExpireOutstanding(void);
+static uint8_t UnlinkOutstanding(uint8_t FrameID);
+static bool RetryOrDrop(uint8_t Which);
+
+/*---------------------------- Module Variables ---------------------------*/
+static TxBuffer_t Buffers[TX_QUEUE_BUFFERS];
+
+static uint8_t FreeHead;
+static uint8_t LaneHead[NUM_TX_LANES];
+static uint8_t LaneTail[NUM_TX_LANES];
+
+static uint8_t Building; // acquired by the producer, not yet committed
+static uint8_t InFlight; // on the wire
+
+static uint8_t OutHead;  // sent, waiting for a transmit status, oldest first
+static uint8_t OutTail;
+static uint8_t NumOutstanding;
+
+static uint8_t NextFrameID = 1;
+static uint8_t LatestCtrlID[MAX_PEERS]; // frame ID of the newest CTRL frame built for each slot
+
+static uint8_t Depth;    // frames waiting in all lanes
+static uint8_t MaxDepth;
+static uint16_t Drops[NUM_TX_LANES];
+static uint16_t Retransmits;
+static uint16_t Expired;
+static uint16_t Superseded;
+static uint16_t GaveUp;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     TxQueue_Init
+
+ Description
+     Puts every buffer on the free list and clears the statistics
+****************************************************************************/
+void TxQueue_Init(void) {
+	uint8_t i;
+
+	FreeHead = NO_BUFFER;
+	for (i = 0; i < TX_QUEUE_BUFFERS; i++) {
+		FreeBuffer(i);
+	}
+	for (i = 0; i < NUM_TX_LANES; i++) {
+		LaneHead[i] = NO_BUFFER;
+		LaneTail[i] = NO_BUFFER;
+		Drops[i] = 0;
+	}
+	for (i = 0; i < MAX_PEERS; i++) {
+		LatestCtrlID[i] = 0;
+	}
+	Building = NO_BUFFER;
+	InFlight = NO_BUFFER;
+	OutHead = NO_BUFFER;
+	OutTail = NO_BUFFER;
+	NumOutstanding = 0;
+	Depth = 0;
+	MaxDepth = 0;
+	Retransmits = 0;
+	Expired = 0;
+	Superseded = 0;
+	GaveUp = 0;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_Acquire
+
+ Parameters
+     TxLane_t : lane the frame will be committed to
+     uint8_t : PeerTable slot of the DOG it is for, NO_PEER if none
+     uint8_t * : set to the frame ID to put in the frame
+
+ Returns
+     uint8_t * : buffer of TX_FRAME_SIZE bytes to build the frame in, NULL if
+     the frame has to be dropped
+
+ Description
+     Must be followed by TxQueue_Commit or TxQueue_Abandon before the next
+     call.
+****************************************************************************/
+uint8_t* TxQueue_Acquire(TxLane_t Lane, uint8_t Slot, uint8_t *pFrameID) {
+	uint8_t Which;
+
+	ExpireOutstanding();
+	Which = TakeFreeBuffer();
+
+	// out of buffers, bump the oldest frame of a lower priority lane
+	if (Which == NO_BUFFER) {
+		int8_t Victim;
+		for (Victim = NUM_TX_LANES - 1; Victim > (int8_t)Lane; Victim--) {
+			if (LaneHead[Victim] != NO_BUFFER) {
+				Which = LaneHead[Victim];
+				LaneHead[Victim] = Buffers[Which].Next;
+				if (LaneHead[Victim] == NO_BUFFER) {
+					LaneTail[Victim] = NO_BUFFER;
+				}
+				Depth--;
+				Drops[Victim]++;
+				break;
+			}
+		}
+	}
+
+	if (Which == NO_BUFFER) {
+		Drops[Lane]++;
+		return NULL;
+	}
+
+	Buffers[Which].Lane = Lane;
+	Buffers[Which].Slot = Slot;
+	Buffers[Which].FrameID = NextFrameID;
+	Buffers[Which].Retries = 0;
+	Building = Which;
+
+	// 0 would tell the XBee not to send a status, so skip it
+	*pFrameID = NextFrameID;
+	NextFrameID++;
+	if (NextFrameID == 0) {
+		NextFrameID = 1;
+	}
+	return Buffers[Which].Frame;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_Commit
+
+ Parameters
+     uint8_t : frame data length of the frame just built
+
+ Description
+     Puts the acquired buffer on the back of its lane
+****************************************************************************/
+void TxQueue_Commit(uint8_t FrameLength) {
+	uint8_t Lane;
+
+	if (Building == NO_BUFFER) {
+		return;
+	}
+	Lane = Buffers[Building].Lane;
+	Buffers[Building].FrameLength = FrameLength;
+	Buffers[Building].Next = NO_BUFFER;
+	if (LaneTail[Lane] == NO_BUFFER) {
+		LaneHead[Lane] = Building;
+	} else {
+		Buffers[LaneTail[Lane]].Next = Building;
+	}
+	LaneTail[Lane] = Building;
+	if ((Lane == TX_LANE_CTRL) && (Buffers[Building].Slot < MAX_PEERS)) {
+		LatestCtrlID[Buffers[Building].Slot] = Buffers[Building].FrameID;
+	}
+	Building = NO_BUFFER;
+
+	Depth++;
+	if (Depth > MaxDepth) {
+		MaxDepth = Depth;
+	}
+}
+
+/****************************************************************************
+ Function
+     TxQueue_Abandon
+
+ Description
+     Gives back an acquired buffer without sending anything
+****************************************************************************/
+void TxQueue_Abandon(void) {
+	if (Building != NO_BUFFER) {
+		FreeBuffer(Building);
+		Building = NO_BUFFER;
+	}
+}
+
+/****************************************************************************
+ Function
+     TxQueue_TxStatus
+
+ Parameters
+     uint8_t : frame ID from the transmit status frame
+     bool : true if the XBee reported success
+
+ Returns
+     bool, true if the frame was put back in its lane to be sent again
+
+ Description
+     Settles an outstanding frame. Statuses for frames that have already
+     been expired or given up on are ignored.
+****************************************************************************/
+bool TxQueue_TxStatus(uint8_t FrameID, bool Success) {
+	uint8_t Which = UnlinkOutstanding(FrameID);
+
+	if (Which == NO_BUFFER) {
+		return false;
+	}
+	if (Success) {
+		FreeBuffer(Which);
+		return false;
+	}
+	return RetryOrDrop(Which);
+}
+
+/****************************************************************************
+ Function
+     TxQueue_StartNext
+
+ Parameters
+     uint8_t ** : set to the first byte (start delimiter) of the frame
+     uint8_t * : set to the frame data length
+
+ Returns
+     bool, false if nothing is waiting, a frame is already in flight or the
+     outstanding window is full
+
+ Description
+     Takes the front frame of the highest priority lane that has one. The
+     buffer stays valid until TxQueue_Release.
+****************************************************************************/
+bool TxQueue_StartNext(uint8_t **ppFrame, uint8_t *pFrameLength) {
+	uint8_t Lane;
+
+	if (InFlight != NO_BUFFER) {
+		return false;
+	}
+	ExpireOutstanding();
+	if (NumOutstanding >= TX_WINDOW) {
+		return false;
+	}
+	for (Lane = 0; Lane < NUM_TX_LANES; Lane++) {
+		if (LaneHead[Lane] != NO_BUFFER) {
+			InFlight = LaneHead[Lane];
+			LaneHead[Lane] = Buffers[InFlight].Next;
+			if (LaneHead[Lane] == NO_BUFFER) {
+				LaneTail[Lane] = NO_BUFFER;
+			}
+			Depth--;
+			*ppFrame = Buffers[InFlight].Frame;
+			*pFrameLength = Buffers[InFlight].FrameLength;
+			return true;
+		}
+	}
+	return false;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_Release
+
+ Description
+     The in-flight frame is off the wire. It joins the outstanding window
+     to wait for its transmit status.
+****************************************************************************/
+void TxQueue_Release(void) {
+	if (InFlight == NO_BUFFER) {
+		return;
+	}
+	Buffers[InFlight].SentTime = ES_Timer_GetTime();
+	Buffers[InFlight].Next = NO_BUFFER;
+	if (OutTail == NO_BUFFER) {
+		OutHead = InFlight;
+	} else {
+		Buffers[OutTail].Next = InFlight;
+	}
+	OutTail = InFlight;
+	NumOutstanding++;
+	InFlight = NO_BUFFER;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_SendFailed
+
+ Returns
+     bool, true if the frame was put back in its lane to be sent again
+
+ Description
+     The in-flight frame never made it out of the UART (Transmit_SM gave up
+     on it). No transmit status will come for it, so instead of joining the
+     outstanding window it is settled straight away, as a failed status
+     would settle it.
+****************************************************************************/
+bool TxQueue_SendFailed(void) {
+	uint8_t Which = InFlight;
+
+	if (Which == NO_BUFFER) {
+		return false;
+	}
+	InFlight = NO_BUFFER;
+	return RetryOrDrop(Which);
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetDepth
+
+ Returns
+     uint8_t : frames waiting to go out, not counting the one on the wire
+****************************************************************************/
+uint8_t TxQueue_GetDepth(void) {
+	return Depth;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetMaxDepth
+
+ Returns
+     uint8_t : most frames that have been waiting at once
+****************************************************************************/
+uint8_t TxQueue_GetMaxDepth(void) {
+	return MaxDepth;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetDrops
+
+ Parameters
+     TxLane_t : the lane
+
+ Returns
+     uint16_t : frames from this lane that were never sent for lack of room
+****************************************************************************/
+uint16_t TxQueue_GetDrops(TxLane_t Lane) {
+	return Drops[Lane];
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetRetransmits
+
+ Returns
+     uint16_t : frames resent after a failed transmit status
+****************************************************************************/
+uint16_t TxQueue_GetRetransmits(void) {
+	return Retransmits;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetExpired
+
+ Returns
+     uint16_t : outstanding frames given up on without ever hearing a status
+****************************************************************************/
+uint16_t TxQueue_GetExpired(void) {
+	return Expired;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetSuperseded
+
+ Returns
+     uint16_t : failed CTRL frames dropped because newer control data existed
+****************************************************************************/
+uint16_t TxQueue_GetSuperseded(void) {
+	return Superseded;
+}
+
+/****************************************************************************
+ Function
+     TxQueue_GetGaveUp
+
+ Returns
+     uint16_t : failed frames dropped after using up their retry budget
+****************************************************************************/
+uint16_t TxQueue_GetGaveUp(void) {
+	return GaveUp;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+static void FreeBuffer(uint8_t Which) {
+	Buffers[Which].Next = FreeHead;
+	FreeHead = Which;
+}
+
+static uint8_t TakeFreeBuffer(void) {
+	uint8_t Which = FreeHead;
+
+	if (Which != NO_BUFFER) {
+		FreeHead = Buffers[Which].Next;
+	} else if (OutHead != NO_BUFFER) {
+		// the oldest frame still waiting on a status loses its chance at a resend
+		Which = UnlinkOutstanding(Buffers[OutHead].FrameID);
+		Expired++;
+	}
+	return Which;
+}
+
+static void PushFront(uint8_t Which) {
+	uint8_t Lane = Buffers[Which].Lane;
+
+	Buffers[Which].Next = LaneHead[Lane];
+	LaneHead[Lane] = Which;
+	if (LaneTail[Lane] == NO_BUFFER) {
+		LaneTail[Lane] = Which;
+	}
+	Depth++;
+	if (Depth > MaxDepth) {
+		MaxDepth = Depth;
+	}
+}
+
+static void ExpireOutstanding(void) {
+	uint16_t Now = ES_Timer_GetTime();
+
+	// the window is in send order, so stop at the first one still in time
+	while ((OutHead != NO_BUFFER) &&
+			((uint16_t)(Now - Buffers[OutHead].SentTime) > TX_STATUS_TIMEOUT)) {
+		FreeBuffer(UnlinkOutstanding(Buffers[OutHead].FrameID));
+		Expired++;
+	}
+}
+
+static uint8_t UnlinkOutstanding(uint8_t FrameID) {
+	uint8_t Prev = NO_BUFFER;
+	uint8_t Which = OutHead;
+
+	while ((Which != NO_BUFFER) && (Buffers[Which].FrameID != FrameID)) {
+		Prev = Which;
+		Which = Buffers[Which].Next;
+	}
+	if (Which == NO_BUFFER) {
+		return NO_BUFFER;
+	}
+	if (Prev == NO_BUFFER) {
+		OutHead = Buffers[Which].Next;
+	} else {
+		Buffers[Prev].Next = Buffers[Which].Next;
+	}
+	if (OutTail == Which) {
+		OutTail = Prev;
+	}
+	NumOutstanding--;
+	return Which;
+}
+
+static bool RetryOrDrop(uint8_t Which) {
+	if ((Buffers[Which].Lane == TX_LANE_CTRL) && (Buffers[Which].Slot < MAX_PEERS) &&
+		(Buffers[Which].FrameID != LatestCtrlID[Buffers[Which].Slot])) {
+		// newer control data for this DOG is already on its way
+		Superseded++;
+		FreeBuffer(Which);
+		return false;
+	}
+	if (Buffers[Which].Retries >= TX_RETRY_BUDGET) {
+		GaveUp++;
+		FreeBuffer(Which);
+		return false;
+	}
+	Buffers[Which].Retries++;
+	Retransmits++;
+	PushFront(Which);
+	return true;
+}
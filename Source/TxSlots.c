@@ -0,0 +1,181 @@
+/****************************************************************************
+ Module
+   TxSlots.c
+
+ Description
+   Slotted schedule for control packets (CTRL_SLOTTED). Time is cut into
+   TDMA_FRAME_TIME cycles of TDMA_SLOTS slots, and the FARMER only starts
+   its INTER_MESSAGE_TIMER ticks at the start of its own slot. The slot
+   comes from the DOG tag to begin with, so FARMERs playing different DOGs
+   start out apart.
+
+   FARMERs have no common clock, so two of them can still end up on top of
+   each other. The schedule corrects itself from what the link tells it:
+
+   - a failed transmit status on a control packet counts as a collision,
+     and TDMA_HOP_FAILS of them in a row move us to another slot, picked
+     at random
+   - a report from the DOG that arrives inside our slot means the
+     exchange went through cleanly there, and clears the run of failures
+
+ Notes
+   Only used from service context. Has no hardware dependencies.
+   The slot to hop to comes from rand(), which FARMER_SM seeds from the
+   cycle counter at the first pair press (StartPairing). TxSlots_Init is
+   only called once a DOG has been paired, so it is always seeded by then
+   and two FARMERs that collide hop to different slots.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include <stdlib.h>
+
+#include "TxSlots.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint16_t PhaseOf(uint16_t Now);
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint16_t Epoch;     // ES_Timer_GetTime() at the start of a cycle, kept within a cycle of now
+static uint8_t Slot;
+static uint8_t FailsInRow;
+
+static uint16_t Hops;
+static uint16_t Collisions;
+static uint16_t ReportsInSlot;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     TxSlots_Init
+
+ Parameters
+     uint8_t : our DOG tag, picks the slot to start in
+     uint16_t : ES_Timer_GetTime() now, taken as the start of a cycle
+****************************************************************************/
+void TxSlots_Init(uint8_t DogTag, uint16_t Now) {
+	Epoch = Now;
+	Slot = DogTag % TDMA_SLOTS;
+	FailsInRow = 0;
+}
+
+/****************************************************************************
+ Function
+     TxSlots_Delay
+
+ Parameters
+     uint16_t : ES_Timer_GetTime() now
+     uint16_t : the soonest the next tick is wanted, in ms
+
+ Returns
+     uint16_t : ms to set INTER_MESSAGE_TIMER for, at least Wanted and
+     ending at the start of our slot
+****************************************************************************/
+uint16_t TxSlots_Delay(uint16_t Now, uint16_t Wanted) {
+	uint16_t Phase = (PhaseOf(Now) + Wanted) % TDMA_FRAME_TIME;
+	uint16_t Wait = (Slot * TDMA_SLOT_TIME + TDMA_FRAME_TIME - Phase) % TDMA_FRAME_TIME;
+
+	if (Wanted + Wait == 0) {
+		return TDMA_FRAME_TIME;
+	}
+	return Wanted + Wait;
+}
+
+/****************************************************************************
+ Function
+     TxSlots_TxStatus
+
+ Parameters
+     bool : true if a frame sent to a DOG was delivered
+****************************************************************************/
+void TxSlots_TxStatus(bool Success) {
+	if (Success) {
+		FailsInRow = 0;
+		return;
+	}
+	Collisions++;
+	if (++FailsInRow >= TDMA_HOP_FAILS) {
+		// somebody else is in our slot, move to any of the others; rand() is
+		// seeded per unit, so whoever we collided with picks differently
+		Slot = (Slot + 1 + rand() % (TDMA_SLOTS - 1)) % TDMA_SLOTS;
+		FailsInRow = 0;
+		Hops++;
+	}
+}
+
+/****************************************************************************
+ Function
+     TxSlots_ReportReceived
+
+ Parameters
+     uint16_t : ES_Timer_GetTime() the DOG's report came in
+****************************************************************************/
+void TxSlots_ReportReceived(uint16_t Now) {
+	uint16_t Lag = (PhaseOf(Now) + TDMA_FRAME_TIME - Slot * TDMA_SLOT_TIME) % TDMA_FRAME_TIME;
+
+	if (Lag < TDMA_SLOT_TIME) {
+		ReportsInSlot++;
+		FailsInRow = 0;
+	}
+}
+
+/****************************************************************************
+ Function
+     TxSlots_GetSlot
+
+ Returns
+     uint8_t : the slot we are sending in now
+****************************************************************************/
+uint8_t TxSlots_GetSlot(void) {
+	return Slot;
+}
+
+/****************************************************************************
+ Function
+     TxSlots_GetHops
+
+ Returns
+     uint16_t : times we have moved to another slot
+****************************************************************************/
+uint16_t TxSlots_GetHops(void) {
+	return Hops;
+}
+
+/****************************************************************************
+ Function
+     TxSlots_GetCollisions
+
+ Returns
+     uint16_t : failed transmit statuses counted against our slot
+****************************************************************************/
+uint16_t TxSlots_GetCollisions(void) {
+	return Collisions;
+}
+
+/****************************************************************************
+ Function
+     TxSlots_GetReportsInSlot
+
+ Returns
+     uint16_t : DOG reports that arrived inside our slot
+****************************************************************************/
+uint16_t TxSlots_GetReportsInSlot(void) {
+	return ReportsInSlot;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Where Now falls in the cycle. Moves Epoch up by whole cycles so the
+// 16 bit difference never wraps, as long as we're called every half minute
+static uint16_t PhaseOf(uint16_t Now) {
+	uint16_t Elapsed = Now - Epoch;
+
+	Epoch += Elapsed - Elapsed % TDMA_FRAME_TIME;
+	return Elapsed % TDMA_FRAME_TIME;
+}
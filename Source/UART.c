@@ -5,6 +5,17 @@
  Description
    UART Initialization and ISR functions
 
+   With UART_TX_DMA defined (Constants.h) a whole frame is handed to uDMA
+   channel 7 (UART5 TX). The ISR runs once when the uDMA has filled the
+   last byte into the FIFO and once more at end of transmission, then posts
+   ES_TX_COMPLETE to Transmit_SM.
+
+   With UART_RX_FLOW defined the XBee's RTS input is driven from PD6. UART5
+   has no flow control of its own on the TM4C123, so it is a plain GPIO
+   that UART_UpdateRxFlow raises when the RxQueue reaches
+   RX_FLOW_HIGH_FRAMES and lowers again at RX_FLOW_LOW_FRAMES. XBeeLink
+   sets D6 so the radio listens to it.
+
  Notes
 
  History
@@ -27,11 +38,14 @@
 #include "driverlib/sysctl.h"
 #include "driverlib/pin_map.h"	// Define PART_TM4C123GH6PM in project
 #include "driverlib/gpio.h"
+#include "driverlib/udma.h"
 
+#include "ES_ShortTimer.h"
 #include "Constants.h"
 #include "Hardware.h"
 #include "Transmit_SM.h"
 #include "Receive_SM.h"
+#include "RxQueue.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 //#define RX_PIN	BIT0HI 	// UART7 Rx: PE0
@@ -39,8 +53,48 @@
 
 #define ALL_BITS (0xff<<2)
 
+// baud rate divisor in 64ths: BRD = SysClk / (16 * Baud), rounded to the
+// nearest 64th the way the TivaWare UARTConfigSetExpClk does it
+#define UART_CLOCK_HZ       (ES_CYCLES_PER_US * 1000000UL)
+#define BRD_64THS(Baud)     ((((UART_CLOCK_HZ * 8UL) / (Baud)) + 1) / 2)
+#define BAUD_ENTRY(Baud)    { (Baud), BRD_64THS(Baud) / 64, BRD_64THS(Baud) % 64 }
+
+typedef struct {
+	uint32_t Baud;
+	uint16_t IBRD;
+	uint8_t FBRD;
+} BaudEntry_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void CountRxErrors(uint32_t Data);
+
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t DataByte; 
+static uint16_t RxErrors[NUM_UART_ERRORS]; // written in UART_ISR only
+
+// indexed by the XBee BD parameter
+static const BaudEntry_t BaudTable[NUM_XBEE_BAUDS] = {
+	BAUD_ENTRY(1200), BAUD_ENTRY(2400), BAUD_ENTRY(4800), BAUD_ENTRY(9600),
+	BAUD_ENTRY(19200), BAUD_ENTRY(38400), BAUD_ENTRY(57600), BAUD_ENTRY(115200)
+};
+static uint8_t BaudCode = XBEE_BD_9600;
+static uint32_t ByteTimeUs; // one start, 8 data and one stop bit
+
+static uint32_t TxISRCycles; // CPU cycles spent on TX in the ISR, see UART_TakeTxISRCycles
+
+static bool RxHeld;          // RTS is up, the XBee is holding on to what it has for us
+static uint16_t RxHolds;     // times RTS has gone up
+static uint16_t RxHoldStart; // ES_Timer_GetTime() it last went up
+static uint32_t RxHeldMs;    // total time spent up, not counting now
+
+#ifdef UART_TX_DMA
+// the uDMA control table must be 1024 byte aligned, only the primary
+// structures are used
+static tDMAControlTable DMAControlTable[32] __attribute__((aligned(1024)));
+
+static bool TxDMABusy = false;     // uDMA still feeding the FIFO
+static bool TxDMADraining = false; // uDMA done, waiting for the FIFO to empty
+#endif
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -89,23 +143,58 @@ void InitUART(void) {
 	HWREG(UART5_BASE + UART_O_CTL) &= ~UART_CTL_UARTEN;
 	
 	// 9. Write integer portion of BRD to UARTIBRD (Baud rate 9600, Integer = 260, Fraction = 27)
-	HWREG(UART5_BASE + UART_O_IBRD) = 260; //0x0104;
+	// the radio always powers up at 9600, XBeeLink may speed us both up later
+	BaudCode = XBEE_BD_9600;
+	ByteTimeUs = (10UL * 1000000UL + BaudTable[BaudCode].Baud - 1) / BaudTable[BaudCode].Baud;
+	HWREG(UART5_BASE + UART_O_IBRD) = BaudTable[BaudCode].IBRD;
 
 	// 10. Write fractional portion of BRD to UARTFBRD
-	HWREG(UART5_BASE + UART_O_FBRD) = 27; //0x1B;
+	HWREG(UART5_BASE + UART_O_FBRD) = BaudTable[BaudCode].FBRD;
 	
 	// 11. Write desired serial parameters to UARTLCRH
-	HWREG(UART5_BASE + UART_O_LCRH) |= (BIT5HI | BIT6HI); // 8-bit word length, all other bits zero
+	HWREG(UART5_BASE + UART_O_LCRH) |= (BIT5HI | BIT6HI | UART_LCRH_FEN); // 8-bit word length, FIFOs on
+	
+	// interrupt when the RX FIFO is 1/8 full, the receive timeout picks up
+	// whatever is left in it at the end of a frame
+	HWREG(UART5_BASE + UART_O_IFLS) = (HWREG(UART5_BASE + UART_O_IFLS) & ~UART_IFLS_RX_M) | UART_IFLS_RX1_8;
 	
 	// 12. Configure UART operation using UARTCTL register 
-	HWREG(UART5_BASE + UART_O_CTL) |= (UART_CTL_RXE | UART_CTL_TXE);// | UART_CTL_EOT); // Enable Receive and Transmit
+	// EOT so that TXIM still fires once per byte with the FIFO on
+	HWREG(UART5_BASE + UART_O_CTL) |= (UART_CTL_RXE | UART_CTL_TXE | UART_CTL_EOT); // Enable Receive and Transmit
 	
 	// 13. Enable UART by setting UARTEN bit in UARTCTL 
 	HWREG(UART5_BASE + UART_O_CTL) |= UART_CTL_UARTEN;
 
-	// locally enable RX interrupts
-	HWREG(UART5_BASE + UART_O_IM) |= UART_IM_RXIM; 
+#ifdef UART_RX_FLOW
+	// RTS on PD6, a plain output held low (send away) until the queue backs up
+	HWREG(SYSCTL_RCGCGPIO) |= SYSCTL_RCGCGPIO_R3;
+	while ((HWREG(SYSCTL_PRGPIO) & SYSCTL_PRGPIO_R3 ) != SYSCTL_PRGPIO_R3 )
+		;
+	HWREG(GPIO_PORTD_BASE + GPIO_O_DEN) |= RTS_PIN;
+	HWREG(GPIO_PORTD_BASE + GPIO_O_DIR) |= RTS_PIN;
+	HWREG(GPIO_PORTD_BASE + (GPIO_O_DATA + ALL_BITS)) &= ~RTS_PIN;
+#endif
+	RxHeld = false;
+
+	// locally enable RX and RX timeout interrupts
+	HWREG(UART5_BASE + UART_O_IM) |= (UART_IM_RXIM | UART_IM_RTIM); 
 	
+#ifdef UART_TX_DMA
+	// set up uDMA channel 7 for UART5 TX: bytes from memory into UARTDR,
+	// 4 at a time whenever the TX FIFO is at or below half full
+	SysCtlPeripheralEnable(SYSCTL_PERIPH_UDMA);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_UDMA))
+		;
+	uDMAEnable();
+	uDMAControlBaseSet(DMAControlTable);
+	uDMAChannelAssign(UDMA_CH7_UART5TX);
+	uDMAChannelAttributeDisable(UDMA_CH7_UART5TX, UDMA_ATTR_ALTSELECT | UDMA_ATTR_USEBURST |
+		UDMA_ATTR_HIGH_PRIORITY | UDMA_ATTR_REQMASK);
+	uDMAChannelControlSet(UDMA_CH7_UART5TX | UDMA_PRI_SELECT,
+		UDMA_SIZE_8 | UDMA_SRC_INC_8 | UDMA_DST_INC_NONE | UDMA_ARB_4);
+	HWREG(UART5_BASE + UART_O_DMACTL) |= UART_DMACTL_TXDMAE;
+#endif
+
 	// set NVIC enable for UART5
 	HWREG(NVIC_EN1) |= BIT29HI;
 	
@@ -119,7 +208,7 @@ void InitUART(void) {
      UART_ISR
 
  Description
-     Responds to RXIM or TXIM interrupts
+     Responds to RXIM/RTIM or TXIM interrupts
 
  Author
      Sarah Cabreros
@@ -127,30 +216,57 @@ void InitUART(void) {
 
  void UART_ISR(void) {
 
-  // if RXMIS set:
- 	if ((HWREG(UART5_BASE+UART_O_MIS) & UART_MIS_RXMIS) == UART_MIS_RXMIS) {
-		//printf("r\r\n");
-		// save new data byte
-		DataByte = HWREG(UART5_BASE + UART_O_DR); 
+  // if RXMIS or RTMIS set:
+ 	if ((HWREG(UART5_BASE+UART_O_MIS) & (UART_MIS_RXMIS | UART_MIS_RTMIS)) != 0) {
+		// clear interrupt flags (set RXIC and RTIC in UARTICR)
+		HWREG(UART5_BASE + UART_O_ICR) = (UART_ICR_RXIC | UART_ICR_RTIC);
 
-		// clear interrupt flag (set RXIC in UARTICR)
-		HWREG(UART5_BASE + UART_O_ICR) |= UART_ICR_RXIC;
-
-		// post ByteReceived event to Receive_SM (event param is byte in UARTDR) 
-		ES_Event ThisEvent;
-		ThisEvent.EventType = ES_BYTE_RECEIVED;
-		ThisEvent.EventParam = DataByte;
-		PostReceive_SM(ThisEvent); 
+		// drain the RX FIFO, the frame parser posts once a whole frame is in
+		while ((HWREG(UART5_BASE + UART_O_FR) & UART_FR_RXFE) == 0) {
+			uint32_t Data = HWREG(UART5_BASE + UART_O_DR);
+			
+			// the error flags come with the byte they happened on, the byte
+			// still goes to the parser, its checksum will catch the damage
+			if ((Data & (UART_DR_OE | UART_DR_BE | UART_DR_PE | UART_DR_FE)) != 0) {
+				CountRxErrors(Data);
+			}
+			DataByte = Data;
+			ProcessReceivedByte(DataByte);
+		}
  	}
 
-	// else if TXMIS set (FIFO open): // where do we enable TXIM interrupts??? 
-	else if ((HWREG(UART5_BASE+UART_O_MIS) & UART_MIS_TXMIS) == UART_MIS_TXMIS) {
-	// should get this interrupt for all bytes AFTER the start byte (0x7E) 
-		//printf("t\r\n");
+#ifdef UART_TX_DMA
+	// uDMA completion comes in on the UART vector, with no MIS bit of its own
+	if (TxDMABusy && !uDMAChannelIsEnabled(UDMA_CH7_UART5TX)) {
+		uint32_t EntryCycles = ES_GetCycles();
+		uDMAIntClear(BIT7HI);
+		TxDMABusy = false;
+		TxDMADraining = true;
+		// the last few bytes are still in the FIFO, EOT tells us when they're out
+		HWREG(UART5_BASE + UART_O_IM) |= UART_IM_TXIM;
+		TxISRCycles += ES_GetCycles() - EntryCycles;
+	}
+#endif
+
+	// if TXMIS set (last byte out):
+	if ((HWREG(UART5_BASE+UART_O_MIS) & UART_MIS_TXMIS) == UART_MIS_TXMIS) {
+		uint32_t EntryCycles = ES_GetCycles();
 		
 		// clear interrupt flag 
 		HWREG(UART5_BASE + UART_O_ICR) |= UART_ICR_TXIC;
 
+#ifdef UART_TX_DMA
+		if (TxDMADraining) {
+			TxDMADraining = false;
+			HWREG(UART5_BASE + UART_O_IM) &= ~UART_IM_TXIM;
+			
+			// whole frame is on the wire
+			ES_Event ThisEvent;
+			ThisEvent.EventType = ES_TX_COMPLETE;
+			PostTransmit_SM(ThisEvent);
+		}
+#else
+	// should get this interrupt for all bytes AFTER the start byte (0x7E) 
 		// post ByteSent event 
 		ES_Event ThisEvent;
 		ThisEvent.EventType = ES_BYTE_SENT;
@@ -161,12 +277,249 @@ void InitUART(void) {
 			// disable TXIM 
 			HWREG(UART5_BASE + UART_O_IM) &= ~UART_IM_TXIM;
 		}
-		
+#endif
+		TxISRCycles += ES_GetCycles() - EntryCycles;
+	}
+}
+
+/****************************************************************************
+ Function
+     UART_SendByte
+
+ Parameters
+     uint8_t : byte to send
+
+ Returns
+     bool, false if the TX FIFO wasn't empty and the byte was not sent
+
+ Description
+     For byte at a time transmit, the TXIM interrupt (UART_EnableTxInt)
+     reports each byte going out as ES_BYTE_SENT
+****************************************************************************/
+bool UART_SendByte(uint8_t DataByte) {
+	if ((HWREG(UART5_BASE + UART_O_FR) & UART_FR_TXFE) == 0) {
+		return false;
+	}
+	HWREG(UART5_BASE + UART_O_DR) = DataByte;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     UART_EnableTxInt
+
+ Description
+     Turns on TXIM, UART_ISR turns it back off after the last byte
+****************************************************************************/
+void UART_EnableTxInt(void) {
+	HWREG(UART5_BASE + UART_O_IM) |= UART_IM_TXIM;
+}
+
+#ifdef UART_TX_DMA
+/****************************************************************************
+ Function
+     UART_StartTxDMA
+
+ Parameters
+     uint8_t * : first byte of the frame (start delimiter)
+     uint8_t : number of bytes to send, including the checksum
+
+ Description
+     Hands a whole frame to the uDMA. The buffer must not change until
+     Transmit_SM gets ES_TX_COMPLETE.
+****************************************************************************/
+void UART_StartTxDMA(uint8_t *pData, uint8_t Length) {
+	// drop any end of transmission left over from before, so that the next
+	// TXMIS really is the end of this frame
+	HWREG(UART5_BASE + UART_O_ICR) = UART_ICR_TXIC;
+	TxDMABusy = true;
+	uDMAChannelTransferSet(UDMA_CH7_UART5TX | UDMA_PRI_SELECT, UDMA_MODE_BASIC,
+		pData, (void *)(UART5_BASE + UART_O_DR), Length);
+	uDMAChannelEnable(UDMA_CH7_UART5TX);
+}
+#endif
+
+/****************************************************************************
+ Function
+     UART_AbortTx
+
+ Description
+     Gives up on the frame going out, for when Transmit_SM times out on it.
+     Stops the uDMA so it reads nothing more from the frame buffer, which
+     Transmit_SM is about to hand back to TxQueue, and turns off TXIM so no
+     ES_TX_COMPLETE or ES_BYTE_SENT for it turns up later. Whatever is
+     already in the FIFO still goes out.
+****************************************************************************/
+void UART_AbortTx(void) {
+	EnterCritical();
+#ifdef UART_TX_DMA
+	uDMAChannelDisable(UDMA_CH7_UART5TX);
+	TxDMABusy = false;
+	TxDMADraining = false;
+#endif
+	HWREG(UART5_BASE + UART_O_IM) &= ~UART_IM_TXIM;
+	HWREG(UART5_BASE + UART_O_ICR) = UART_ICR_TXIC;
+	ExitCritical();
+}
+
+/****************************************************************************
+ Function
+     UART_SetBaudCode
+
+ Parameters
+     uint8_t : XBee BD parameter (0 = 1200 ... 7 = 115200)
+
+ Returns
+     bool, false if the code is out of range
+
+ Description
+     Waits for anything still going out to finish, uDMA included, then
+     reprograms the divisors. The LCRH write is what latches new IBRD/FBRD values.
+****************************************************************************/
+bool UART_SetBaudCode(uint8_t NewCode) {
+	if (NewCode >= NUM_XBEE_BAUDS) {
+		return false;
 	}
+#ifdef UART_TX_DMA
+	// a frame the uDMA is still feeding in would go out half at each rate
+	while (uDMAChannelIsEnabled(UDMA_CH7_UART5TX))
+		;
+#endif
+	while ((HWREG(UART5_BASE + UART_O_FR) & UART_FR_BUSY) != 0)
+		;
+	HWREG(UART5_BASE + UART_O_CTL) &= ~UART_CTL_UARTEN;
+	HWREG(UART5_BASE + UART_O_IBRD) = BaudTable[NewCode].IBRD;
+	HWREG(UART5_BASE + UART_O_FBRD) = BaudTable[NewCode].FBRD;
+	HWREG(UART5_BASE + UART_O_LCRH) = HWREG(UART5_BASE + UART_O_LCRH);
+	HWREG(UART5_BASE + UART_O_CTL) |= UART_CTL_UARTEN;
+	
+	BaudCode = NewCode;
+	ByteTimeUs = (10UL * 1000000UL + BaudTable[NewCode].Baud - 1) / BaudTable[NewCode].Baud;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     UART_GetBaud
+
+ Returns
+     uint32_t : the baud rate UART5 is running at
+****************************************************************************/
+uint32_t UART_GetBaud(void) {
+	return BaudTable[BaudCode].Baud;
 }
 
+/****************************************************************************
+ Function
+     UART_GetByteTimeUs
 
+ Returns
+     uint32_t : microseconds one byte takes on the wire at the current baud,
+     rounded up. All the byte and frame timeouts are worked out from this.
+****************************************************************************/
+uint32_t UART_GetByteTimeUs(void) {
+	return ByteTimeUs;
+}
 
+/****************************************************************************
+ Function
+     UART_GetErrorCount
 
+ Parameters
+     UARTError_t : which receive error
 
+ Returns
+     uint16_t : how many bytes have come in with it since power up
+****************************************************************************/
+uint16_t UART_GetErrorCount(UARTError_t Which) {
+	if (Which >= NUM_UART_ERRORS) {
+		return 0;
+	}
+	return RxErrors[Which];
+}
 
+/****************************************************************************
+ Function
+     UART_UpdateRxFlow
+
+ Description
+     Moves RTS to match the RxQueue. Called by ProcessReceivedByte after each
+     frame it queues and by Comm_Service after each one it releases, so it
+     runs at both interrupt and service level and keeps the depth check and
+     the pin write together. Does nothing without UART_RX_FLOW.
+****************************************************************************/
+void UART_UpdateRxFlow(void) {
+#ifdef UART_RX_FLOW
+	uint8_t Depth;
+	
+	EnterCritical();
+	Depth = RxQueue_GetDepth();
+	if (!RxHeld && (Depth >= RX_FLOW_HIGH_FRAMES)) {
+		HWREG(GPIO_PORTD_BASE + (GPIO_O_DATA + ALL_BITS)) |= RTS_PIN;
+		RxHeld = true;
+		RxHolds++;
+		RxHoldStart = ES_Timer_GetTime();
+	} else if (RxHeld && (Depth <= RX_FLOW_LOW_FRAMES)) {
+		HWREG(GPIO_PORTD_BASE + (GPIO_O_DATA + ALL_BITS)) &= ~RTS_PIN;
+		RxHeld = false;
+		RxHeldMs += (uint16_t)(ES_Timer_GetTime() - RxHoldStart);
+	}
+	ExitCritical();
+#endif
+}
+
+/****************************************************************************
+ Function
+     UART_GetRxHolds
+
+ Returns
+     uint16_t : times RTS has been raised to hold the XBee off
+****************************************************************************/
+uint16_t UART_GetRxHolds(void) {
+	return RxHolds;
+}
+
+/****************************************************************************
+ Function
+     UART_GetRxHeldMs
+
+ Returns
+     uint32_t : ms the XBee has been held off in total, up to the last
+     time RTS came back down
+****************************************************************************/
+uint32_t UART_GetRxHeldMs(void) {
+	return RxHeldMs;
+}
+
+/****************************************************************************
+ Function
+     UART_TakeTxISRCycles
+
+ Returns
+     CPU cycles spent on transmit work in UART_ISR since the last call
+
+ Description
+     Lets Transmit_SM charge the interrupt side of a frame to that frame
+****************************************************************************/
+uint32_t UART_TakeTxISRCycles(void) {
+	uint32_t Cycles;
+	EnterCritical();
+	Cycles = TxISRCycles;
+	TxISRCycles = 0;
+	ExitCritical();
+	return Cycles;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Tallies the error flags read from UARTDR along with a byte, and clears
+// them from UARTRSR
+static void CountRxErrors(uint32_t Data) {
+	if (Data & UART_DR_OE) RxErrors[UART_ERR_OVERRUN]++;
+	if (Data & UART_DR_FE) RxErrors[UART_ERR_FRAMING]++;
+	if (Data & UART_DR_PE) RxErrors[UART_ERR_PARITY]++;
+	if (Data & UART_DR_BE) RxErrors[UART_ERR_BREAK]++;
+	HWREG(UART5_BASE + UART_O_ECR) = 0;
+}
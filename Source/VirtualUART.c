@@ -0,0 +1,594 @@
+/****************************************************************************
+ Module
+   VirtualUART.c
+
+ Description
+   Host stand-in for UART.c, so the receive and transmit paths can be run
+   on a PC. It implements the same UART.h interface over a simulated
+   UART5:
+
+   - a wire in each direction, moved one byte per character time as
+     VUART_Advance is called
+   - an RX FIFO with a configurable depth and interrupt trigger level,
+     an RX timeout after four idle character times, and overruns when
+     the FIFO is not emptied in time
+   - bit errors injected on the receive wire at a configurable rate,
+     flagged as framing errors the way the hardware would
+   - a 16 byte TX FIFO fed either a byte at a time or by a DMA stand-in,
+     which posts ES_BYTE_SENT / ES_TX_COMPLETE to Transmit_SM like the
+     real ISR does
+   - optional loopback of everything sent back into the receive side
+   - with UART_RX_FLOW, an RTS line the radio end obeys: once it goes up
+     the receive wire stops after RtsLagBytes more bytes and waits there
+     until it comes back down
+
+   VUART_RunReceiveBench pushes generated XBee frames, clean and damaged,
+   through the simulated FIFO and interrupt into the frame parser, and
+   counts what comes out against what went in.
+
+ Notes
+   Only built with ES_HOST_BUILD, the target uses UART.c. The host
+   programs in Host/ link it with the comm stack; make -C Host
+   run-vuart-bench runs the bench.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+#ifdef ES_HOST_BUILD
+/*----------------------------- Include Files -----------------------------*/
+#include <string.h>
+#include <time.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+
+#include "Constants.h"
+#include "VirtualUART.h"
+#include "XBeeParser.h"
+#include "Transmit_SM.h"
+#include "Receive_SM.h"
+#include "RxQueue.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define VUART_TX_FIFO       16
+#define RX_TIMEOUT_BYTES    4   // RTIM fires after 32 bit times of quiet
+
+// same positions as the flags in UARTDR
+#define DR_FE               0x100
+#define DR_PE               0x200
+#define DR_BE               0x400
+#define DR_OE               0x800
+
+#define BENCH_RECENT        8   // frames the bench remembers to match against
+#define BENCH_FRAME_SIZE    (HEADER_LENGTH + MAX_FRAME_LENGTH + 1)
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint32_t CurrentByteTime(void);
+static void ByteTick(void);
+static uint32_t Random(void);
+static void BenchSink(uint8_t DataByte);
+static void BenchMatch(const uint8_t *pFrame, uint8_t Length);
+
+/*---------------------------- Module Variables ---------------------------*/
+static VUARTConfig_t Config = { 0, 16, 2, 0, false, 1 };
+static VUARTRxSink_t RxSink = ProcessReceivedByte;
+
+static uint32_t NowUs;
+static uint32_t CarryUs;   // toward the next character time
+static uint32_t RandomState;
+
+static const uint32_t Bauds[NUM_XBEE_BAUDS] = { 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+static uint8_t BaudCode = XBEE_BD_9600;
+
+// XBee -> us
+static uint8_t RxWire[VUART_LINE_SIZE];
+static uint16_t RxWireHead;
+static uint16_t RxWireCount;
+static uint16_t RxFifo[VUART_MAX_FIFO]; // data byte plus DR_ flags
+static uint8_t RxFifoHead;
+static uint8_t RxFifoCount;
+static bool OverrunPending;
+static uint8_t RxIdleBytes;
+static uint32_t LineErrors;    // bit errors injected so far
+static uint16_t RxErrors[NUM_UART_ERRORS];
+static bool RxHeld;            // RTS up
+static uint8_t RtsLagLeft;     // bytes the radio may still send with RTS up
+static uint16_t RxHolds;
+#ifdef UART_RX_FLOW
+static uint32_t RxHoldStartUs;
+#endif
+static uint32_t RxHeldUs;
+
+// us -> XBee
+static uint8_t TxFifo[VUART_TX_FIFO];
+static uint8_t TxFifoHead;
+static uint8_t TxFifoCount;
+static const uint8_t *pTxDMA;
+static uint8_t TxDMALeft;
+static bool TxDMAFrame;        // the bytes in flight came from UART_StartTxDMA
+static bool TxIntEnabled;
+static bool TxEmptyPending;    // TX FIFO has gone empty, for UART_ISR
+static uint8_t TxWire[VUART_LINE_SIZE];
+static uint16_t TxWireHead;
+static uint16_t TxWireCount;
+
+// receive bench
+static XBeeParser_t BenchParser;
+static VUARTBenchResult_t *pBench;
+static struct {
+	uint8_t Data[MAX_FRAME_LENGTH];
+	uint8_t Length;
+	bool Damaged;
+	bool Delivered;
+	bool Used;
+} Recent[BENCH_RECENT];
+static uint8_t RecentNext;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ UART.h interface
+****************************************************************************/
+void InitUART(void) {
+	NowUs = 0;
+	CarryUs = 0;
+	RandomState = (Config.Seed != 0) ? Config.Seed : 1;
+	BaudCode = XBEE_BD_9600;
+	RxWireHead = RxWireCount = 0;
+	RxFifoHead = RxFifoCount = 0;
+	OverrunPending = false;
+	RxIdleBytes = 0;
+	TxFifoHead = TxFifoCount = 0;
+	pTxDMA = NULL;
+	TxDMALeft = 0;
+	TxDMAFrame = false;
+	TxIntEnabled = false;
+	TxEmptyPending = false;
+	TxWireHead = TxWireCount = 0;
+	memset(RxErrors, 0, sizeof(RxErrors));
+	RxHeld = false;
+	RtsLagLeft = 0;
+	RxHolds = 0;
+	RxHeldUs = 0;
+}
+
+void UART_ISR(void) {
+	// drain the RX FIFO into the parser
+	while (RxFifoCount != 0) {
+		uint16_t Data = RxFifo[RxFifoHead];
+		RxFifoHead = (RxFifoHead + 1) % VUART_MAX_FIFO;
+		RxFifoCount--;
+		if (Data & DR_OE) RxErrors[UART_ERR_OVERRUN]++;
+		if (Data & DR_FE) RxErrors[UART_ERR_FRAMING]++;
+		if (Data & DR_PE) RxErrors[UART_ERR_PARITY]++;
+		if (Data & DR_BE) RxErrors[UART_ERR_BREAK]++;
+		RxSink((uint8_t)Data);
+	}
+	RxIdleBytes = 0;
+
+	if (TxEmptyPending) {
+		ES_Event ThisEvent;
+		TxEmptyPending = false;
+		if (TxDMAFrame) {
+			// whole frame is on the wire
+			TxDMAFrame = false;
+			ThisEvent.EventType = ES_TX_COMPLETE;
+			PostTransmit_SM(ThisEvent);
+		} else if (TxIntEnabled) {
+			ThisEvent.EventType = ES_BYTE_SENT;
+			PostTransmit_SM(ThisEvent);
+			if (IsLastByte()) {
+				TxIntEnabled = false;
+			}
+		}
+	}
+}
+
+bool UART_SendByte(uint8_t DataByte) {
+	if (TxFifoCount != 0) {
+		return false;
+	}
+	TxFifo[TxFifoHead] = DataByte;
+	TxFifoCount = 1;
+	return true;
+}
+
+void UART_EnableTxInt(void) {
+	TxIntEnabled = true;
+}
+
+void UART_StartTxDMA(uint8_t *pData, uint8_t Length) {
+	pTxDMA = pData;
+	TxDMALeft = Length;
+	TxDMAFrame = true;
+	while ((TxDMALeft != 0) && (TxFifoCount < VUART_TX_FIFO)) {
+		TxFifo[(TxFifoHead + TxFifoCount) % VUART_TX_FIFO] = *pTxDMA++;
+		TxFifoCount++;
+		TxDMALeft--;
+	}
+}
+
+void UART_AbortTx(void) {
+	// like the uDMA being stopped, the FIFO keeps what it already has
+	pTxDMA = NULL;
+	TxDMALeft = 0;
+	TxDMAFrame = false;
+	TxIntEnabled = false;
+	TxEmptyPending = false;
+}
+
+uint32_t UART_TakeTxISRCycles(void) {
+	return 0;
+}
+
+bool UART_SetBaudCode(uint8_t NewCode) {
+	if (NewCode >= NUM_XBEE_BAUDS) {
+		return false;
+	}
+	BaudCode = NewCode;
+	return true;
+}
+
+uint32_t UART_GetBaud(void) {
+	return Bauds[BaudCode];
+}
+
+uint32_t UART_GetByteTimeUs(void) {
+	return (10UL * 1000000UL + Bauds[BaudCode] - 1) / Bauds[BaudCode];
+}
+
+uint16_t UART_GetErrorCount(UARTError_t Which) {
+	if (Which >= NUM_UART_ERRORS) {
+		return 0;
+	}
+	return RxErrors[Which];
+}
+
+void UART_UpdateRxFlow(void) {
+#ifdef UART_RX_FLOW
+	uint8_t Depth = RxQueue_GetDepth();
+
+	if (!RxHeld && (Depth >= RX_FLOW_HIGH_FRAMES)) {
+		RxHeld = true;
+		RtsLagLeft = Config.RtsLagBytes;
+		RxHolds++;
+		RxHoldStartUs = NowUs;
+	} else if (RxHeld && (Depth <= RX_FLOW_LOW_FRAMES)) {
+		RxHeld = false;
+		RxHeldUs += NowUs - RxHoldStartUs;
+	}
+#endif
+}
+
+uint16_t UART_GetRxHolds(void) {
+	return RxHolds;
+}
+
+uint32_t UART_GetRxHeldMs(void) {
+	return RxHeldUs / 1000;
+}
+
+/****************************************************************************
+ Function
+     VUART_Configure
+
+ Parameters
+     const VUARTConfig_t * : timing, FIFO and error settings
+
+ Description
+     Takes effect at once, call InitUART afterwards to start clean
+****************************************************************************/
+void VUART_Configure(const VUARTConfig_t *pConfig) {
+	Config = *pConfig;
+	if ((Config.RxFifoDepth == 0) || (Config.RxFifoDepth > VUART_MAX_FIFO)) {
+		Config.RxFifoDepth = VUART_MAX_FIFO;
+	}
+	if ((Config.RxTrigger == 0) || (Config.RxTrigger > Config.RxFifoDepth)) {
+		Config.RxTrigger = Config.RxFifoDepth;
+	}
+	RandomState = (Config.Seed != 0) ? Config.Seed : 1;
+}
+
+/****************************************************************************
+ Function
+     VUART_SetRxSink
+
+ Parameters
+     VUARTRxSink_t : function UART_ISR hands received bytes to, NULL puts
+                     back ProcessReceivedByte
+****************************************************************************/
+void VUART_SetRxSink(VUARTRxSink_t Sink) {
+	RxSink = (Sink != NULL) ? Sink : ProcessReceivedByte;
+}
+
+/****************************************************************************
+ Function
+     VUART_InjectRx
+
+ Parameters
+     const uint8_t * : bytes the XBee sends us
+     uint16_t : how many
+
+ Returns
+     uint16_t : how many fitted on the wire, the rest are not sent
+****************************************************************************/
+uint16_t VUART_InjectRx(const uint8_t *pBytes, uint16_t Length) {
+	uint16_t i;
+
+	for (i = 0; (i < Length) && (RxWireCount < VUART_LINE_SIZE); i++) {
+		RxWire[(RxWireHead + RxWireCount) % VUART_LINE_SIZE] = pBytes[i];
+		RxWireCount++;
+	}
+	return i;
+}
+
+/****************************************************************************
+ Function
+     VUART_Advance
+
+ Parameters
+     uint32_t : microseconds of simulated time to run
+
+ Description
+     Moves bytes along both wires, one per character time, and runs
+     UART_ISR whenever the hardware would have interrupted
+****************************************************************************/
+void VUART_Advance(uint32_t Microseconds) {
+	uint32_t ByteTime = CurrentByteTime();
+
+	CarryUs += Microseconds;
+	while (CarryUs >= ByteTime) {
+		CarryUs -= ByteTime;
+		NowUs += ByteTime;
+		ByteTick();
+	}
+}
+
+/****************************************************************************
+ Function
+     VUART_TakeTx
+
+ Parameters
+     uint8_t * : where to put what we sent
+     uint16_t : room there
+
+ Returns
+     uint16_t : bytes taken off the transmit wire
+****************************************************************************/
+uint16_t VUART_TakeTx(uint8_t *pBytes, uint16_t MaxLength) {
+	uint16_t i;
+
+	for (i = 0; (i < MaxLength) && (TxWireCount != 0); i++) {
+		pBytes[i] = TxWire[TxWireHead];
+		TxWireHead = (TxWireHead + 1) % VUART_LINE_SIZE;
+		TxWireCount--;
+	}
+	return i;
+}
+
+/****************************************************************************
+ Function
+     VUART_GetTimeUs
+
+ Returns
+     uint32_t : simulated time since InitUART
+****************************************************************************/
+uint32_t VUART_GetTimeUs(void) {
+	return NowUs;
+}
+
+/****************************************************************************
+ Function
+     VUART_RunReceiveBench
+
+ Parameters
+     uint32_t : frames to send
+     uint8_t : how many frames in 256 to damage on purpose (a flipped byte,
+               a bad length, cut short, or junk in front)
+     uint32_t : seed for the frame generator
+     VUARTBenchResult_t * : filled in with the counts
+
+ Description
+     Frames of random length and content (with plenty of 0x7E in them) go
+     in through the simulated wire, FIFO and interrupt into an XBee frame
+     parser, the same one Receive_SM uses. Line errors from the current
+     configuration are added on top of the deliberate damage. Every frame
+     that comes out is checked against the ones that went in. Leaves the
+     RX sink as it found it.
+****************************************************************************/
+void VUART_RunReceiveBench(uint32_t Frames, uint8_t DamagePer256, uint32_t Seed,
+	VUARTBenchResult_t *pResult) {
+	VUARTRxSink_t OldSink = RxSink;
+	uint8_t Frame[BENCH_FRAME_SIZE + 8];
+	uint16_t StartOverruns;
+	clock_t Start;
+	uint32_t n;
+	uint8_t i;
+
+	memset(pResult, 0, sizeof(*pResult));
+	memset(Recent, 0, sizeof(Recent));
+	RecentNext = 0;
+	pBench = pResult;
+	XBee_ParserInit(&BenchParser);
+	RxSink = BenchSink;
+	RandomState = (Seed != 0) ? Seed : 1;
+	StartOverruns = RxErrors[UART_ERR_OVERRUN];
+	Start = clock();
+
+	for (n = 0; n < Frames; n++) {
+		uint8_t Length = 1 + Random() % MAX_FRAME_LENGTH;
+		uint8_t Size = HEADER_LENGTH + Length + 1;
+		uint8_t *pSend = Frame;
+		uint8_t Sum = 0;
+		uint32_t ErrorsBefore = LineErrors;
+		bool Damaged = false;
+
+		// a frame the old one drops out of the window unseen is a miss
+		if (Recent[RecentNext].Used && !Recent[RecentNext].Damaged && !Recent[RecentNext].Delivered) {
+			pResult->Missed++;
+		}
+
+		Frame[START_BYTE_INDEX] = START_DELIMITER;
+		Frame[LENGTH_MSB_BYTE_INDEX] = 0;
+		Frame[LENGTH_LSB_BYTE_INDEX] = Length;
+		for (i = 0; i < Length; i++) {
+			uint8_t Byte = ((Random() & 7) == 0) ? START_DELIMITER : (uint8_t)Random();
+			Frame[HEADER_LENGTH + i] = Byte;
+			Sum += Byte;
+		}
+		Frame[HEADER_LENGTH + Length] = 0xFF - Sum;
+
+		Recent[RecentNext].Length = Length;
+		memcpy(Recent[RecentNext].Data, &Frame[HEADER_LENGTH], Length);
+		Recent[RecentNext].Delivered = false;
+		Recent[RecentNext].Used = true;
+
+		if ((Random() & 0xFF) < DamagePer256) {
+			Damaged = true;
+			switch (Random() % 4) {
+				case 0: // flip a byte somewhere
+					Frame[Random() % Size] ^= 1 + (Random() % 0xFF);
+					break;
+				case 1: // bad length
+					Frame[LENGTH_LSB_BYTE_INDEX] = Random();
+					break;
+				case 2: // cut short
+					Size = 1 + Random() % (Size - 1);
+					break;
+				default: // junk in front, the frame itself is fine
+					pSend = &Frame[BENCH_FRAME_SIZE];
+					for (i = 0; i < 8; i++) {
+						pSend[i] = (i == 0) ? START_DELIMITER : (uint8_t)Random();
+					}
+					VUART_InjectRx(pSend, 8);
+					pSend = Frame;
+					break;
+			}
+		}
+
+		VUART_InjectRx(pSend, Size);
+		// long enough for the bytes to arrive and the RX timeout to fire
+		VUART_Advance(CurrentByteTime() * (RxWireCount + RX_TIMEOUT_BYTES + 1));
+
+		Recent[RecentNext].Damaged = Damaged || (LineErrors != ErrorsBefore);
+		if (Recent[RecentNext].Damaged) {
+			pResult->FramesDamaged++;
+		}
+		pResult->FramesSent++;
+		RecentNext = (RecentNext + 1) % BENCH_RECENT;
+	}
+
+	for (i = 0; i < BENCH_RECENT; i++) {
+		if (Recent[i].Used && !Recent[i].Damaged && !Recent[i].Delivered) {
+			pResult->Missed++;
+		}
+	}
+
+	pResult->FramesPerSec = (double)Frames * CLOCKS_PER_SEC / (double)((clock() - Start) + 1);
+	pResult->ParserBytes = sizeof(XBeeParser_t);
+	pResult->Overruns = RxErrors[UART_ERR_OVERRUN] - StartOverruns;
+	RxSink = OldSink;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+static uint32_t CurrentByteTime(void) {
+	return (Config.ByteTimeUs != 0) ? Config.ByteTimeUs : UART_GetByteTimeUs();
+}
+
+// One character time: a byte comes in off each wire, then the interrupts
+// the hardware would raise
+static void ByteTick(void) {
+	if ((RxWireCount != 0) && (!RxHeld || (RtsLagLeft != 0))) {
+		if (RxHeld) {
+			RtsLagLeft--;
+		}
+		uint16_t Data = RxWire[RxWireHead];
+		RxWireHead = (RxWireHead + 1) % VUART_LINE_SIZE;
+		RxWireCount--;
+
+		if ((Config.ErrorRate != 0) && ((Random() & 0xFFFF) < Config.ErrorRate)) {
+			Data ^= 1 << (Random() % 8);
+			Data |= DR_FE;
+			LineErrors++;
+		}
+
+		if (RxFifoCount == Config.RxFifoDepth) {
+			// lost, the next byte that makes it in carries the flag
+			OverrunPending = true;
+		} else {
+			if (OverrunPending) {
+				Data |= DR_OE;
+				OverrunPending = false;
+			}
+			RxFifo[(RxFifoHead + RxFifoCount) % VUART_MAX_FIFO] = Data;
+			RxFifoCount++;
+		}
+		RxIdleBytes = 0;
+	} else if (RxFifoCount != 0) {
+		RxIdleBytes++;
+	}
+
+	if (TxFifoCount != 0) {
+		uint8_t Byte = TxFifo[TxFifoHead];
+		TxFifoHead = (TxFifoHead + 1) % VUART_TX_FIFO;
+		TxFifoCount--;
+
+		if (Config.Loopback) {
+			VUART_InjectRx(&Byte, 1);
+		} else if (TxWireCount < VUART_LINE_SIZE) {
+			TxWire[(TxWireHead + TxWireCount) % VUART_LINE_SIZE] = Byte;
+			TxWireCount++;
+		}
+
+		// the DMA keeps the FIFO topped up
+		if (TxDMALeft != 0) {
+			TxFifo[(TxFifoHead + TxFifoCount) % VUART_TX_FIFO] = *pTxDMA++;
+			TxFifoCount++;
+			TxDMALeft--;
+		}
+		if (TxFifoCount == 0) {
+			TxEmptyPending = TxDMAFrame || TxIntEnabled;
+		}
+	}
+
+	if ((RxFifoCount >= Config.RxTrigger) || ((RxFifoCount != 0) && (RxIdleBytes >= RX_TIMEOUT_BYTES)) ||
+			TxEmptyPending) {
+		UART_ISR();
+	}
+}
+
+// xorshift32, plenty for picking errors
+static uint32_t Random(void) {
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return RandomState;
+}
+
+static void BenchSink(uint8_t DataByte) {
+	if (XBee_ParseByte(&BenchParser, DataByte) == XBEE_FRAME_GOOD) {
+		do {
+			BenchMatch(BenchParser.Frame, BenchParser.FrameLength);
+		} while (XBee_ParseMore(&BenchParser) == XBEE_FRAME_GOOD);
+	}
+}
+
+// A frame out of the parser has to be one of the recent ones sent
+static void BenchMatch(const uint8_t *pFrame, uint8_t Length) {
+	uint8_t i;
+
+	for (i = 0; i < BENCH_RECENT; i++) {
+		if (Recent[i].Used && !Recent[i].Delivered && (Recent[i].Length == Length) &&
+				(memcmp(Recent[i].Data, pFrame, Length) == 0)) {
+			Recent[i].Delivered = true;
+			pBench->Accepted++;
+			return;
+		}
+	}
+	pBench->FalseAccepts++;
+}
+
+#endif /* ES_HOST_BUILD */
@@ -0,0 +1,362 @@
+/****************************************************************************
+ Module
+   XBeeLink.c
+
+ Description
+   Boot time set up of the serial link to the XBee. The radio always powers
+   up at 9600 baud; this service asks it to go faster and follows it there.
+
+   1. AP (API mode, no escapes), D6 (RTS flow control, with UART_RX_FLOW)
+      and BD (target rate) are sent as queued AT commands (0x09), then AC
+      (0x08) to apply them, all back to back without waiting for the
+      responses in between.
+   2. When they have all come back OK, the XBee switches rate. We give it
+      LINK_SETTLE_TIME and then reprogram UART5 to match.
+   3. A BD query at the new rate confirms both ends agree.
+
+   An error status or a missing response at any step puts the link back at
+   9600 and it carries on there. Before AC has gone out that only means
+   reprogramming UART5. After it, the radio may already be at the new rate
+   even though the sequence failed, so it is sent BD=9600 and AC first:
+   at the rate UART5 is on, and if that goes unanswered, at the other one.
+   Nothing is written to the radio's non-volatile memory, so a power cycle
+   always brings it back to 9600.
+
+   Nothing else is sent to the radio until XBeeLink_IsReady: Comm_Service
+   drops frames for DOGs and FARMER_SM ignores the pair button until then.
+
+ Notes
+   AT frames go through the TxQueue like everything else and take their
+   frame IDs from it. Comm_Service settles their TxQueue entries when the
+   0x88 responses come in and passes the status on as ES_AT_RESPONSE.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+
+#include "Constants.h"
+#include "XBeeLink.h"
+#include "TxQueue.h"
+#include "Transmit_SM.h"
+#include "UART.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define LINK_RESPONSE_TIME  200 // ms to wait for AT responses
+#define LINK_SETTLE_TIME    10  // ms for the XBee to change rate after AC
+#define MAX_PENDING_AT      4
+#define AT_STATUS_OK        0
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool SendATCommand(uint8_t APIIdent, char Cmd0, char Cmd1, uint8_t *Param, uint8_t ParamLength);
+static bool SettleResponse(uint16_t Param);
+static void FallBack(void);
+static void StartRevert(uint8_t BaudCode);
+static void NextRevert(void);
+static void FinishAt9600(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static XBeeLinkState_t CurrentState;
+
+static uint8_t MyPriority;
+
+// frame IDs of the AT commands we are still waiting to hear about
+static uint8_t PendingIDs[MAX_PENDING_AT];
+static uint8_t NumPending;
+
+static uint8_t LinkBD;       // BD code UART5 is running at
+static bool ACSent;          // the radio may have changed rate
+static uint8_t RevertTries;  // rates BD=9600 has been sent at
+static bool RevertAccepted;  // the radio said OK to it, waiting for it to switch
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     InitXBeeLink
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority and posts the initial transition. Must come
+     after Receive_SM in the service list, it needs the UART set up.
+****************************************************************************/
+bool InitXBeeLink ( uint8_t Priority )
+{
+	ES_Event ThisEvent;
+
+	MyPriority = Priority;
+	CurrentState = LinkConfiguring;
+	NumPending = 0;
+	LinkBD = XBEE_BD_9600;
+	ACSent = false;
+
+	ThisEvent.EventType = ES_INIT;
+	return ES_PostToService( MyPriority, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+     PostXBeeLink
+
+ Parameters
+     EF_Event ThisEvent , the event to post to the queue
+
+ Returns
+     boolean False if the Enqueue operation failed, True otherwise
+
+ Description
+     Posts an event to this state machine's queue
+****************************************************************************/
+bool PostXBeeLink( ES_Event ThisEvent )
+{
+	return ES_PostToService( MyPriority, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunXBeeLink
+
+ Parameters
+   ES_Event : the event to process
+
+ Returns
+   ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
+
+ Description
+   Steps through the rate change described at the top of the file
+****************************************************************************/
+ES_Event RunXBeeLink( ES_Event ThisEvent )
+{
+	ES_Event ReturnEvent;
+	ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
+
+	switch ( CurrentState )
+	{
+		case LinkConfiguring:
+			if ( ThisEvent.EventType == ES_INIT ) {
+				uint8_t APValue = API_MODE_NO_ESCAPES;
+				uint8_t BDValue = LINK_TARGET_BD;
+#ifdef UART_RX_FLOW
+				uint8_t D6Value = XBEE_D6_RTS;
+#endif
+
+				// all of them go out back to back, the XBee answers each in turn
+				if (!SendATCommand(API_IDENTIFIER_AT_Queue, 'A', 'P', &APValue, 1) ||
+#ifdef UART_RX_FLOW
+						!SendATCommand(API_IDENTIFIER_AT_Queue, 'D', '6', &D6Value, 1) ||
+#endif
+						!SendATCommand(API_IDENTIFIER_AT_Queue, 'B', 'D', &BDValue, 1) ||
+						!SendATCommand(API_IDENTIFIER_AT, 'A', 'C', NULL, 0)) {
+					FallBack();
+					break;
+				}
+				ACSent = true;
+				ES_Timer_InitTimer(LINK_TIMER, LINK_RESPONSE_TIME);
+			}
+
+			if ( ThisEvent.EventType == ES_AT_RESPONSE ) {
+				if (!SettleResponse(ThisEvent.EventParam)) {
+					FallBack();
+				} else if (NumPending == 0) {
+					// the XBee is changing rate, give it a moment before we follow
+					ES_Timer_InitTimer(LINK_TIMER, LINK_SETTLE_TIME);
+					CurrentState = LinkSwitching;
+				}
+			}
+
+			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LINK_TIMER ) {
+				FallBack();
+			}
+		break;
+
+		case LinkSwitching:
+			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LINK_TIMER ) {
+				UART_SetBaudCode(LINK_TARGET_BD);
+				LinkBD = LINK_TARGET_BD;
+
+				// ask for BD back to make sure we're both on the same rate
+				if (!SendATCommand(API_IDENTIFIER_AT, 'B', 'D', NULL, 0)) {
+					FallBack();
+					break;
+				}
+				ES_Timer_InitTimer(LINK_TIMER, LINK_RESPONSE_TIME);
+				CurrentState = LinkVerifying;
+			}
+		break;
+
+		case LinkVerifying:
+			if ( ThisEvent.EventType == ES_AT_RESPONSE ) {
+				if (!SettleResponse(ThisEvent.EventParam)) {
+					FallBack();
+				} else if (NumPending == 0) {
+					ES_Timer_StopTimer(LINK_TIMER);
+					printf("XBee link up at %lu baud\r\n", (unsigned long)UART_GetBaud());
+					CurrentState = LinkReady;
+				}
+			}
+
+			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LINK_TIMER ) {
+				FallBack();
+			}
+		break;
+
+		case LinkReverting:
+			// anything once nothing is pending is left over from before
+			if ( ThisEvent.EventType == ES_AT_RESPONSE && NumPending != 0 ) {
+				if (!SettleResponse(ThisEvent.EventParam)) {
+					NextRevert();
+				} else if (NumPending == 0) {
+					// it heard us, give it a moment to switch before we follow
+					RevertAccepted = true;
+					ES_Timer_InitTimer(LINK_TIMER, LINK_SETTLE_TIME);
+				}
+			}
+
+			if ( ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == LINK_TIMER ) {
+				if (RevertAccepted) {
+					FinishAt9600();
+				} else {
+					NextRevert();
+				}
+			}
+		break;
+
+		case LinkReady:
+			// late responses from a failed attempt end up here and are ignored
+		break;
+
+		default :
+			;
+	}                                   // end switch on Current State
+	return ReturnEvent;
+}
+
+/****************************************************************************
+ Function
+    XBeeLink_IsReady
+
+ Returns
+   bool, true once the link rate has been settled one way or the other
+****************************************************************************/
+bool XBeeLink_IsReady(void) {
+	return CurrentState == LinkReady;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Builds an AT command frame in a TxQueue buffer and kicks Transmit_SM.
+// Returns false if there was no buffer for it.
+static bool SendATCommand(uint8_t APIIdent, char Cmd0, char Cmd1, uint8_t *Param, uint8_t ParamLength) {
+	uint8_t FrameID;
+	uint8_t *Frame = TxQueue_Acquire(TX_LANE_PAIRING, NO_PEER, &FrameID);
+	uint8_t RunningSum = 0;
+	uint8_t Index = HEADER_LENGTH;
+	uint8_t i;
+	ES_Event NewEvent;
+
+	if ((Frame == NULL) || (NumPending == MAX_PENDING_AT)) {
+		TxQueue_Abandon();
+		return false;
+	}
+
+	Frame[START_BYTE_INDEX] = START_DELIMITER;
+	Frame[LENGTH_MSB_BYTE_INDEX] = 0x00;
+	Frame[LENGTH_LSB_BYTE_INDEX] = AT_HEADER_LENGTH + ParamLength;
+	Frame[Index++] = APIIdent;
+	Frame[Index++] = FrameID;
+	Frame[Index++] = Cmd0;
+	Frame[Index++] = Cmd1;
+	for (i = 0; i < ParamLength; i++) {
+		Frame[Index++] = Param[i];
+	}
+	for (i = HEADER_LENGTH; i < Index; i++) {
+		RunningSum += Frame[i];
+	}
+	Frame[Index] = 0xFF - RunningSum;
+	TxQueue_Commit(AT_HEADER_LENGTH + ParamLength);
+
+	PendingIDs[NumPending++] = FrameID;
+
+	NewEvent.EventType = ES_START_XMIT;
+	PostTransmit_SM(NewEvent);
+	return true;
+}
+
+// Crosses off the AT command an ES_AT_RESPONSE is for. Returns false if it
+// reported an error. Responses we aren't waiting for are let through.
+static bool SettleResponse(uint16_t Param) {
+	uint8_t FrameID = Param >> 8;
+	uint8_t i;
+
+	for (i = 0; i < NumPending; i++) {
+		if (PendingIDs[i] == FrameID) {
+			PendingIDs[i] = PendingIDs[--NumPending];
+			return (Param & 0xFF) == AT_STATUS_OK;
+		}
+	}
+	return true;
+}
+
+// Gives up on the faster rate. If AC went out the radio has to be talked
+// back down first, at whatever rate it is on now
+static void FallBack(void) {
+	ES_Timer_StopTimer(LINK_TIMER);
+	NumPending = 0;
+	if (ACSent) {
+		RevertTries = 0;
+		StartRevert(LinkBD);
+	} else {
+		FinishAt9600();
+	}
+}
+
+// Sends BD=9600 and AC at the given rate
+static void StartRevert(uint8_t BaudCode) {
+	uint8_t BDValue = XBEE_BD_9600;
+
+	CurrentState = LinkReverting;
+	RevertAccepted = false;
+	RevertTries++;
+	NumPending = 0;
+	UART_SetBaudCode(BaudCode);
+	LinkBD = BaudCode;
+	if (!SendATCommand(API_IDENTIFIER_AT_Queue, 'B', 'D', &BDValue, 1) ||
+			!SendATCommand(API_IDENTIFIER_AT, 'A', 'C', NULL, 0)) {
+		// no buffer, move on as if it went unanswered
+		NumPending = 0;
+		ES_Timer_InitTimer(LINK_TIMER, 1);
+		return;
+	}
+	ES_Timer_InitTimer(LINK_TIMER, LINK_RESPONSE_TIME);
+}
+
+// BD=9600 failed at one rate, try the other one if it hasn't been yet
+static void NextRevert(void) {
+	if (RevertTries >= 2) {
+		FinishAt9600();
+	} else {
+		StartRevert((LinkBD == XBEE_BD_9600) ? LINK_TARGET_BD : XBEE_BD_9600);
+	}
+}
+
+// Carries on at 9600
+static void FinishAt9600(void) {
+	ES_Timer_StopTimer(LINK_TIMER);
+	NumPending = 0;
+	UART_SetBaudCode(XBEE_BD_9600);
+	LinkBD = XBEE_BD_9600;
+	if (ACSent && !RevertAccepted) {
+		printf("XBee did not answer BD=9600, its rate is unknown\r\n");
+	}
+	printf("XBee link fell back to 9600 baud\r\n");
+	CurrentState = LinkReady;
+}
@@ -0,0 +1,609 @@
+/****************************************************************************
+ Module
+   XBeeParser.c
+
+ Description
+   Streaming parser for XBee API frames. Bytes are fed in one at a time as
+   they come off the UART, the length is checked as soon as it arrives and
+   the checksum is checked over the whole frame data (a word at a time, by
+   PacketKernel_Sum) when it comes in, so a frame is known to be good (or
+   bad) the moment its last byte is parsed.
+
+   Every byte from the current frame's start delimiter on is also kept in
+   a small ring. When a frame turns out to be bad, the parser does not
+   throw those bytes away and wait for the next 0x7E off the line: it
+   rewinds to the byte after the bad delimiter and parses the ring again,
+   so a real frame that started inside the bad one is picked up at once.
+   A gap on the line (XBee_ParserGap) is handled the same way: no frame can
+   run across it, so the frame in progress is bad and the ring is rescanned
+   up to the gap for one that started inside it.
+
+   XBee_RunParseBench (host builds only) times the parser on its own over a
+   recorded byte stream, or one XBee_BuildBenchStream lays down with the
+   mix of frames a FARMER sees. XBee_RunRecoveryBench damages frames and
+   leaves gaps between them, and counts what gets through.
+
+ Notes
+   Has no hardware or framework dependencies so that it can be run from
+   the UART interrupt on the target or from a test program on a PC. All of
+   the state lives in the XBeeParser_t that is passed in.
+
+ History
+ When           Who     What/Why
+ -------------- ---     --------
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "XBeeParser.h"
+#include "PacketKernel.h"
+
+#ifdef ES_HOST_BUILD
+#include <string.h>
+#include <time.h>
+
+#include "PeerTable.h"
+#endif
+
+/*----------------------------- Module Defines ----------------------------*/
+#ifdef ES_HOST_BUILD
+#define BENCH_RX_SOURCE     0x2180  // DOG the recorded traffic comes from
+#define BENCH_WINDOW        16      // frames sent that can still come out
+#define BENCH_SEQ_INDEX     (PACKET_TYPE_BYTE_INDEX_RX + 1)
+#endif
+
+/*---------------------------- Module Functions ---------------------------*/
+static XBeeResult_t ParsePending(XBeeParser_t *pParser);
+static void DropFrame(XBeeParser_t *pParser);
+#ifdef ES_HOST_BUILD
+static uint8_t PutBenchFrame(uint8_t *pOut, const uint8_t *pData, uint8_t Length);
+static uint8_t BuildSeqFrame(uint8_t *pOut, uint32_t Seq);
+static void FeedRecovery(uint8_t Byte, bool GapBefore);
+static void CheckRecovered(void);
+static uint32_t Random(void);
+#endif
+
+/*---------------------------- Module Variables ---------------------------*/
+#ifdef ES_HOST_BUILD
+static uint32_t RandomState;
+
+// XBee_RunRecoveryBench state
+static XBeeParser_t RecoveryParser;
+static XBeeRecoveryBenchResult_t *pRecovery;
+static bool RecoveryResets;
+static uint32_t RecoverySeq;           // frames sent so far
+static bool SeqClean[BENCH_WINDOW];
+static bool SeqDelivered[BENCH_WINDOW];
+#endif
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     XBee_ParserInit
+
+ Parameters
+     XBeeParser_t * : the parser to set up
+
+ Returns
+     none
+
+ Description
+     Puts the parser in Wait4Start and clears its frame counters
+****************************************************************************/
+void XBee_ParserInit(XBeeParser_t *pParser) {
+	pParser->GoodFrames = 0;
+	pParser->BadFrames = 0;
+	pParser->RecoveredFrames = 0;
+	pParser->Tail = 0;
+	XBee_ParserReset(pParser);
+}
+
+/****************************************************************************
+ Function
+     XBee_ParserReset
+
+ Parameters
+     XBeeParser_t * : the parser to reset
+
+ Returns
+     none
+
+ Description
+     Abandons any frame in progress, along with the bytes kept for it, and
+     goes back to hunting for a start delimiter. XBee_ParserGap is the one
+     to use when the line has gone quiet, this throws away any frame that
+     started inside the one in progress.
+****************************************************************************/
+void XBee_ParserReset(XBeeParser_t *pParser) {
+	pParser->State = Wait4Start;
+	pParser->FrameLength = 0;
+	pParser->BytesLeft = 0;
+	pParser->Head = pParser->Tail;
+	pParser->Next = pParser->Tail;
+	pParser->RescanLeft = 0;
+	pParser->StartRescanned = false;
+	pParser->GapPending = false;
+}
+
+/****************************************************************************
+ Function
+     XBee_ParserGap
+
+ Parameters
+     XBeeParser_t * : the parser
+
+ Returns
+     none
+
+ Description
+     Tells the parser the line went quiet before the next byte, partway
+     through a frame. The frame in progress can't be finished across the
+     gap, so it is dropped as bad and the bytes after its delimiter are
+     rescanned, but nothing found there may run across the gap either.
+     The work is done as the next byte is parsed.
+****************************************************************************/
+void XBee_ParserGap(XBeeParser_t *pParser) {
+	pParser->GapAt = pParser->Tail;
+	pParser->GapPending = true;
+}
+
+/****************************************************************************
+ Function
+     XBee_ParseByte
+
+ Parameters
+     XBeeParser_t * : the parser
+     uint8_t : the next byte off the line
+
+ Returns
+     XBEE_FRAME_GOOD when a frame with a good checksum was completed, the
+     frame data is then in pParser->Frame[0..FrameLength-1] until the next
+     call. XBEE_FRAME_BAD when a frame was dropped for an impossible length
+     or a bad checksum and nothing good turned up rescanning its bytes.
+     XBEE_IN_PROGRESS otherwise.
+
+ Description
+     After XBEE_FRAME_GOOD, call XBee_ParseMore until it stops returning
+     XBEE_FRAME_GOOD: a rescan can turn up more than one frame at a time.
+****************************************************************************/
+XBeeResult_t XBee_ParseByte(XBeeParser_t *pParser, uint8_t Byte) {
+	// only happens if XBee_ParseMore isn't being called, make room
+	if ((uint8_t)(pParser->Tail - pParser->Head) >= XBEE_RING_SIZE) {
+		XBee_ParserReset(pParser);
+	}
+	pParser->Ring[pParser->Tail & XBEE_RING_MASK] = Byte;
+	pParser->Tail++;
+	return ParsePending(pParser);
+}
+
+/****************************************************************************
+ Function
+     XBee_ParseMore
+
+ Parameters
+     XBeeParser_t * : the parser
+
+ Returns
+     same as XBee_ParseByte
+
+ Description
+     Carries on parsing bytes left over in the ring after a rescan found a
+     good frame in the middle of them.
+****************************************************************************/
+XBeeResult_t XBee_ParseMore(XBeeParser_t *pParser) {
+	return ParsePending(pParser);
+}
+
+#ifdef ES_HOST_BUILD
+/****************************************************************************
+ Function
+     XBee_BuildBenchStream
+
+ Parameters
+     uint8_t * : where to lay the stream down
+     uint32_t : room there
+     uint32_t : seed for the frame mix and contents
+
+ Returns
+     uint32_t : bytes written, whole frames only
+
+ Description
+     Lays down what the XBee sends a FARMER in play: mostly DOG reports,
+     a transmit status for each frame we send, and now and then a DOG ACK,
+     a reset request or an AT response. Every frame is good, with 0x7E
+     turning up inside them as often as it would in real data.
+****************************************************************************/
+uint32_t XBee_BuildBenchStream(uint8_t *pStream, uint32_t MaxLength, uint32_t Seed) {
+	uint8_t Data[MAX_FRAME_LENGTH];
+	uint32_t Length = 0;
+	uint8_t DataLength;
+	uint8_t i;
+
+	RandomState = (Seed != 0) ? Seed : 1;
+	while (Length + HEADER_LENGTH + MAX_FRAME_LENGTH + 1 <= MaxLength) {
+		uint8_t Pick = Random() % 16;
+
+		if (Pick < 8) {
+			// DOG report: RX header, type, IMU data
+			Data[0] = API_IDENTIFIER_Rx;
+			Data[SOURCE_ADDRESS_MSB_INDEX] = BENCH_RX_SOURCE >> 8;
+			Data[SOURCE_ADDRESS_LSB_INDEX] = BENCH_RX_SOURCE & 0xFF;
+			Data[RSSI_BYTE_INDEX] = 40 + Random() % 30;
+			Data[RSSI_BYTE_INDEX + 1] = 0;
+			Data[PACKET_TYPE_BYTE_INDEX_RX] = DOG_FARMER_REPORT;
+			for (i = 0; i < IMU_DATA_LENGTH; i++) {
+				Data[PACKET_TYPE_BYTE_INDEX_RX + 1 + i] = ((Random() & 15) == 0) ? START_DELIMITER : Random();
+			}
+			DataLength = PACKET_TYPE_BYTE_INDEX_RX + 1 + IMU_DATA_LENGTH;
+		} else if (Pick < 14) {
+			// transmit status for one of ours
+			Data[0] = API_IDENTIFIER_Tx_Result;
+			Data[1] = 1 + Random() % 255;
+			Data[2] = ((Random() & 7) == 0) ? 1 : SUCCESS;
+			DataLength = 3;
+		} else if (Pick == 14) {
+			// ACK or reset request, type byte only
+			Data[0] = API_IDENTIFIER_Rx;
+			Data[SOURCE_ADDRESS_MSB_INDEX] = BENCH_RX_SOURCE >> 8;
+			Data[SOURCE_ADDRESS_LSB_INDEX] = BENCH_RX_SOURCE & 0xFF;
+			Data[RSSI_BYTE_INDEX] = 40 + Random() % 30;
+			Data[RSSI_BYTE_INDEX + 1] = 0;
+			Data[PACKET_TYPE_BYTE_INDEX_RX] = (Random() & 1) ? DOG_ACK : DOG_FARMER_RESET_ENCR;
+			DataLength = PACKET_TYPE_BYTE_INDEX_RX + 1;
+		} else {
+			// AT response, OK
+			Data[0] = API_IDENTIFIER_AT_Response;
+			Data[1] = 1 + Random() % 255;
+			Data[2] = 'B';
+			Data[3] = 'D';
+			Data[AT_STATUS_BYTE_INDEX] = 0;
+			DataLength = AT_STATUS_BYTE_INDEX + 1;
+		}
+		Length += PutBenchFrame(&pStream[Length], Data, DataLength);
+	}
+	return Length;
+}
+
+/****************************************************************************
+ Function
+     XBee_RunParseBench
+
+ Parameters
+     const uint8_t * : recorded bytes off the UART
+     uint32_t : how many
+     uint32_t : times to parse them
+     XBeeParseBenchResult_t * : filled in
+
+ Description
+     Feeds the stream through XBee_ParseByte and XBee_ParseMore, the way
+     ProcessReceivedByte does but with nothing done with the frames, and
+     times it. One untimed pass first counts the frames, since the
+     parser's own counters are only 16 bits.
+****************************************************************************/
+void XBee_RunParseBench(const uint8_t *pStream, uint32_t Length, uint32_t Passes,
+	XBeeParseBenchResult_t *pResult) {
+	static XBeeParser_t BenchParser;
+	clock_t Start;
+	double Ns;
+	uint32_t Pass;
+	uint32_t n;
+
+	memset(pResult, 0, sizeof(*pResult));
+	if ((Length == 0) || (Passes == 0)) {
+		return;
+	}
+	XBee_ParserInit(&BenchParser);
+	for (n = 0; n < Length; n++) {
+		XBeeResult_t Result = XBee_ParseByte(&BenchParser, pStream[n]);
+
+		while (Result == XBEE_FRAME_GOOD) {
+			pResult->GoodFrames++;
+			Result = XBee_ParseMore(&BenchParser);
+		}
+		if (Result == XBEE_FRAME_BAD) {
+			pResult->BadFrames++;
+		}
+	}
+
+	XBee_ParserInit(&BenchParser);
+	Start = clock();
+	for (Pass = 0; Pass < Passes; Pass++) {
+		for (n = 0; n < Length; n++) {
+			if (XBee_ParseByte(&BenchParser, pStream[n]) == XBEE_FRAME_GOOD) {
+				while (XBee_ParseMore(&BenchParser) == XBEE_FRAME_GOOD)
+					;
+			}
+		}
+	}
+	Ns = 1e9 * (double)(clock() - Start) / CLOCKS_PER_SEC;
+
+	pResult->Bytes = Length;
+	pResult->NsPerByte = Ns / ((double)Length * Passes);
+	if (pResult->GoodFrames != 0) {
+		pResult->NsPerFrame = Ns / ((double)pResult->GoodFrames * Passes);
+	}
+	pResult->BytesPerSec = (Ns > 0) ? 1e9 * (double)Length * Passes / Ns : 0;
+}
+
+/****************************************************************************
+ Function
+     XBee_RunRecoveryBench
+
+ Parameters
+     uint32_t : frames to send
+     uint8_t : chance in 256 that a frame is damaged
+     uint32_t : seed for the damage, gaps and frame contents
+     bool : true to call XBee_ParserReset on a gap instead of XBee_ParserGap
+     XBeeRecoveryBenchResult_t * : filled in
+
+ Description
+     Sends numbered DOG reports through the parser the way
+     ProcessReceivedByte does, with the line going quiet after half of
+     them. A damaged frame gets one of: a flipped byte, a length too long
+     for it (it swallows the frames after it), cut short with the line
+     going quiet after, or a false start with a plausible length in front
+     of it (the frame itself is fine). Counts the undamaged frames that
+     came out and those that didn't.
+****************************************************************************/
+void XBee_RunRecoveryBench(uint32_t Frames, uint8_t DamagePer256, uint32_t Seed, bool ResetOnGap,
+	XBeeRecoveryBenchResult_t *pResult) {
+	uint8_t Frame[HEADER_LENGTH + MAX_FRAME_LENGTH + 1];
+	bool Gap = false;
+	uint32_t n;
+	uint8_t i;
+
+	memset(pResult, 0, sizeof(*pResult));
+	memset(SeqClean, 0, sizeof(SeqClean));
+	memset(SeqDelivered, 0, sizeof(SeqDelivered));
+	pRecovery = pResult;
+	RecoveryResets = ResetOnGap;
+	RecoverySeq = 0;
+	RandomState = (Seed != 0) ? Seed : 1;
+	XBee_ParserInit(&RecoveryParser);
+
+	for (n = 0; n < Frames; n++) {
+		uint8_t Slot = n % BENCH_WINDOW;
+		uint8_t Size = BuildSeqFrame(Frame, n);
+		bool Damaged = false;
+
+		// the frame this one pushes out of the window is gone for good
+		if ((n >= BENCH_WINDOW) && SeqClean[Slot] && !SeqDelivered[Slot]) {
+			pResult->Lost++;
+		}
+
+		if ((Random() & 0xFF) < DamagePer256) {
+			switch (Random() % 4) {
+				case 0: // flip a byte after the delimiter
+					Frame[1 + Random() % (Size - 1)] ^= 1 + (Random() % 0xFF);
+					Damaged = true;
+					break;
+				case 1: // too long, runs on into what comes next
+					Frame[LENGTH_LSB_BYTE_INDEX] = MAX_FRAME_LENGTH;
+					Damaged = true;
+					break;
+				case 2: // cut short, the rest never comes
+					Size = 1 + Random() % (Size - 1);
+					Damaged = true;
+					break;
+				default: // false start in front, the frame itself is fine
+					FeedRecovery(START_DELIMITER, Gap);
+					FeedRecovery(0, false);
+					FeedRecovery(Size + Random() % (MAX_FRAME_LENGTH - Size + 1), false);
+					Gap = false;
+					break;
+			}
+		}
+		SeqClean[Slot] = !Damaged;
+		SeqDelivered[Slot] = false;
+		RecoverySeq = n + 1;
+		if (Damaged) {
+			pResult->FramesDamaged++;
+		}
+		pResult->FramesSent++;
+
+		for (i = 0; i < Size; i++) {
+			FeedRecovery(Frame[i], Gap && (i == 0));
+		}
+		Gap = (Random() & 1) || (Size < HEADER_LENGTH + Frame[LENGTH_LSB_BYTE_INDEX] + 1);
+	}
+
+	// the line goes quiet at the end too
+	if (RecoveryParser.State != Wait4Start) {
+		pResult->Gaps++;
+		if (ResetOnGap) {
+			XBee_ParserReset(&RecoveryParser);
+		} else {
+			XBee_ParserGap(&RecoveryParser);
+			while (XBee_ParseMore(&RecoveryParser) == XBEE_FRAME_GOOD) {
+				CheckRecovered();
+			}
+		}
+	}
+	for (n = 0; (n < BENCH_WINDOW) && (n < Frames); n++) {
+		if (SeqClean[n] && !SeqDelivered[n]) {
+			pResult->Lost++;
+		}
+	}
+	pResult->Recovered = RecoveryParser.RecoveredFrames;
+}
+#endif
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+
+// Runs the bytes from Next up to Tail through the frame state machine,
+// stopping early at the end of a good frame.
+static XBeeResult_t ParsePending(XBeeParser_t *pParser) {
+	XBeeResult_t Result = XBEE_IN_PROGRESS;
+	uint8_t Stop;
+	bool Bad;
+
+	do {
+		// a frame still open where the line went quiet is never finished
+		if (pParser->GapPending && (pParser->Next == pParser->GapAt)) {
+			if (pParser->State != Wait4Start) {
+				DropFrame(pParser);
+				Result = XBEE_FRAME_BAD;
+			} else {
+				pParser->GapPending = false;
+			}
+		}
+
+		// parse up to the gap, if there is one, and stop there to check
+		Stop = pParser->GapPending ? pParser->GapAt : pParser->Tail;
+		while (pParser->Next != Stop) {
+			uint8_t Byte = pParser->Ring[pParser->Next & XBEE_RING_MASK];
+			bool Rescanned = (pParser->RescanLeft != 0);
+
+			pParser->Next++;
+			if (Rescanned) {
+				pParser->RescanLeft--;
+			}
+			Bad = false;
+
+			switch (pParser->State) {
+				case Wait4Start:
+					// waiting to receive 0x7E, everything else is noise
+					if (Byte == START_DELIMITER) {
+						pParser->Head = pParser->Next - 1;
+						pParser->StartRescanned = Rescanned;
+						pParser->State = Wait4MSBLength;
+					} else {
+						pParser->Head = pParser->Next;
+					}
+					break;
+
+				case Wait4MSBLength:
+					// none of our frames come close to 256 bytes
+					if (Byte != 0) {
+						Bad = true;
+						break;
+					}
+					pParser->State = Wait4LSBLength;
+					break;
+
+				case Wait4LSBLength:
+					// reject lengths that would not fit in the frame buffer now,
+					// rather than finding out when it overflows
+					if ((Byte == 0) || (Byte > MAX_FRAME_LENGTH)) {
+						Bad = true;
+						break;
+					}
+					pParser->FrameLength = Byte;
+					pParser->BytesLeft = Byte;
+					pParser->State = ReceivingData;
+					break;
+
+				case ReceivingData:
+					// if BytesLeft = 0, then we just received the checksum
+					if (pParser->BytesLeft == 0) {
+						if ((uint8_t)(PacketKernel_Sum(pParser->Frame, pParser->FrameLength) + Byte) != 0xFF) {
+							Bad = true;
+							break;
+						}
+						pParser->State = Wait4Start;
+						pParser->Head = pParser->Next;
+						pParser->GoodFrames++;
+						if (pParser->StartRescanned) {
+							pParser->RecoveredFrames++;
+						}
+						return XBEE_FRAME_GOOD;
+					}
+					// else we're still receiving data bytes
+					pParser->Frame[pParser->FrameLength - pParser->BytesLeft] = Byte;
+					pParser->BytesLeft--;
+					break;
+			}
+
+			if (Bad) {
+				DropFrame(pParser);
+				Result = XBEE_FRAME_BAD;
+			}
+		}
+	} while (pParser->GapPending);
+	return Result;
+}
+
+// The delimiter at Head wasn't the start of a frame after all, go back and
+// look again starting from the byte after it. Bytes past a gap haven't
+// been parsed yet, so they aren't a rescan.
+static void DropFrame(XBeeParser_t *pParser) {
+	pParser->BadFrames++;
+	pParser->State = Wait4Start;
+	pParser->Next = pParser->Head + 1;
+	pParser->Head = pParser->Next;
+	pParser->RescanLeft = (pParser->GapPending ? pParser->GapAt : pParser->Tail) - pParser->Next;
+}
+
+#ifdef ES_HOST_BUILD
+// Wraps frame data in a delimiter, length and checksum, returns the size
+static uint8_t PutBenchFrame(uint8_t *pOut, const uint8_t *pData, uint8_t Length) {
+	pOut[START_BYTE_INDEX] = START_DELIMITER;
+	pOut[LENGTH_MSB_BYTE_INDEX] = 0;
+	pOut[LENGTH_LSB_BYTE_INDEX] = Length;
+	memcpy(&pOut[HEADER_LENGTH], pData, Length);
+	pOut[HEADER_LENGTH + Length] = 0xFF - PacketKernel_Sum(pData, Length);
+	return HEADER_LENGTH + Length + 1;
+}
+
+// A DOG report carrying Seq in its first four data bytes, returns the size
+static uint8_t BuildSeqFrame(uint8_t *pOut, uint32_t Seq) {
+	uint8_t Data[PACKET_TYPE_BYTE_INDEX_RX + 1 + IMU_DATA_LENGTH];
+	uint8_t i;
+
+	Data[0] = API_IDENTIFIER_Rx;
+	Data[SOURCE_ADDRESS_MSB_INDEX] = BENCH_RX_SOURCE >> 8;
+	Data[SOURCE_ADDRESS_LSB_INDEX] = BENCH_RX_SOURCE & 0xFF;
+	Data[RSSI_BYTE_INDEX] = 40 + Random() % 30;
+	Data[RSSI_BYTE_INDEX + 1] = 0;
+	Data[PACKET_TYPE_BYTE_INDEX_RX] = DOG_FARMER_REPORT;
+	memcpy(&Data[BENCH_SEQ_INDEX], &Seq, sizeof(Seq));
+	for (i = BENCH_SEQ_INDEX + sizeof(Seq); i < sizeof(Data); i++) {
+		Data[i] = ((Random() & 7) == 0) ? START_DELIMITER : Random();
+	}
+	return PutBenchFrame(pOut, Data, sizeof(Data));
+}
+
+// One byte off the line, as ProcessReceivedByte takes it
+static void FeedRecovery(uint8_t Byte, bool GapBefore) {
+	if (GapBefore && (RecoveryParser.State != Wait4Start)) {
+		pRecovery->Gaps++;
+		if (RecoveryResets) {
+			XBee_ParserReset(&RecoveryParser);
+		} else {
+			XBee_ParserGap(&RecoveryParser);
+		}
+	}
+	if (XBee_ParseByte(&RecoveryParser, Byte) == XBEE_FRAME_GOOD) {
+		do {
+			CheckRecovered();
+		} while (XBee_ParseMore(&RecoveryParser) == XBEE_FRAME_GOOD);
+	}
+}
+
+// Matches the frame the parser just finished against the ones sent
+static void CheckRecovered(void) {
+	uint32_t Seq;
+	uint8_t Slot;
+
+	if (RecoveryParser.FrameLength != PACKET_TYPE_BYTE_INDEX_RX + 1 + IMU_DATA_LENGTH) {
+		pRecovery->FalseAccepts++;
+		return;
+	}
+	memcpy(&Seq, &RecoveryParser.Frame[BENCH_SEQ_INDEX], sizeof(Seq));
+	Slot = Seq % BENCH_WINDOW;
+	if ((Seq >= RecoverySeq) || (RecoverySeq - Seq > BENCH_WINDOW) || !SeqClean[Slot] || SeqDelivered[Slot]) {
+		pRecovery->FalseAccepts++;
+		return;
+	}
+	SeqDelivered[Slot] = true;
+	pRecovery->Delivered++;
+}
+
+// xorshift32
+static uint32_t Random(void) {
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return RandomState;
+}
+#endif